@@ -0,0 +1,236 @@
+/*
+ * apex_bintrace.c
+ * Contains the binary pipeline trace writer
+ *
+ * The simulator thread is the only producer and the writer thread the only
+ * consumer of a ring of records, so the ring needs no lock: the producer
+ * owns head, the consumer owns tail, and each publishes its index with a
+ * release store that the other side reads with an acquire load. When the
+ * ring is full the producer waits for the writer instead of dropping
+ * records.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "apex_bintrace.h"
+#include "apex_macros.h"
+
+#define CACHE_LINE 64
+
+struct APEX_Bintrace
+{
+    APEX_Bintrace_Record *ring;
+    uint32_t mask;                 /* Ring size - 1 */
+    int pipes;                     /* Pipes recorded per cycle */
+    FILE *fp;
+    pthread_t writer;
+    int write_error;               /* Only touched by the writer */
+
+    /* Producer and consumer indices on separate cache lines */
+    _Alignas(CACHE_LINE) atomic_size_t head;
+    _Alignas(CACHE_LINE) atomic_size_t tail;
+    _Alignas(CACHE_LINE) atomic_int closing;
+};
+
+/* Writes [tail, head) to the file, in at most two pieces */
+static void
+write_records(APEX_Bintrace *trace, size_t tail, size_t head)
+{
+    while (tail != head)
+    {
+        size_t index = tail & trace->mask;
+        size_t count = head - tail;
+
+        if (count > trace->mask + 1 - index)
+        {
+            count = trace->mask + 1 - index;
+        }
+        if (fwrite(&trace->ring[index], sizeof(APEX_Bintrace_Record), count,
+                   trace->fp) != count)
+        {
+            trace->write_error = TRUE;
+        }
+        tail += count;
+    }
+}
+
+static void *
+writer_main(void *arg)
+{
+    APEX_Bintrace *trace = arg;
+    size_t tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+
+    while (TRUE)
+    {
+        size_t head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+        if (head == tail)
+        {
+            struct timespec pause = { 0, 100000 };
+
+            /* closing is set after the last record was published */
+            if (atomic_load_explicit(&trace->closing, memory_order_acquire)
+                && atomic_load_explicit(&trace->head, memory_order_acquire) == tail)
+            {
+                break;
+            }
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        write_records(trace, tail, head);
+        tail = head;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+/*
+ * Creates filename and starts the writer thread. ring_records is clamped to
+ * APEX_BINTRACE_MIN_RING_RECORDS..APEX_BINTRACE_MAX_RING_RECORDS and rounded
+ * up to a power of two, 0 selects APEX_BINTRACE_RING_RECORDS. pipes is 2 to
+ * record the V pipe as well. Returns NULL on error.
+ */
+APEX_Bintrace *
+APEX_bintrace_open(const char *filename, uint32_t ring_records, int pipes)
+{
+    APEX_Bintrace_Header header;
+    APEX_Bintrace *trace;
+    uint32_t size = 1;
+
+    if (pipes < 1 || pipes > APEX_BINTRACE_MAX_PIPES)
+    {
+        return NULL;
+    }
+
+    if (!ring_records)
+    {
+        ring_records = APEX_BINTRACE_RING_RECORDS;
+    }
+    else if (ring_records < APEX_BINTRACE_MIN_RING_RECORDS)
+    {
+        ring_records = APEX_BINTRACE_MIN_RING_RECORDS;
+    }
+    else if (ring_records > APEX_BINTRACE_MAX_RING_RECORDS)
+    {
+        ring_records = APEX_BINTRACE_MAX_RING_RECORDS;
+    }
+    while (size < ring_records)
+    {
+        size <<= 1;
+    }
+
+    trace = aligned_alloc(CACHE_LINE, (sizeof(*trace) + CACHE_LINE - 1)
+                                          / CACHE_LINE * CACHE_LINE);
+    if (!trace)
+    {
+        return NULL;
+    }
+    memset(trace, 0, sizeof(*trace));
+    trace->mask = size - 1;
+    trace->pipes = pipes;
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->closing, FALSE);
+
+    trace->ring = malloc(sizeof(APEX_Bintrace_Record) * size);
+    trace->fp = fopen(filename, "wb");
+    if (!trace->ring || !trace->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create trace %s\n", filename);
+        if (trace->fp)
+        {
+            fclose(trace->fp);
+        }
+        free(trace->ring);
+        free(trace);
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, APEX_BINTRACE_MAGIC, sizeof(header.magic));
+    header.version = APEX_BINTRACE_VERSION;
+    header.record_size = sizeof(APEX_Bintrace_Record);
+    header.pipes = pipes;
+    if (fwrite(&header, sizeof(header), 1, trace->fp) != 1)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write the trace\n");
+        fclose(trace->fp);
+        free(trace->ring);
+        free(trace);
+        return NULL;
+    }
+
+    if (pthread_create(&trace->writer, NULL, writer_main, trace) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to start the trace writer\n");
+        fclose(trace->fp);
+        free(trace->ring);
+        free(trace);
+        return NULL;
+    }
+
+    return trace;
+}
+
+/* Records the display state of the five stages of each pipe after a cycle */
+void
+APEX_bintrace_cycle(APEX_Bintrace *trace, const APEX_CPU *cpu)
+{
+    size_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    int count = 5 * trace->pipes;
+    int i;
+
+    /* Wait until the writer made room for the whole cycle */
+    while (head + count - atomic_load_explicit(&trace->tail, memory_order_acquire)
+           > (size_t)trace->mask + 1)
+    {
+        sched_yield();
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        const CPU_Stage *stage = (i < 5) ? &cpu->outputDisplay[i]
+                                         : &cpu->outputDisplay_v[i - 5];
+        APEX_Bintrace_Record *record = &trace->ring[(head + i) & trace->mask];
+
+        record->cycle = (uint32_t)cpu->clock;
+        record->pc = stage->pc;
+        record->imm = stage->imm;
+        record->stage = i | (stage->has_insn ? APEX_BINTRACE_VALID : 0);
+        record->opcode = stage->opcode;
+        record->regs = (stage->rd & 0x1f) | (stage->rs1 & 0x1f) << 5
+                       | (stage->rs2 & 0x1f) << 10;
+    }
+
+    atomic_store_explicit(&trace->head, head + count, memory_order_release);
+}
+
+/*
+ * Waits for the writer to drain the ring and closes the file.
+ * Returns 0 on success, -1 if writing failed.
+ */
+int
+APEX_bintrace_close(APEX_Bintrace *trace)
+{
+    int status;
+
+    atomic_store_explicit(&trace->closing, TRUE, memory_order_release);
+    pthread_join(trace->writer, NULL);
+
+    status = (fclose(trace->fp) != 0 || trace->write_error) ? -1 : 0;
+    if (status)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write the trace\n");
+    }
+
+    free(trace->ring);
+    free(trace);
+    return status;
+}
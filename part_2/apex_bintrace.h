@@ -0,0 +1,57 @@
+/*
+ * apex_bintrace.h
+ * Contains the binary pipeline trace: one fixed size record per stage per
+ * cycle, of the V pipe too when display mode shows it, streamed to a file
+ * by a background writer thread. apex_tracedump renders a trace file in the
+ * display mode format.
+ */
+#ifndef _APEX_BINTRACE_H_
+#define _APEX_BINTRACE_H_
+
+#include <stdint.h>
+
+#include "apex_cpu.h"
+
+#define APEX_BINTRACE_MAGIC "APEXBTRC"
+#define APEX_BINTRACE_VERSION 2
+
+/* Default ring size in records, a power of two */
+#define APEX_BINTRACE_RING_RECORDS (1 << 16)
+
+/* Pipes of a trace, the ring holds at least one cycle of all of them */
+#define APEX_BINTRACE_MAX_PIPES 2
+#define APEX_BINTRACE_MIN_RING_RECORDS (5 * APEX_BINTRACE_MAX_PIPES)
+#define APEX_BINTRACE_MAX_RING_RECORDS (1u << 30)
+
+/* Bit 7 of APEX_Bintrace_Record.stage, the stage holds an instruction */
+#define APEX_BINTRACE_VALID 0x80
+
+typedef struct APEX_Bintrace_Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t pipes;                /* 1, or 2 with the V pipe */
+} APEX_Bintrace_Header;
+
+/* What display mode shows of one stage in one cycle */
+typedef struct APEX_Bintrace_Record
+{
+    uint32_t cycle;                /* Low 32 bits of the clock, enough to
+                                      group the records of a cycle */
+    int32_t pc;
+    int32_t imm;
+    uint8_t stage;                 /* 0 (fetch) to 4 (writeback), 5 to 9 in
+                                      the V pipe | VALID */
+    uint8_t opcode;
+    uint16_t regs;                 /* rd | rs1 << 5 | rs2 << 10 */
+} APEX_Bintrace_Record;
+
+typedef struct APEX_Bintrace APEX_Bintrace;
+
+APEX_Bintrace *APEX_bintrace_open(const char *filename, uint32_t ring_records,
+                                  int pipes);
+void APEX_bintrace_cycle(APEX_Bintrace *trace, const APEX_CPU *cpu);
+int APEX_bintrace_close(APEX_Bintrace *trace);
+
+#endif
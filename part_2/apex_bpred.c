@@ -0,0 +1,508 @@
+/*
+ * apex_bpred.c
+ * Contains the branch direction predictors
+ *
+ * Every predictor implements predict, which only reads the state, and
+ * update, which trains it with the outcome of a resolved branch. Update gets
+ * the global history the branch was predicted with, so the predictors
+ * recompute their table indices instead of carrying them down the pipeline.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_bpred.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define PERCEPTRON_THRESHOLD ((int)(1.93 * APEX_PERCEPTRON_HISTORY + 14))
+#define PERCEPTRON_MAX_WEIGHT 127
+
+/* Usefulness of the TAGE entries is halved every 2^18 updates */
+#define TAGE_AGING_PERIOD (1u << 18)
+#define TAGE_VALID (1 << APEX_TAGE_TAG_BITS)
+
+/* History lengths of the tagged tables, a geometric series */
+static const int tage_history[APEX_TAGE_TABLES] = { 5, 11, 22, 44 };
+
+typedef struct Bpred_Ops
+{
+    const char *name;
+    int (*predict)(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                   const BTB_entry *entry);
+    void (*update)(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                   BTB_entry *entry, int taken);
+} Bpred_Ops;
+
+/* 2-bit saturating counters, taken when >= 2 */
+static void
+train_counter(uint8_t *counter, int taken)
+{
+    if (taken && *counter < 3)
+    {
+        (*counter)++;
+    }
+    else if (!taken && *counter > 0)
+    {
+        (*counter)--;
+    }
+}
+
+static int
+pc_bits(int pc)
+{
+    return (unsigned)pc >> 2;
+}
+
+/*
+ * Legacy: the outcome bits of the BTB entry. BNZ and BP predict taken
+ * unless the bits are 0, BZ and BNP only when they are 2.
+ */
+static int
+legacy_predict(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+               const BTB_entry *entry)
+{
+    (void)bp;
+    (void)pc;
+    (void)history;
+
+    if (!entry)
+    {
+        return FALSE;
+    }
+
+    if (opcode == OPCODE_BNZ || opcode == OPCODE_BP)
+    {
+        return entry->outcome_bit != 0;
+    }
+
+    return entry->outcome_bit == 2;
+}
+
+static void
+legacy_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+              BTB_entry *entry, int taken)
+{
+    (void)bp;
+    (void)pc;
+    (void)opcode;
+    (void)history;
+
+    if (entry)
+    {
+        entry->outcome_bit = taken ? change_btb_2(entry->outcome_bit)
+                                   : change_btb_0(entry->outcome_bit);
+    }
+}
+
+static int
+bimodal_index(int pc, uint64_t history)
+{
+    (void)history;
+
+    return pc_bits(pc) & (APEX_BPRED_COUNTERS - 1);
+}
+
+static int
+gshare_index(int pc, uint64_t history)
+{
+    return (pc_bits(pc) ^ (int)history) & (APEX_BPRED_COUNTERS - 1);
+}
+
+static int
+bimodal_predict(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                const BTB_entry *entry)
+{
+    (void)opcode;
+    (void)entry;
+
+    return bp->u.counters[bimodal_index(pc, history)] >= 2;
+}
+
+static void
+bimodal_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+               BTB_entry *entry, int taken)
+{
+    (void)opcode;
+    (void)entry;
+
+    train_counter(&bp->u.counters[bimodal_index(pc, history)], taken);
+}
+
+static int
+gshare_predict(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+               const BTB_entry *entry)
+{
+    (void)opcode;
+    (void)entry;
+
+    return bp->u.counters[gshare_index(pc, history)] >= 2;
+}
+
+static void
+gshare_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+              BTB_entry *entry, int taken)
+{
+    (void)opcode;
+    (void)entry;
+
+    train_counter(&bp->u.counters[gshare_index(pc, history)], taken);
+}
+
+/* XOR-folds the newest length bits of history into bits bits */
+static uint32_t
+fold_history(uint64_t history, int length, int bits)
+{
+    uint32_t folded = 0;
+
+    if (length < 64)
+    {
+        history &= (1ull << length) - 1;
+    }
+    while (history)
+    {
+        folded ^= history & ((1u << bits) - 1);
+        history >>= bits;
+    }
+
+    return folded;
+}
+
+/* Where a TAGE prediction comes from */
+typedef struct Tage_Lookup
+{
+    int index[APEX_TAGE_TABLES];
+    uint16_t tag[APEX_TAGE_TABLES];
+    int base_index;
+    int provider;                  /* Longest matching table or -1 */
+    int alt;                       /* Next matching table or -1 (base) */
+    int provider_pred;
+    int alt_pred;
+    int use_alt;                   /* Provider is a new, weak entry */
+    int pred;
+} Tage_Lookup;
+
+static void
+tage_lookup(const APEX_Bpred *bp, int pc, uint64_t history, Tage_Lookup *l)
+{
+    int bits = pc_bits(pc);
+    int t;
+
+    l->base_index = bits & (APEX_BPRED_COUNTERS - 1);
+    l->provider = -1;
+    l->alt = -1;
+
+    for (t = APEX_TAGE_TABLES - 1; t >= 0; --t)
+    {
+        l->index[t] = (bits ^ (bits >> (APEX_TAGE_INDEX_BITS - t))
+                       ^ fold_history(history, tage_history[t],
+                                      APEX_TAGE_INDEX_BITS))
+                      & ((1 << APEX_TAGE_INDEX_BITS) - 1);
+        l->tag[t] = ((bits ^ fold_history(history, tage_history[t],
+                                          APEX_TAGE_TAG_BITS)
+                      ^ (fold_history(history, tage_history[t],
+                                      APEX_TAGE_TAG_BITS - 1) << 1))
+                     & (TAGE_VALID - 1))
+                    | TAGE_VALID;
+
+        if (bp->u.tage.tables[t][l->index[t]].tag == l->tag[t])
+        {
+            if (l->provider < 0)
+            {
+                l->provider = t;
+            }
+            else if (l->alt < 0)
+            {
+                l->alt = t;
+            }
+        }
+    }
+
+    l->alt_pred = (l->alt >= 0)
+                  ? bp->u.tage.tables[l->alt][l->index[l->alt]].ctr >= 0
+                  : bp->u.tage.base[l->base_index] >= 2;
+    l->use_alt = TRUE;
+    l->pred = l->alt_pred;
+
+    if (l->provider >= 0)
+    {
+        const APEX_Tage_Entry *entry
+            = &bp->u.tage.tables[l->provider][l->index[l->provider]];
+
+        l->provider_pred = entry->ctr >= 0;
+        l->use_alt = (entry->ctr == 0 || entry->ctr == -1) && entry->u == 0;
+        if (!l->use_alt)
+        {
+            l->pred = l->provider_pred;
+        }
+    }
+}
+
+static int
+tage_predict(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+             const BTB_entry *entry)
+{
+    Tage_Lookup l;
+
+    (void)opcode;
+    (void)entry;
+
+    tage_lookup(bp, pc, history, &l);
+    return l.pred;
+}
+
+static void
+train_tage_ctr(int8_t *ctr, int taken)
+{
+    if (taken && *ctr < 3)
+    {
+        (*ctr)++;
+    }
+    else if (!taken && *ctr > -4)
+    {
+        (*ctr)--;
+    }
+}
+
+static void
+tage_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+            BTB_entry *entry, int taken)
+{
+    Tage_Lookup l;
+    int t;
+
+    (void)opcode;
+    (void)entry;
+
+    tage_lookup(bp, pc, history, &l);
+
+    /* Train the provider, and the alternate when it made the prediction */
+    if (l.provider >= 0)
+    {
+        APEX_Tage_Entry *provider = &bp->u.tage.tables[l.provider][l.index[l.provider]];
+
+        if (l.provider_pred != l.alt_pred)
+        {
+            if (l.provider_pred == taken && provider->u < 3)
+            {
+                provider->u++;
+            }
+            else if (l.provider_pred != taken && provider->u > 0)
+            {
+                provider->u--;
+            }
+        }
+        train_tage_ctr(&provider->ctr, taken);
+    }
+    if (l.use_alt)
+    {
+        if (l.alt >= 0)
+        {
+            train_tage_ctr(&bp->u.tage.tables[l.alt][l.index[l.alt]].ctr, taken);
+        }
+        else
+        {
+            train_counter(&bp->u.tage.base[l.base_index], taken);
+        }
+    }
+
+    /* A misprediction allocates an entry in a longer history table */
+    if (l.pred != taken && l.provider < APEX_TAGE_TABLES - 1)
+    {
+        int allocated = FALSE;
+
+        for (t = l.provider + 1; t < APEX_TAGE_TABLES && !allocated; ++t)
+        {
+            APEX_Tage_Entry *candidate = &bp->u.tage.tables[t][l.index[t]];
+
+            if (candidate->u == 0)
+            {
+                candidate->tag = l.tag[t];
+                candidate->ctr = taken ? 0 : -1;
+                allocated = TRUE;
+            }
+        }
+        for (t = l.provider + 1; t < APEX_TAGE_TABLES && !allocated; ++t)
+        {
+            APEX_Tage_Entry *candidate = &bp->u.tage.tables[t][l.index[t]];
+
+            if (candidate->u > 0)
+            {
+                candidate->u--;
+            }
+        }
+    }
+
+    if (++bp->u.tage.updates % TAGE_AGING_PERIOD == 0)
+    {
+        int i;
+
+        for (t = 0; t < APEX_TAGE_TABLES; ++t)
+        {
+            for (i = 0; i < (1 << APEX_TAGE_INDEX_BITS); ++i)
+            {
+                bp->u.tage.tables[t][i].u >>= 1;
+            }
+        }
+    }
+}
+
+static int
+perceptron_output(const APEX_Bpred *bp, int pc, uint64_t history)
+{
+    const int8_t *weights = bp->u.weights[pc_bits(pc) % APEX_PERCEPTRONS];
+    int y = weights[0];
+    int i;
+
+    for (i = 0; i < APEX_PERCEPTRON_HISTORY; ++i)
+    {
+        y += ((history >> i) & 1) ? weights[i + 1] : -weights[i + 1];
+    }
+
+    return y;
+}
+
+static int
+perceptron_predict(const APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                   const BTB_entry *entry)
+{
+    (void)opcode;
+    (void)entry;
+
+    return perceptron_output(bp, pc, history) >= 0;
+}
+
+static void
+train_weight(int8_t *weight, int agree)
+{
+    if (agree && *weight < PERCEPTRON_MAX_WEIGHT)
+    {
+        (*weight)++;
+    }
+    else if (!agree && *weight > -PERCEPTRON_MAX_WEIGHT)
+    {
+        (*weight)--;
+    }
+}
+
+static void
+perceptron_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                  BTB_entry *entry, int taken)
+{
+    int8_t *weights = bp->u.weights[pc_bits(pc) % APEX_PERCEPTRONS];
+    int y = perceptron_output(bp, pc, history);
+    int i;
+
+    (void)opcode;
+    (void)entry;
+
+    /* Train on a misprediction or while the output is not confident */
+    if ((y >= 0) == taken && abs(y) > PERCEPTRON_THRESHOLD)
+    {
+        return;
+    }
+
+    train_weight(&weights[0], taken);
+    for (i = 0; i < APEX_PERCEPTRON_HISTORY; ++i)
+    {
+        train_weight(&weights[i + 1], (int)((history >> i) & 1) == taken);
+    }
+}
+
+static const Bpred_Ops bpred_ops[APEX_NUM_BPREDS] = {
+    { "legacy", legacy_predict, legacy_update },
+    { "bimodal", bimodal_predict, bimodal_update },
+    { "gshare", gshare_predict, gshare_update },
+    { "tage", tage_predict, tage_update },
+    { "perceptron", perceptron_predict, perceptron_update },
+};
+
+/* Resets the predictor to kind with untrained, weakly not-taken state */
+void
+APEX_bpred_init(APEX_Bpred *bp, int kind)
+{
+    memset(bp, 0, sizeof(*bp));
+    bp->kind = kind;
+
+    switch (kind)
+    {
+        case APEX_BPRED_BIMODAL:
+        case APEX_BPRED_GSHARE:
+        {
+            memset(bp->u.counters, 1, sizeof(bp->u.counters));
+            break;
+        }
+
+        case APEX_BPRED_TAGE:
+        {
+            memset(bp->u.tage.base, 1, sizeof(bp->u.tage.base));
+            break;
+        }
+    }
+}
+
+/* Returns the APEX_BPRED_* called name, or -1 */
+int
+APEX_bpred_parse(const char *name)
+{
+    int kind;
+
+    for (kind = 0; kind < APEX_NUM_BPREDS; ++kind)
+    {
+        if (strcmp(name, bpred_ops[kind].name) == 0)
+        {
+            return kind;
+        }
+    }
+
+    return -1;
+}
+
+const char *
+APEX_bpred_name(int kind)
+{
+    return (kind >= 0 && kind < APEX_NUM_BPREDS) ? bpred_ops[kind].name : "?";
+}
+
+/*
+ * Predicts the direction of the branch at pc with the current history.
+ * entry is its resolved BTB entry or NULL.
+ */
+int
+APEX_bpred_predict(const APEX_Bpred *bp, int pc, int opcode,
+                   const BTB_entry *entry)
+{
+    return bpred_ops[bp->kind].predict(bp, pc, opcode, bp->history, entry);
+}
+
+/* Shifts the direction fetch followed into the speculative history */
+void
+APEX_bpred_push(APEX_Bpred *bp, int taken)
+{
+    bp->history = (bp->history << 1) | (taken ? 1 : 0);
+}
+
+/*
+ * Trains the predictor with a resolved branch. history is the global
+ * history it was predicted with, entry its BTB entry or NULL.
+ */
+void
+APEX_bpred_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                  BTB_entry *entry, int taken)
+{
+    bpred_ops[bp->kind].update(bp, pc, opcode, history, entry, taken);
+}
+
+/*
+ * Restores the history after a redirect to what it was when the redirecting
+ * instruction was fetched, followed by its outcome if it is a conditional
+ * branch
+ */
+void
+APEX_bpred_repair(APEX_Bpred *bp, uint64_t history, int conditional, int taken)
+{
+    bp->history = history;
+    if (conditional)
+    {
+        APEX_bpred_push(bp, taken);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * apex_bpred.h
+ * Contains the branch direction predictors
+ *
+ * Fetch asks the predictor selected by APEX_Config.bpred for the direction
+ * of BZ, BNZ, BP and BNP, execute trains it with the outcome, and a redirect
+ * repairs the speculative global history. The BTB still provides the target,
+ * so a branch can only be predicted taken once its entry is resolved.
+ */
+#ifndef _APEX_BPRED_H_
+#define _APEX_BPRED_H_
+
+#include <stdint.h>
+
+/* Predictors, APEX_Config.bpred */
+enum
+{
+    APEX_BPRED_LEGACY,             /* Outcome bits of the BTB entry */
+    APEX_BPRED_BIMODAL,            /* 2-bit counters indexed by PC */
+    APEX_BPRED_GSHARE,             /* 2-bit counters indexed by PC ^ history */
+    APEX_BPRED_TAGE,               /* Bimodal base and tagged history tables */
+    APEX_BPRED_PERCEPTRON,         /* Perceptrons over the global history */
+    APEX_NUM_BPREDS
+};
+
+#define APEX_BPRED_COUNTER_BITS 12 /* 4096 bimodal/gshare/TAGE base counters */
+#define APEX_BPRED_COUNTERS (1 << APEX_BPRED_COUNTER_BITS)
+
+#define APEX_TAGE_TABLES 4
+#define APEX_TAGE_INDEX_BITS 10    /* Entries per tagged table */
+#define APEX_TAGE_TAG_BITS 9
+
+#define APEX_PERCEPTRONS 256
+#define APEX_PERCEPTRON_HISTORY 32
+
+typedef struct APEX_Tage_Entry
+{
+    uint16_t tag;
+    int8_t ctr;                    /* 3-bit signed, taken when >= 0 */
+    uint8_t u;                     /* 2-bit usefulness */
+} APEX_Tage_Entry;
+
+/* Predictor state, a plain value so CPUs and checkpoints can copy it */
+typedef struct APEX_Bpred
+{
+    int kind;                      /* APEX_BPRED_* */
+    uint64_t history;              /* Speculative global history, newest in bit 0 */
+
+    union
+    {
+        uint8_t counters[APEX_BPRED_COUNTERS];
+
+        struct
+        {
+            uint8_t base[APEX_BPRED_COUNTERS];
+            APEX_Tage_Entry tables[APEX_TAGE_TABLES][1 << APEX_TAGE_INDEX_BITS];
+            uint32_t updates;      /* Usefulness is aged periodically */
+        } tage;
+
+        int8_t weights[APEX_PERCEPTRONS][APEX_PERCEPTRON_HISTORY + 1];
+    } u;
+} APEX_Bpred;
+
+struct BTB_entry;
+
+void APEX_bpred_init(APEX_Bpred *bp, int kind);
+int APEX_bpred_parse(const char *name);
+const char *APEX_bpred_name(int kind);
+int APEX_bpred_predict(const APEX_Bpred *bp, int pc, int opcode,
+                       const struct BTB_entry *entry);
+void APEX_bpred_push(APEX_Bpred *bp, int taken);
+void APEX_bpred_update(APEX_Bpred *bp, int pc, int opcode, uint64_t history,
+                       struct BTB_entry *entry, int taken);
+void APEX_bpred_repair(APEX_Bpred *bp, uint64_t history, int conditional,
+                       int taken);
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ * apex_cache.c
+ * Contains the set-associative cache model
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cache.h"
+#include "apex_macros.h"
+
+static const char *const policy_names[APEX_NUM_CACHE_POLICIES] = {
+    "lru", "plru", "rrip"
+};
+
+static int
+is_power_of_two(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+/*
+ * Returns NULL if the geometry can be modelled, a size of 0 always can.
+ * Otherwise returns the option suffix ("size", "ways", ...) of the first
+ * parameter which can not.
+ */
+const char *
+APEX_cache_config_error(const APEX_Cache_Config *config)
+{
+    int num_lines;
+
+    if (!config->size)
+    {
+        return NULL;
+    }
+    if (!is_power_of_two(config->line_size))
+    {
+        return "line";
+    }
+    if (!is_power_of_two(config->ways) || config->ways > APEX_CACHE_MAX_WAYS)
+    {
+        return "ways";
+    }
+
+    num_lines = config->size / config->line_size;
+    if (config->size < 0 || config->size % config->line_size
+        || num_lines > APEX_CACHE_MAX_LINES)
+    {
+        return "size";
+    }
+    if (num_lines % config->ways || !is_power_of_two(num_lines / config->ways))
+    {
+        return "ways";
+    }
+    if (config->hit_latency < 1)
+    {
+        return "latency";
+    }
+    if (config->policy < 0 || config->policy >= APEX_NUM_CACHE_POLICIES)
+    {
+        return "policy";
+    }
+
+    return NULL;
+}
+
+/* Lines of the cache, 0 without one */
+int
+APEX_cache_num_lines(const APEX_Cache *cache)
+{
+    return cache->num_sets * cache->config.ways;
+}
+
+/*
+ * Empties the cache and sets its geometry, which must be valid. The lines
+ * are allocated for that geometry, none without a cache. cache must be
+ * zeroed or initialized before. Returns 0, or -1 if out of memory, which
+ * leaves the cache disabled.
+ */
+int
+APEX_cache_init(APEX_Cache *cache, const APEX_Cache_Config *config)
+{
+    APEX_cache_free(cache);
+    memset(cache, 0, sizeof(*cache));
+    cache->config = *config;
+    if (!config->size)
+    {
+        return 0;
+    }
+
+    cache->num_sets = config->size / config->line_size / config->ways;
+    while ((1 << cache->line_bits) < config->line_size)
+    {
+        cache->line_bits++;
+    }
+
+    cache->plru = calloc(cache->num_sets, sizeof(*cache->plru));
+    cache->lines = calloc(APEX_cache_num_lines(cache), sizeof(*cache->lines));
+    if (!cache->plru || !cache->lines)
+    {
+        APEX_cache_free(cache);
+        memset(cache, 0, sizeof(*cache));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Makes dst, initialized before, a copy of src with lines of its own.
+ * Returns 0, or -1 if out of memory, which leaves dst disabled.
+ */
+int
+APEX_cache_copy(APEX_Cache *dst, const APEX_Cache *src)
+{
+    if (APEX_cache_init(dst, &src->config) != 0)
+    {
+        return -1;
+    }
+
+    dst->clock = src->clock;
+    if (src->num_sets)
+    {
+        memcpy(dst->plru, src->plru, sizeof(*dst->plru) * src->num_sets);
+        memcpy(dst->lines, src->lines,
+               sizeof(*dst->lines) * APEX_cache_num_lines(src));
+    }
+    return 0;
+}
+
+/* Frees the lines, the cache must be initialized again before its next use */
+void
+APEX_cache_free(APEX_Cache *cache)
+{
+    free(cache->plru);
+    free(cache->lines);
+    cache->plru = NULL;
+    cache->lines = NULL;
+    cache->num_sets = 0;
+}
+
+/*
+ * Points the tree bits of a set away from the way just used. Bit n (n from
+ * 1, the root) is set when the pseudo-LRU line is in the upper half.
+ */
+static void
+plru_touch(uint16_t *bits, int ways, int way)
+{
+    int node = 1;
+    int low = 0;
+    int half;
+
+    for (half = ways / 2; half >= 1; half /= 2)
+    {
+        if (way < low + half)
+        {
+            *bits |= 1u << node;
+            node = 2 * node;
+        }
+        else
+        {
+            *bits &= ~(1u << node);
+            low += half;
+            node = 2 * node + 1;
+        }
+    }
+}
+
+static int
+plru_victim(uint16_t bits, int ways)
+{
+    int node = 1;
+    int low = 0;
+    int half;
+
+    for (half = ways / 2; half >= 1; half /= 2)
+    {
+        if (bits & (1u << node))
+        {
+            low += half;
+            node = 2 * node + 1;
+        }
+        else
+        {
+            node = 2 * node;
+        }
+    }
+
+    return low;
+}
+
+/* Way of the set to replace, invalid lines first */
+static int
+choose_victim(APEX_Cache *cache, int set)
+{
+    APEX_Cache_Line *lines = &cache->lines[set * cache->config.ways];
+    int ways = cache->config.ways;
+    int victim = 0;
+    int way;
+
+    for (way = 0; way < ways; ++way)
+    {
+        if (!lines[way].valid)
+        {
+            return way;
+        }
+    }
+
+    switch (cache->config.policy)
+    {
+        case APEX_CACHE_PLRU:
+        {
+            return plru_victim(cache->plru[set], ways);
+        }
+
+        case APEX_CACHE_RRIP:
+        {
+            /* Age the set until a line is predicted to be re-used last */
+            for (;;)
+            {
+                for (way = 0; way < ways; ++way)
+                {
+                    if (lines[way].rrpv >= APEX_CACHE_RRPV_MAX)
+                    {
+                        return way;
+                    }
+                }
+                for (way = 0; way < ways; ++way)
+                {
+                    lines[way].rrpv++;
+                }
+            }
+        }
+    }
+
+    for (way = 1; way < ways; ++way)
+    {
+        if (lines[way].last_use < lines[victim].last_use)
+        {
+            victim = way;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Replaces a line of the set with the line of line_number and reports the
+ * dirty victim in outcome. Returns the way.
+ */
+static int
+fill_line(APEX_Cache *cache, int set, uint32_t line_number,
+          APEX_Cache_Outcome *outcome)
+{
+    APEX_Cache_Line *lines = &cache->lines[set * cache->config.ways];
+    int way = choose_victim(cache, set);
+
+    if (lines[way].valid && lines[way].dirty)
+    {
+        outcome->victim = lines[way].line << cache->line_bits;
+    }
+    lines[way].line = line_number;
+    lines[way].valid = TRUE;
+    lines[way].dirty = FALSE;
+    lines[way].prefetched = FALSE;
+    lines[way].ready = 0;
+    outcome->fill = TRUE;
+    return way;
+}
+
+/* Way holding line_number in the set, or -1 */
+static int
+find_line(const APEX_Cache *cache, int set, uint32_t line_number)
+{
+    const APEX_Cache_Line *lines = &cache->lines[set * cache->config.ways];
+    int way;
+
+    for (way = 0; way < cache->config.ways; ++way)
+    {
+        if (lines[way].valid && lines[way].line == line_number)
+        {
+            return way;
+        }
+    }
+
+    return -1;
+}
+
+/* Updates the replacement state of a line which was hit or filled */
+static void
+touch_line(APEX_Cache *cache, int set, int way, int hit)
+{
+    APEX_Cache_Line *line = &cache->lines[set * cache->config.ways + way];
+
+    line->last_use = ++cache->clock;
+    line->rrpv = hit ? 0 : APEX_CACHE_RRPV_MAX - 1;
+    plru_touch(&cache->plru[set], cache->config.ways, way);
+}
+
+/*
+ * Looks up the line of address for a read or a write and fills it on a
+ * miss (unless it is a write and the cache does not write-allocate).
+ * Counts the access in stats unless it is NULL, as when warming the cache.
+ * Returns outcome->hit.
+ */
+int
+APEX_cache_access(APEX_Cache *cache, int address, int write,
+                  APEX_Cache_Stats *stats, APEX_Cache_Outcome *outcome)
+{
+    const APEX_Cache_Config *config = &cache->config;
+    uint32_t line_number = (uint32_t)address >> cache->line_bits;
+    int set = line_number & (cache->num_sets - 1);
+    APEX_Cache_Line *lines = &cache->lines[set * config->ways];
+    int way = find_line(cache, set, line_number);
+
+    memset(outcome, 0, sizeof(*outcome));
+    outcome->victim = -1;
+
+    if (way >= 0)
+    {
+        outcome->hit = TRUE;
+        outcome->prefetch_hit = lines[way].prefetched;
+        outcome->ready = lines[way].ready;
+        lines[way].prefetched = FALSE;
+    }
+    else if (!write || config->write_allocate)
+    {
+        way = fill_line(cache, set, line_number, outcome);
+    }
+    if (way >= 0)
+    {
+        touch_line(cache, set, way, outcome->hit);
+        if (write && config->write_back)
+        {
+            lines[way].dirty = TRUE;
+        }
+    }
+    outcome->write_through = write && (!config->write_back || way < 0);
+
+    if (stats)
+    {
+        if (write)
+        {
+            stats->writes++;
+            stats->write_misses += !outcome->hit;
+        }
+        else
+        {
+            stats->reads++;
+            stats->read_misses += !outcome->hit;
+        }
+        stats->writebacks += outcome->victim >= 0;
+        stats->useful_prefetches += outcome->prefetch_hit;
+    }
+
+    return outcome->hit;
+}
+
+/* Returns TRUE if the cache holds the line of address */
+int
+APEX_cache_contains(const APEX_Cache *cache, int address)
+{
+    uint32_t line_number = (uint32_t)address >> cache->line_bits;
+
+    return find_line(cache, line_number & (cache->num_sets - 1), line_number) >= 0;
+}
+
+/*
+ * Fills the line of address unless the cache holds it already. The line
+ * arrives at cycle ready. Counts the prefetch in stats unless it is NULL.
+ * Returns outcome->fill.
+ */
+int
+APEX_cache_prefetch(APEX_Cache *cache, int address, uint64_t ready,
+                    APEX_Cache_Stats *stats, APEX_Cache_Outcome *outcome)
+{
+    uint32_t line_number = (uint32_t)address >> cache->line_bits;
+    int set = line_number & (cache->num_sets - 1);
+    int way;
+
+    memset(outcome, 0, sizeof(*outcome));
+    outcome->victim = -1;
+    if (find_line(cache, set, line_number) >= 0)
+    {
+        return FALSE;
+    }
+
+    way = fill_line(cache, set, line_number, outcome);
+    touch_line(cache, set, way, FALSE);
+    cache->lines[set * cache->config.ways + way].prefetched = TRUE;
+    cache->lines[set * cache->config.ways + way].ready = ready;
+    if (stats)
+    {
+        stats->prefetches++;
+        stats->writebacks += outcome->victim >= 0;
+    }
+
+    return TRUE;
+}
+
+/* Returns the APEX_CACHE_* called name, or -1 */
+int
+APEX_cache_parse_policy(const char *name)
+{
+    int policy;
+
+    for (policy = 0; policy < APEX_NUM_CACHE_POLICIES; ++policy)
+    {
+        if (strcmp(name, policy_names[policy]) == 0)
+        {
+            return policy;
+        }
+    }
+
+    return -1;
+}
+
+const char *
+APEX_cache_policy_name(int policy)
+{
+    return (policy >= 0 && policy < APEX_NUM_CACHE_POLICIES) ? policy_names[policy]
+                                                             : "?";
+}
+
+/* Prints the geometry and the counters of an enabled cache */
+void
+APEX_cache_print_stats(const char *name, const APEX_Cache_Config *config,
+                       const APEX_Cache_Stats *stats)
+{
+    uint64_t accesses = stats->reads + stats->writes;
+    uint64_t misses = stats->read_misses + stats->write_misses;
+
+    printf("APEX_CPU: %s %d B, %d ways, %d B lines, %s", name, config->size,
+           config->ways, config->line_size, APEX_cache_policy_name(config->policy));
+    if (stats->writes)
+    {
+        printf(", %s, %s", config->write_back ? "write-back" : "write-through",
+               config->write_allocate ? "write-allocate" : "no write-allocate");
+    }
+    printf("\n          reads = %llu, read misses = %llu",
+           (unsigned long long)stats->reads,
+           (unsigned long long)stats->read_misses);
+    if (stats->writes)
+    {
+        printf(", writes = %llu, write misses = %llu, writebacks = %llu",
+               (unsigned long long)stats->writes,
+               (unsigned long long)stats->write_misses,
+               (unsigned long long)stats->writebacks);
+    }
+    if (accesses)
+    {
+        printf(", hit rate %.1f%%", 100.0 * (accesses - misses) / accesses);
+    }
+    if (accesses && stats->cycles)
+    {
+        printf(", average access time %.2f cycles",
+               (double)stats->cycles / accesses);
+    }
+    printf("\n");
+    if (stats->prefetches)
+    {
+        printf("          prefetches = %llu, useful = %llu (%.1f%% accurate)\n",
+               (unsigned long long)stats->prefetches,
+               (unsigned long long)stats->useful_prefetches,
+               100.0 * stats->useful_prefetches / stats->prefetches);
+    }
+}
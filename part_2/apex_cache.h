@@ -0,0 +1,107 @@
+/*
+ * apex_cache.h
+ * Contains the set-associative cache model
+ *
+ * A cache only tracks which lines it holds, the data itself stays in
+ * APEX_CPU.data_memory. An access reports whether it hit and which lines
+ * had to move to or from the next level, and the caller turns that into
+ * cycles. Addresses are byte addresses, as LOADP and STOREP step by 4, and
+ * the PC is one too. A prefetch fills a line which only arrives at a given
+ * cycle; a demand access which hits it reports that cycle.
+ */
+#ifndef _APEX_CACHE_H_
+#define _APEX_CACHE_H_
+
+#include <stdint.h>
+
+/* Replacement policies, APEX_Cache_Config.policy */
+enum
+{
+    APEX_CACHE_LRU,                /* Least recently used */
+    APEX_CACHE_PLRU,               /* Tree pseudo-LRU */
+    APEX_CACHE_RRIP,               /* Static RRIP with 2-bit re-reference values */
+    APEX_NUM_CACHE_POLICIES
+};
+
+#define APEX_CACHE_MAX_LINES 4096
+#define APEX_CACHE_MAX_WAYS 16
+#define APEX_CACHE_RRPV_MAX 3      /* Predicted re-reference in the distant future */
+
+/* Geometry and policies, part of APEX_Config */
+typedef struct APEX_Cache_Config
+{
+    int size;                      /* Bytes, 0 disables the cache */
+    int ways;                      /* Lines per set, a power of two */
+    int line_size;                 /* Bytes, a power of two */
+    int hit_latency;               /* Cycles of a hit */
+    int policy;                    /* APEX_CACHE_* */
+    int write_back;                /* FALSE: every write goes to the next level */
+    int write_allocate;            /* FALSE: write misses do not fill a line */
+} APEX_Cache_Config;
+
+/* Event counters, part of APEX_Stats */
+typedef struct APEX_Cache_Stats
+{
+    uint64_t reads;
+    uint64_t read_misses;
+    uint64_t writes;
+    uint64_t write_misses;
+    uint64_t writebacks;           /* Dirty lines written to the next level */
+    uint64_t prefetches;           /* Lines filled by a prefetch */
+    uint64_t useful_prefetches;    /* ... which a demand access used */
+    uint64_t cycles;               /* Latency of all accesses, added by the
+                                      caller, for the average access time */
+} APEX_Cache_Stats;
+
+/* What an access moved between the cache and the next level */
+typedef struct APEX_Cache_Outcome
+{
+    int hit;
+    int prefetch_hit;              /* First demand use of a prefetched line */
+    uint64_t ready;                /* Cycle a prefetched line arrives */
+    int fill;                      /* The line was read from the next level */
+    int write_through;             /* The written data went to the next level */
+    int victim;                    /* Address of the dirty line evicted, or -1 */
+} APEX_Cache_Outcome;
+
+typedef struct APEX_Cache_Line
+{
+    uint32_t line;                 /* Address / line_size */
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t rrpv;                  /* RRIP re-reference prediction */
+    uint8_t prefetched;            /* Filled by a prefetch, not used yet */
+    uint64_t ready;                /* Cycle a prefetched line arrives */
+    uint64_t last_use;             /* clock at the last use, for LRU */
+} APEX_Cache_Line;
+
+/*
+ * Cache state. The lines are allocated for the configured geometry, so a
+ * copy needs APEX_cache_copy() and the cache APEX_cache_free().
+ */
+typedef struct APEX_Cache
+{
+    APEX_Cache_Config config;
+    int num_sets;
+    int line_bits;                 /* log2(line_size) */
+    uint64_t clock;                /* Stamps uses of lines */
+    uint16_t *plru;                /* Tree bits of each set */
+    APEX_Cache_Line *lines;        /* Set by set */
+} APEX_Cache;
+
+const char *APEX_cache_config_error(const APEX_Cache_Config *config);
+int APEX_cache_init(APEX_Cache *cache, const APEX_Cache_Config *config);
+int APEX_cache_copy(APEX_Cache *dst, const APEX_Cache *src);
+void APEX_cache_free(APEX_Cache *cache);
+int APEX_cache_num_lines(const APEX_Cache *cache);
+int APEX_cache_access(APEX_Cache *cache, int address, int write,
+                      APEX_Cache_Stats *stats, APEX_Cache_Outcome *outcome);
+int APEX_cache_contains(const APEX_Cache *cache, int address);
+int APEX_cache_prefetch(APEX_Cache *cache, int address, uint64_t ready,
+                        APEX_Cache_Stats *stats, APEX_Cache_Outcome *outcome);
+int APEX_cache_parse_policy(const char *name);
+const char *APEX_cache_policy_name(int policy);
+void APEX_cache_print_stats(const char *name, const APEX_Cache_Config *config,
+                            const APEX_Cache_Stats *stats);
+
+#endif
@@ -0,0 +1,1008 @@
+/*
+ * apex_checkpoint.c
+ * Contains binary checkpoint and restore of the complete APEX_CPU state
+ *
+ * A checkpoint file is a header, which carries the configuration, followed
+ * by tagged sections. Every section has a fixed size for a given
+ * APEX_CHECKPOINT_VERSION, except the lines of the caches which follow the
+ * configured geometry, so a file written by a different build or for a
+ * different program is rejected instead of being silently misread. Restore
+ * maps the file with mmap() and copies the sections into a CPU created from
+ * the same input file.
+ */
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+#define APEX_CHECKPOINT_MAGIC "APEXCKPT"
+#define APEX_CHECKPOINT_VERSION 21
+
+/* Section tags */
+#define CKPT_CORE 1
+#define CKPT_REGS 2
+#define CKPT_FORWARDING 3
+#define CKPT_LATCHES 4
+#define CKPT_BTB 5
+#define CKPT_DATA_MEMORY 6
+#define CKPT_DISPLAY 7
+#define CKPT_STATS 8
+#define CKPT_BPRED 9
+#define CKPT_RAS 10
+#define CKPT_OOO 11
+#define CKPT_UNITS 12
+#define CKPT_CACHES 13
+#define CKPT_STORE_BUFFER 14
+#define CKPT_MSHRS 15
+#define CKPT_NUM_SECTIONS 15           /* Every tag exactly once */
+
+typedef struct APEX_Checkpoint_Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint32_t code_memory_size;
+    uint32_t code_hash;            /* Detects a checkpoint of another program */
+    APEX_Config config;            /* Sizes the sections, checked first */
+} APEX_Checkpoint_Header;
+
+typedef struct APEX_Checkpoint_Section
+{
+    uint32_t tag;
+    uint32_t size;                 /* Payload bytes following this header */
+} APEX_Checkpoint_Section;
+
+/* Scalar state, widened to fixed size fields */
+typedef struct APEX_Checkpoint_Core
+{
+    int64_t pc;
+    uint64_t clock;
+    uint64_t insn_completed;
+    int64_t last_retired_pc;
+    int64_t halted;
+    int64_t fault;
+    int64_t fault_pc;
+    int64_t fault_address;
+    int64_t zero_flag;
+    int64_t pos_flag;
+    int64_t neg_flag;
+    int64_t fetch_from_next_cycle;
+    int64_t fetch_redirected;
+    int64_t btb_clock;
+    int64_t btb_random;
+    uint64_t next_seq;
+    uint64_t flags_seq;
+    int64_t icache_pending;
+    int64_t icache_pc;
+    uint64_t icache_ready;
+} APEX_Checkpoint_Core;
+
+/* Register file and the per-register pipeline bookkeeping */
+typedef struct APEX_Checkpoint_Regs
+{
+    int32_t regs[REG_FILE_SIZE];
+    int32_t flags_for_regs[REG_FILE_SIZE];
+} APEX_Checkpoint_Regs;
+
+typedef struct APEX_Checkpoint_Forwarding
+{
+    int32_t regs_status_pending[REG_FILE_SIZE];
+    int32_t regs_value_pending[REG_FILE_SIZE];
+    uint64_t regs_pending_seq[REG_FILE_SIZE];
+} APEX_Checkpoint_Forwarding;
+
+/* Instructions in the function units of the in-order pipeline */
+typedef struct APEX_Checkpoint_Units
+{
+    int64_t count;
+    CPU_Stage window[APEX_FU_WINDOW];
+} APEX_Checkpoint_Units;
+
+/*
+ * The DRAM banks and the stride table, followed by the tree bits and the
+ * lines of the L1D, the L1I and the L2 as many as their geometry has
+ */
+typedef struct APEX_Checkpoint_Caches
+{
+    uint64_t cache_clock[3];
+    APEX_Dram dram;
+    APEX_Stride stride;
+} APEX_Checkpoint_Caches;
+
+/* FNV-1a hash of the predecoded program */
+static uint32_t
+hash_code_memory(const APEX_CPU *cpu)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        const APEX_Instruction *ins = &cpu->code_memory[i];
+        uint32_t fields[6] = { ins->opcode, ins->rd, ins->rs1, ins->rs2,
+                               (uint32_t)ins->imm, ins->operand_class };
+        int j;
+
+        for (j = 0; j < 6; ++j)
+        {
+            hash = (hash ^ fields[j]) * 16777619u;
+        }
+    }
+
+    return hash;
+}
+
+/* Bytes of the tree bits and the lines of a cache with a valid geometry */
+static size_t
+cache_lines_size(const APEX_Cache_Config *config)
+{
+    int num_lines = config->size ? config->size / config->line_size : 0;
+
+    return sizeof(uint16_t) * (num_lines ? num_lines / config->ways : 0)
+           + sizeof(APEX_Cache_Line) * num_lines;
+}
+
+/* Payload bytes of the CACHES section for a valid configuration */
+static uint32_t
+caches_size(const APEX_Config *config)
+{
+    return sizeof(APEX_Checkpoint_Caches) + cache_lines_size(&config->l1d)
+           + cache_lines_size(&config->l1i) + cache_lines_size(&config->l2);
+}
+
+/* Appends the tree bits and the lines of a cache to out */
+static unsigned char *
+put_cache_lines(unsigned char *out, const APEX_Cache *cache)
+{
+    size_t plru_size = sizeof(*cache->plru) * cache->num_sets;
+    size_t lines_size = sizeof(*cache->lines) * APEX_cache_num_lines(cache);
+
+    if (cache->num_sets)
+    {
+        memcpy(out, cache->plru, plru_size);
+        memcpy(out + plru_size, cache->lines, lines_size);
+    }
+    return out + plru_size + lines_size;
+}
+
+/* Reads them back into a cache initialized for the same geometry */
+static const unsigned char *
+get_cache_lines(APEX_Cache *cache, const unsigned char *in)
+{
+    size_t plru_size = sizeof(*cache->plru) * cache->num_sets;
+    size_t lines_size = sizeof(*cache->lines) * APEX_cache_num_lines(cache);
+
+    if (cache->num_sets)
+    {
+        memcpy(cache->plru, in, plru_size);
+        memcpy(cache->lines, in + plru_size, lines_size);
+    }
+    return in + plru_size + lines_size;
+}
+
+static int
+write_section(FILE *fp, uint32_t tag, const void *payload, uint32_t size)
+{
+    APEX_Checkpoint_Section section = { tag, size };
+
+    return fwrite(&section, sizeof(section), 1, fp) == 1
+           && fwrite(payload, size, 1, fp) == 1;
+}
+
+/*
+ * Writes the complete CPU state to a checkpoint file.
+ * Returns 0 on success, -1 on error.
+ */
+int
+APEX_cpu_checkpoint(const APEX_CPU *cpu, const char *filename)
+{
+    APEX_Checkpoint_Header header;
+    APEX_Checkpoint_Core core;
+    APEX_Checkpoint_Regs regs;
+    APEX_Checkpoint_Forwarding forwarding;
+    CPU_Stage latches[10];
+    CPU_Stage display[10];
+    APEX_Checkpoint_Units units;
+    APEX_Checkpoint_Caches caches;
+    unsigned char *caches_payload;
+    unsigned char *lines;
+    FILE *fp;
+    int ok;
+    int i;
+
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create checkpoint %s\n", filename);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, APEX_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = APEX_CHECKPOINT_VERSION;
+    header.num_sections = CKPT_NUM_SECTIONS;
+    header.code_memory_size = cpu->code_memory_size;
+    header.code_hash = hash_code_memory(cpu);
+    header.config = cpu->config;
+
+    memset(&core, 0, sizeof(core));
+    core.pc = cpu->pc;
+    core.clock = cpu->clock;
+    core.insn_completed = cpu->insn_completed;
+    core.last_retired_pc = cpu->last_retired_pc;
+    core.halted = cpu->halted;
+    core.fault = cpu->fault;
+    core.fault_pc = cpu->fault_pc;
+    core.fault_address = cpu->fault_address;
+    core.zero_flag = cpu->zero_flag;
+    core.pos_flag = cpu->pos_flag;
+    core.neg_flag = cpu->neg_flag;
+    core.fetch_from_next_cycle = cpu->fetch_from_next_cycle;
+    core.fetch_redirected = cpu->fetch_redirected;
+    core.btb_clock = cpu->btb_clock;
+    core.btb_random = cpu->btb_random;
+    core.next_seq = cpu->next_seq;
+    core.flags_seq = cpu->flags_seq;
+    core.icache_pending = cpu->icache_pending;
+    core.icache_pc = cpu->icache_pc;
+    core.icache_ready = cpu->icache_ready;
+
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        regs.regs[i] = cpu->regs[i];
+        regs.flags_for_regs[i] = cpu->flags_for_regs[i];
+        forwarding.regs_status_pending[i] = cpu->regs_status_pending[i];
+        forwarding.regs_value_pending[i] = cpu->regs_value_pending[i];
+        forwarding.regs_pending_seq[i] = cpu->regs_pending_seq[i];
+    }
+
+    latches[0] = cpu->fetch;
+    latches[1] = cpu->decode;
+    latches[2] = cpu->execute;
+    latches[3] = cpu->memory;
+    latches[4] = cpu->writeback;
+    latches[5] = cpu->fetch_v;
+    latches[6] = cpu->decode_v;
+    latches[7] = cpu->execute_v;
+    latches[8] = cpu->memory_v;
+    latches[9] = cpu->writeback_v;
+    memcpy(display, cpu->outputDisplay, sizeof(cpu->outputDisplay));
+    memcpy(display + 5, cpu->outputDisplay_v, sizeof(cpu->outputDisplay_v));
+
+    memset(&units, 0, sizeof(units));
+    units.count = cpu->fu_window_count;
+    memcpy(units.window, cpu->fu_window, sizeof(units.window));
+
+    memset(&caches, 0, sizeof(caches));
+    caches.cache_clock[0] = cpu->l1d.clock;
+    caches.cache_clock[1] = cpu->l1i.clock;
+    caches.cache_clock[2] = cpu->l2.clock;
+    caches.dram = cpu->dram;
+    caches.stride = cpu->stride;
+    caches_payload = malloc(caches_size(&cpu->config));
+    if (!caches_payload)
+    {
+        fclose(fp);
+        fprintf(stderr, "APEX_Error: Unable to write checkpoint %s\n", filename);
+        return -1;
+    }
+    memcpy(caches_payload, &caches, sizeof(caches));
+    lines = put_cache_lines(caches_payload + sizeof(caches), &cpu->l1d);
+    lines = put_cache_lines(lines, &cpu->l1i);
+    put_cache_lines(lines, &cpu->l2);
+
+    ok = fwrite(&header, sizeof(header), 1, fp) == 1
+         && write_section(fp, CKPT_CORE, &core, sizeof(core))
+         && write_section(fp, CKPT_REGS, &regs, sizeof(regs))
+         && write_section(fp, CKPT_FORWARDING, &forwarding, sizeof(forwarding))
+         && write_section(fp, CKPT_LATCHES, latches, sizeof(latches))
+         && write_section(fp, CKPT_BTB, cpu->BTB_array, sizeof(cpu->BTB_array))
+         && write_section(fp, CKPT_DATA_MEMORY, cpu->data_memory,
+                          sizeof(cpu->data_memory))
+         && write_section(fp, CKPT_DISPLAY, display, sizeof(display))
+         && write_section(fp, CKPT_STATS, &cpu->stats, sizeof(cpu->stats))
+         && write_section(fp, CKPT_BPRED, &cpu->bpred, sizeof(cpu->bpred))
+         && write_section(fp, CKPT_RAS, &cpu->ras, sizeof(cpu->ras))
+         && write_section(fp, CKPT_OOO, &cpu->ooo, sizeof(cpu->ooo))
+         && write_section(fp, CKPT_UNITS, &units, sizeof(units))
+         && write_section(fp, CKPT_CACHES, caches_payload,
+                          caches_size(&cpu->config))
+         && write_section(fp, CKPT_STORE_BUFFER, &cpu->store_buffer,
+                          sizeof(cpu->store_buffer))
+         && write_section(fp, CKPT_MSHRS, &cpu->mshrs, sizeof(cpu->mshrs));
+    free(caches_payload);
+
+    if (fclose(fp) != 0 || !ok)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write checkpoint %s\n", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Expected payload size of each section. That of the caches depends on
+ * config, the configuration in the header.
+ */
+static uint32_t
+section_size(uint32_t tag, const APEX_Config *config)
+{
+    switch (tag)
+    {
+        case CKPT_CORE:
+            return sizeof(APEX_Checkpoint_Core);
+
+        case CKPT_REGS:
+            return sizeof(APEX_Checkpoint_Regs);
+
+        case CKPT_FORWARDING:
+            return sizeof(APEX_Checkpoint_Forwarding);
+
+        case CKPT_LATCHES:
+            return 10 * sizeof(CPU_Stage);
+
+        case CKPT_BTB:
+            return sizeof(((APEX_CPU *)0)->BTB_array);
+
+        case CKPT_DATA_MEMORY:
+            return sizeof(((APEX_CPU *)0)->data_memory);
+
+        case CKPT_DISPLAY:
+            return 10 * sizeof(CPU_Stage);
+
+        case CKPT_STATS:
+            return sizeof(APEX_Stats);
+
+        case CKPT_BPRED:
+            return sizeof(APEX_Bpred);
+
+        case CKPT_RAS:
+            return sizeof(APEX_Ras);
+
+        case CKPT_OOO:
+            return sizeof(APEX_Ooo);
+
+        case CKPT_UNITS:
+            return sizeof(APEX_Checkpoint_Units);
+
+        case CKPT_CACHES:
+            return caches_size(config);
+
+        case CKPT_STORE_BUFFER:
+            return sizeof(APEX_Store_Buffer);
+
+        case CKPT_MSHRS:
+            return sizeof(APEX_Mshr_File);
+    }
+
+    return 0;
+}
+
+/*
+ * Copies a section into cpu. Returns FALSE if the caches are out of memory.
+ */
+static int
+restore_section(APEX_CPU *cpu, uint32_t tag, const void *payload)
+{
+    switch (tag)
+    {
+        case CKPT_CORE:
+        {
+            APEX_Checkpoint_Core core;
+
+            memcpy(&core, payload, sizeof(core));
+            cpu->pc = core.pc;
+            cpu->clock = core.clock;
+            cpu->insn_completed = core.insn_completed;
+            cpu->last_retired_pc = core.last_retired_pc;
+            cpu->halted = core.halted;
+            cpu->fault = core.fault;
+            cpu->fault_pc = core.fault_pc;
+            cpu->fault_address = core.fault_address;
+            cpu->zero_flag = core.zero_flag;
+            cpu->pos_flag = core.pos_flag;
+            cpu->neg_flag = core.neg_flag;
+            cpu->fetch_from_next_cycle = core.fetch_from_next_cycle;
+            cpu->fetch_redirected = core.fetch_redirected;
+            cpu->btb_clock = core.btb_clock;
+            cpu->btb_random = core.btb_random;
+            cpu->next_seq = core.next_seq;
+            cpu->flags_seq = core.flags_seq;
+            cpu->icache_pending = core.icache_pending;
+            cpu->icache_pc = core.icache_pc;
+            cpu->icache_ready = core.icache_ready;
+            break;
+        }
+
+        case CKPT_REGS:
+        {
+            APEX_Checkpoint_Regs regs;
+            int i;
+
+            memcpy(&regs, payload, sizeof(regs));
+            for (i = 0; i < REG_FILE_SIZE; ++i)
+            {
+                cpu->regs[i] = regs.regs[i];
+                cpu->flags_for_regs[i] = regs.flags_for_regs[i];
+            }
+            break;
+        }
+
+        case CKPT_FORWARDING:
+        {
+            APEX_Checkpoint_Forwarding forwarding;
+            int i;
+
+            memcpy(&forwarding, payload, sizeof(forwarding));
+            for (i = 0; i < REG_FILE_SIZE; ++i)
+            {
+                cpu->regs_status_pending[i] = forwarding.regs_status_pending[i];
+                cpu->regs_value_pending[i] = forwarding.regs_value_pending[i];
+                cpu->regs_pending_seq[i] = forwarding.regs_pending_seq[i];
+            }
+            break;
+        }
+
+        case CKPT_LATCHES:
+        {
+            CPU_Stage latches[10];
+
+            memcpy(latches, payload, sizeof(latches));
+            cpu->fetch = latches[0];
+            cpu->decode = latches[1];
+            cpu->execute = latches[2];
+            cpu->memory = latches[3];
+            cpu->writeback = latches[4];
+            cpu->fetch_v = latches[5];
+            cpu->decode_v = latches[6];
+            cpu->execute_v = latches[7];
+            cpu->memory_v = latches[8];
+            cpu->writeback_v = latches[9];
+            break;
+        }
+
+        case CKPT_BTB:
+        {
+            memcpy(cpu->BTB_array, payload, sizeof(cpu->BTB_array));
+            break;
+        }
+
+        case CKPT_DATA_MEMORY:
+        {
+            memcpy(cpu->data_memory, payload, sizeof(cpu->data_memory));
+            break;
+        }
+
+        case CKPT_DISPLAY:
+        {
+            CPU_Stage display[10];
+
+            memcpy(display, payload, sizeof(display));
+            memcpy(cpu->outputDisplay, display, sizeof(cpu->outputDisplay));
+            memcpy(cpu->outputDisplay_v, display + 5, sizeof(cpu->outputDisplay_v));
+            break;
+        }
+
+        case CKPT_STATS:
+        {
+            memcpy(&cpu->stats, payload, sizeof(cpu->stats));
+            break;
+        }
+
+        case CKPT_BPRED:
+        {
+            memcpy(&cpu->bpred, payload, sizeof(cpu->bpred));
+            break;
+        }
+
+        case CKPT_RAS:
+        {
+            memcpy(&cpu->ras, payload, sizeof(cpu->ras));
+            break;
+        }
+
+        case CKPT_STORE_BUFFER:
+        {
+            memcpy(&cpu->store_buffer, payload, sizeof(cpu->store_buffer));
+            break;
+        }
+
+        case CKPT_MSHRS:
+        {
+            memcpy(&cpu->mshrs, payload, sizeof(cpu->mshrs));
+            break;
+        }
+
+        case CKPT_OOO:
+        {
+            memcpy(&cpu->ooo, payload, sizeof(cpu->ooo));
+            break;
+        }
+
+        case CKPT_UNITS:
+        {
+            APEX_Checkpoint_Units units;
+
+            memcpy(&units, payload, sizeof(units));
+            cpu->fu_window_count = units.count;
+            memcpy(cpu->fu_window, units.window, sizeof(cpu->fu_window));
+            break;
+        }
+
+        case CKPT_CACHES:
+        {
+            APEX_Checkpoint_Caches caches;
+            const unsigned char *lines = payload;
+
+            /* The configuration of the header sizes the lines */
+            if (APEX_cache_init(&cpu->l1d, &cpu->config.l1d) != 0
+                || APEX_cache_init(&cpu->l1i, &cpu->config.l1i) != 0
+                || APEX_cache_init(&cpu->l2, &cpu->config.l2) != 0)
+            {
+                return FALSE;
+            }
+            memcpy(&caches, payload, sizeof(caches));
+            cpu->l1d.clock = caches.cache_clock[0];
+            cpu->l1i.clock = caches.cache_clock[1];
+            cpu->l2.clock = caches.cache_clock[2];
+            cpu->dram = caches.dram;
+            cpu->stride = caches.stride;
+            lines = get_cache_lines(&cpu->l1d, lines + sizeof(caches));
+            lines = get_cache_lines(&cpu->l1i, lines);
+            get_cache_lines(&cpu->l2, lines);
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Returns TRUE if a RAS has depth entries and its top and count fit them */
+static int
+valid_ras(const APEX_Ras *ras, int depth)
+{
+    return ras->depth == depth && ras->count >= 0 && ras->count <= depth
+           && ras->top >= 0 && ras->top < (depth ? depth : 1);
+}
+
+/* Returns TRUE if a RAS snapshot fits a stack of depth entries */
+static int
+valid_ras_snapshot(const APEX_Ras_Snapshot *snapshot, int depth)
+{
+    return snapshot->count >= 0 && snapshot->count <= depth
+           && snapshot->top >= 0 && snapshot->top < (depth ? depth : 1);
+}
+
+/* Returns TRUE if a latch is empty or holds an instruction of the program */
+static int
+valid_stage(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    const APEX_Instruction *ins;
+
+    if (!stage->has_insn)
+    {
+        return TRUE;
+    }
+    if (stage->code_index < 0 || stage->code_index >= cpu->code_memory_size)
+    {
+        return FALSE;
+    }
+
+    ins = &cpu->code_memory[stage->code_index];
+    return stage->opcode == ins->opcode && stage->rd == ins->rd
+           && stage->rs1 == ins->rs1 && stage->rs2 == ins->rs2
+           && stage->imm == ins->imm
+           && stage->fu >= 0 && stage->fu < APEX_NUM_FUS
+           && valid_ras_snapshot(&stage->ras, cpu->config.ras_depth);
+}
+
+static int
+valid_address(int address)
+{
+    return address >= 0 && address < DATA_MEMORY_SIZE;
+}
+
+/* Returns TRUE if a memory stage latch accesses data memory */
+static int
+valid_memory_stage(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int operand_class;
+
+    if (!stage->has_insn)
+    {
+        return TRUE;
+    }
+
+    operand_class = cpu->code_memory[stage->code_index].operand_class;
+    return !(operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+           || valid_address(stage->memory_address);
+}
+
+/* Returns TRUE if a restored cache has the geometry config gives it */
+static int
+valid_cache(const APEX_Cache *cache, const APEX_Cache_Config *config)
+{
+    if (memcmp(&cache->config, config, sizeof(*config)) != 0)
+    {
+        return FALSE;
+    }
+    if (!config->size)
+    {
+        return cache->num_sets == 0;
+    }
+
+    return cache->num_sets == config->size / config->line_size / config->ways
+           && cache->line_bits >= 0 && (1 << cache->line_bits) == config->line_size;
+}
+
+static int
+valid_dram(const APEX_Dram *dram, const APEX_Dram_Config *config)
+{
+    return memcmp(&dram->config, config, sizeof(*config)) == 0
+           && (!config->banks || (dram->row_bits >= 0 && dram->row_bits < 31
+                                  && (1 << dram->row_bits) == config->row_size));
+}
+
+static int
+valid_phys(const APEX_Config *config, int phys)
+{
+    return phys >= 0 && phys < config->phys_regs;
+}
+
+/* Returns TRUE if the queues of an active out-of-order backend are in range */
+static int
+valid_ooo(const APEX_CPU *cpu)
+{
+    const APEX_Config *config = &cpu->config;
+    const APEX_Ooo *ooo = &cpu->ooo;
+    int fq_size = sizeof(ooo->fetch_queue) / sizeof(ooo->fetch_queue[0]);
+    int i;
+    int j;
+
+    if (!ooo->active)
+    {
+        return TRUE;
+    }
+    if (!valid_ras(&ooo->commit_ras, config->ras_depth))
+    {
+        return FALSE;
+    }
+    if (ooo->free_head < 0 || ooo->free_head >= config->phys_regs
+        || ooo->free_count < 0 || ooo->free_count > config->phys_regs
+        || ooo->rob_head < 0 || ooo->rob_head >= config->rob_size
+        || ooo->rob_count < 0 || ooo->rob_count > config->rob_size
+        || ooo->iq_count < 0 || ooo->iq_count > config->iq_size
+        || ooo->lsq_head < 0 || ooo->lsq_head >= config->lsq_size
+        || ooo->lsq_count < 0 || ooo->lsq_count > config->lsq_size
+        || ooo->fq_head < 0 || ooo->fq_head >= fq_size
+        || ooo->fq_count < 0 || ooo->fq_count > fq_size)
+    {
+        return FALSE;
+    }
+
+    for (i = 0; i < APEX_OOO_ARCH_REGS; ++i)
+    {
+        if (!valid_phys(config, ooo->rat[i]))
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < config->phys_regs; ++i)
+    {
+        if (!valid_phys(config, ooo->free_list[i]))
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < ooo->rob_count; ++i)
+    {
+        const APEX_Rob_Entry *entry = &ooo->rob[(ooo->rob_head + i) % config->rob_size];
+
+        if (!valid_stage(cpu, &entry->insn) || entry->num_dests < 0 || entry->num_dests > 3
+            || entry->lsq_index < -1 || entry->lsq_index >= config->lsq_size)
+        {
+            return FALSE;
+        }
+        for (j = 0; j < entry->num_dests; ++j)
+        {
+            if (entry->dest_arch[j] < 0 || entry->dest_arch[j] >= APEX_OOO_ARCH_REGS
+                || !valid_phys(config, entry->dest_phys[j])
+                || !valid_phys(config, entry->prev_phys[j]))
+            {
+                return FALSE;
+            }
+        }
+    }
+    for (i = 0; i < ooo->iq_count; ++i)
+    {
+        if (ooo->iq[i].rob_index < 0 || ooo->iq[i].rob_index >= config->rob_size
+            || ooo->iq[i].fu < 0 || ooo->iq[i].fu >= APEX_OOO_NUM_FU_KINDS)
+        {
+            return FALSE;
+        }
+        for (j = 0; j < 3; ++j)
+        {
+            if (ooo->iq[i].src_phys[j] != -1 && !valid_phys(config, ooo->iq[i].src_phys[j]))
+            {
+                return FALSE;
+            }
+        }
+    }
+    for (i = 0; i < ooo->lsq_count; ++i)
+    {
+        const APEX_Lsq_Entry *lsq = &ooo->lsq[(ooo->lsq_head + i) % config->lsq_size];
+
+        if (lsq->rob_index < 0 || lsq->rob_index >= config->rob_size
+            || (lsq->address_known && !valid_address(lsq->address)))
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < ooo->fq_count; ++i)
+    {
+        if (!valid_stage(cpu, &ooo->fetch_queue[(ooo->fq_head + i) % fq_size]))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/* Returns TRUE if the store buffer and the MSHRs fit the configuration */
+static int
+valid_memory_buffers(const APEX_CPU *cpu)
+{
+    const APEX_Store_Buffer *store_buffer = &cpu->store_buffer;
+    const APEX_Mshr_File *mshrs = &cpu->mshrs;
+    int i;
+    int j;
+
+    if (store_buffer->count < 0 || store_buffer->count > cpu->config.store_buffer
+        || mshrs->count < 0 || mshrs->count > cpu->config.mshrs)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < store_buffer->count; ++i)
+    {
+        if (!valid_address(store_buffer->entries[i].address))
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < mshrs->count; ++i)
+    {
+        const APEX_Mshr *mshr = &mshrs->entries[i];
+
+        if (mshr->num_targets < 1 || mshr->num_targets > APEX_MSHR_TARGETS)
+        {
+            return FALSE;
+        }
+        for (j = 0; j < mshr->num_targets; ++j)
+        {
+            if (mshr->targets[j].rd < -1 || mshr->targets[j].rd >= REG_FILE_SIZE)
+            {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Returns TRUE if restored state can be simulated: every model was built for
+ * the configuration of the header, which passed APEX_config_check() already,
+ * only a halted CPU has a fault and no count or index leaves its array
+ */
+static int
+valid_state(const APEX_CPU *cpu)
+{
+    const CPU_Stage *latches[8] = {
+        &cpu->decode, &cpu->execute, &cpu->memory, &cpu->writeback,
+        &cpu->decode_v, &cpu->execute_v, &cpu->memory_v, &cpu->writeback_v
+    };
+    int i;
+
+    if (cpu->fault < APEX_FAULT_NONE || cpu->fault > APEX_FAULT_DATA
+        || (cpu->fault != APEX_FAULT_NONE && !cpu->halted)
+        || cpu->bpred.kind != cpu->config.bpred
+        || !valid_ras(&cpu->ras, cpu->config.ras_depth)
+        || cpu->fu_window_count < 0 || cpu->fu_window_count > APEX_FU_WINDOW
+        || !valid_cache(&cpu->l1d, &cpu->config.l1d)
+        || !valid_cache(&cpu->l1i, &cpu->config.l1i)
+        || !valid_cache(&cpu->l2, &cpu->config.l2)
+        || !valid_dram(&cpu->dram, &cpu->config.dram)
+        || memcmp(&cpu->stride.config, &cpu->config.stride,
+                  sizeof(cpu->stride.config)) != 0
+        || !valid_memory_buffers(cpu)
+        || !valid_ooo(cpu))
+    {
+        return FALSE;
+    }
+
+    /* The fetch latches only hold an instruction while it waits for decode,
+     * has_insn alone keeps fetch running */
+    if (cpu->fetch.stalling_value && !valid_stage(cpu, &cpu->fetch))
+    {
+        return FALSE;
+    }
+    for (i = 0; i < 8; ++i)
+    {
+        if (!valid_stage(cpu, latches[i]))
+        {
+            return FALSE;
+        }
+    }
+    for (i = 0; i < cpu->fu_window_count; ++i)
+    {
+        if (!valid_stage(cpu, &cpu->fu_window[i]))
+        {
+            return FALSE;
+        }
+    }
+
+    return valid_memory_stage(cpu, &cpu->memory)
+           && valid_memory_stage(cpu, &cpu->memory_v);
+}
+
+/*
+ * Restores a checkpoint into a CPU initialized from the same input file.
+ * The file is validated completely before any state is changed: the state
+ * is restored into a copy of the CPU, which only replaces it if every
+ * section was present once and the restored state passes valid_state().
+ * Returns 0 on success, -1 on error.
+ */
+int
+APEX_cpu_restore(APEX_CPU *cpu, const char *filename)
+{
+    const APEX_Checkpoint_Header *header;
+    const unsigned char *base;
+    APEX_CPU *restored;
+    APEX_Config config;
+    char config_error[128];
+    struct stat st;
+    size_t offset;
+    uint32_t seen = 0;
+    int ok = TRUE;
+    uint32_t pass;
+    uint32_t i;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open checkpoint %s\n", filename);
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header))
+    {
+        fprintf(stderr, "APEX_Error: %s is not an APEX checkpoint\n", filename);
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "APEX_Error: Unable to map checkpoint %s\n", filename);
+        return -1;
+    }
+
+    base = map;
+    header = map;
+    if (memcmp(header->magic, APEX_CHECKPOINT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != APEX_CHECKPOINT_VERSION)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a version %d APEX checkpoint\n",
+                filename, APEX_CHECKPOINT_VERSION);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    if (header->code_memory_size != (uint32_t)cpu->code_memory_size
+        || header->code_hash != hash_code_memory(cpu))
+    {
+        fprintf(stderr, "APEX_Error: checkpoint %s was taken for another program\n",
+                filename);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    /* Before any section, the size of the caches depends on it */
+    memcpy(&config, &header->config, sizeof(config));
+    if (APEX_config_check(&config, config_error, sizeof(config_error)) != 0)
+    {
+        fprintf(stderr, "APEX_Error: checkpoint %s has an invalid configuration, %s\n",
+                filename, config_error);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    /* Too large for the stack */
+    restored = calloc(1, sizeof(*restored));
+    if (!restored || APEX_cpu_copy(restored, cpu) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Unable to restore checkpoint %s\n", filename);
+        APEX_cpu_free_copy(restored);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    restored->config = config;
+
+    /* First pass validates the section table, second pass restores */
+    for (pass = 0; pass < 2; ++pass)
+    {
+        offset = sizeof(*header);
+        for (i = 0; i < header->num_sections; ++i)
+        {
+            APEX_Checkpoint_Section section;
+
+            if (offset + sizeof(section) > (size_t)st.st_size)
+            {
+                break;
+            }
+            memcpy(&section, base + offset, sizeof(section));
+            offset += sizeof(section);
+
+            if (section.tag < 1 || section.tag > CKPT_NUM_SECTIONS
+                || section.size != section_size(section.tag, &config)
+                || offset + section.size > (size_t)st.st_size)
+            {
+                break;
+            }
+
+            if (pass == 0)
+            {
+                if (seen & (1u << section.tag))
+                {
+                    break;
+                }
+                seen |= 1u << section.tag;
+            }
+            else if (!restore_section(restored, section.tag, base + offset))
+            {
+                ok = FALSE;
+                break;
+            }
+            offset += section.size;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "APEX_Error: Unable to restore checkpoint %s\n",
+                    filename);
+        }
+        else if (i != header->num_sections
+                 || header->num_sections != CKPT_NUM_SECTIONS
+                 || (pass == 1 && !valid_state(restored)))
+        {
+            fprintf(stderr, "APEX_Error: checkpoint %s is corrupted\n", filename);
+            ok = FALSE;
+        }
+        if (!ok)
+        {
+            APEX_cpu_free_copy(restored);
+            munmap(map, st.st_size);
+            return -1;
+        }
+    }
+
+    /* cpu takes over the caches of the restored copy */
+    APEX_memsys_free(cpu);
+    *cpu = *restored;
+    free(restored);
+    munmap(map, st.st_size);
+    return 0;
+}
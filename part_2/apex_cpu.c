@@ -10,13 +10,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "apex_bintrace.h"
+#include "apex_kanata.h"
+#include "apex_profile.h"
 #include "apex_cpu.h"
+#include "apex_isa.h"
 #include "apex_macros.h"
 
-CPU_Stage outputDisplay[5];
-
-char stages[5][20] = { "FETCH_ ","DECODE_RF_","EX_","MEMORY_","WRITEBACK_"};
-
 
 /* Converts the PC(4000 series) into array index for code memory
  *
@@ -31,11 +31,13 @@ get_code_memory_index_from_pc(const int pc)
 static void
 print_instruction(const CPU_Stage *stage)
 {
+    const char *opcode_str = get_opcode_str(stage->opcode);
+
     switch (stage->opcode)
     {
         case OPCODE_ADD:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
@@ -43,114 +45,114 @@ print_instruction(const CPU_Stage *stage)
 
         case OPCODE_SUB:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_SUBL:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rd, stage->rs1,
                    stage->imm);
             break;
         }
 
         case OPCODE_ADDL:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rd, stage->rs1,
                    stage->imm);
             break;
         }
 
         case OPCODE_MUL:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_DIV:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_AND:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_OR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_XOR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,R%d ", opcode_str, stage->rd, stage->rs1,
                    stage->rs2);
             break;
         }
 
         case OPCODE_MOVC:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
+            printf("%s,R%d,#%d ", opcode_str, stage->rd, stage->imm);
             break;
         }
 
         case OPCODE_LOAD:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rd, stage->rs1,
                    stage->imm);
             break;
         }
 
         case OPCODE_STORE:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rs1, stage->rs2,
                    stage->imm);
             break;
         }
 
         case OPCODE_BZ:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
         case OPCODE_BNZ:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
         
         case OPCODE_BP:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
         case OPCODE_BNP:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
         case OPCODE_BN:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
         case OPCODE_BNN:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            printf("%s,#%d ", opcode_str, stage->imm);
             break;
         }
 
@@ -158,49 +160,49 @@ print_instruction(const CPU_Stage *stage)
 
         case OPCODE_HALT:
         {
-            printf("%s", stage->opcode_str);
+            printf("%s", opcode_str);
             break;
         }
 
         case OPCODE_CMP:
         {
-            printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1, stage->rs2);
+            printf("%s,R%d,R%d ", opcode_str, stage->rs1, stage->rs2);
             break;
         }
 
         case OPCODE_CML:
         {
-            printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1, stage->imm);
+            printf("%s,R%d,R%d ", opcode_str, stage->rs1, stage->imm);
             break;
         }
 
         case OPCODE_NOP:
         {
-            printf("%s", stage->opcode_str);
+            printf("%s", opcode_str);
             break;
         }
         
         case OPCODE_JUMP:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rs1, stage->imm);
+            printf("%s,R%d,#%d ", opcode_str, stage->rs1, stage->imm);
             break;
         }
 
         case OPCODE_JALR:
         {
-            printf("%s,R%d, R%d, #%d ", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
+            printf("%s,R%d, R%d, #%d ", opcode_str, stage->rd, stage->rs1, stage->imm);
             break;
         }
 
         case OPCODE_LOADP:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rd, stage->rs1, stage->imm);
             break;
         }
 
         case OPCODE_STOREP:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2, stage->imm);
+            printf("%s,R%d,R%d,#%d ", opcode_str, stage->rs1, stage->rs2, stage->imm);
             break;
         }
 
@@ -216,8 +218,8 @@ print_instruction(const CPU_Stage *stage)
  *
  * Note: You can edit this function to print in more detail
  */
-static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+void
+APEX_print_stage(const char *name, const CPU_Stage *stage)
 {
     printf("%-15s: pc(%d) ", name, stage->pc);
     print_instruction(stage);
@@ -251,1163 +253,1036 @@ print_reg_file(const APEX_CPU *cpu)
 }
 
 /*
- * Fetch Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
+ * Reads a source register in decode. Results of older instructions which
+ * have not been written back yet are forwarded from regs_value_pending.
+ * Returns FALSE when the value is not produced yet (e.g. load-use), or not
+ * written back yet when forwarding is disabled.
  */
-static void
-APEX_fetch(APEX_CPU *cpu)
+static int
+read_source_register(const APEX_CPU *cpu, int reg, int *value)
 {
-    APEX_Instruction *current_ins;
-
-    if (cpu->fetch.has_insn && !cpu->fetch.stalling_value)
+    switch (cpu->regs_status_pending[reg])
     {
-        /* This fetches new branch target instruction from next cycle */
-        if (cpu->fetch_from_next_cycle == TRUE)
+        case PENDING_FORWARD:
         {
-            cpu->fetch_from_next_cycle = FALSE;
-
-            /* Skip this cycle*/
-             outputDisplay[0].has_insn = 0; //fetch
-            return;
+            if (!cpu->config.forwarding)
+            {
+                return FALSE;
+            }
+            *value = cpu->regs_value_pending[reg];
+            return TRUE;
         }
 
-        /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
+        case PENDING_WAIT:
+        {
+            return FALSE;
+        }
+    }
 
-        /* Index into code memory using this pc and copy all instruction fields
-         * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.rs3 = current_ins->rs3; //added for store
-        cpu->fetch.imm = current_ins->imm;
+    *value = cpu->regs[reg];
+    return TRUE;
+}
 
-        /* Update PC for next instruction */
+/*
+ * Publishes a result computed in execute/memory for forwarding, unless a
+ * younger producer of the register has already issued
+ */
+static void
+forward_result(APEX_CPU *cpu, const CPU_Stage *stage, int reg, int value)
+{
+    if (cpu->regs_pending_seq[reg] > stage->seq)
+    {
+        return;
+    }
+    if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_FORWARDING, stage->pc))
+    {
+        printf("Forward        : pc(%d) R%d = %d\n", stage->pc, reg, value);
+    }
+    cpu->regs_status_pending[reg] = PENDING_FORWARD;
+    cpu->regs_value_pending[reg] = value;
+    cpu->regs_pending_seq[reg] = stage->seq;
+}
 
-        // cpu->pc += 4;
+/* Marks a register whose value is not produced yet */
+static void
+mark_result_pending(APEX_CPU *cpu, const CPU_Stage *stage, int reg)
+{
+    cpu->regs_status_pending[reg] = PENDING_WAIT;
+    cpu->regs_pending_seq[reg] = stage->seq;
+}
 
-        // /* Copy data from fetch latch to decode latch*/
-        // cpu->decode = cpu->fetch;
+/* Clears the forwarding entry once its youngest producer writes back */
+static void
+release_pending(APEX_CPU *cpu, const CPU_Stage *stage, int reg)
+{
+    if (cpu->regs_pending_seq[reg] == stage->seq)
+    {
+        cpu->regs_status_pending[reg] = PENDING_NONE;
+    }
+}
 
-        // fetch code for BTB 
-        // 4 cases for BTB - 1. BTB miss, 2. BTB hit, 3. BTB miss and branch taken, 4. BTB hit and branch taken
-        // BTB will be used for - BNZ, BZ, BNP and BP
-        
-        // BNZ and BP will have the same implementation
-        // BZ and BNP will have the same implementation
+/* Sends fetch to a new PC and squashes the younger instructions */
+static void
+redirect_fetch(APEX_CPU *cpu, int new_pc)
+{
+    cpu->pc = new_pc;
 
+    /* Since we are using reverse callbacks for pipeline stages,
+     * this will prevent the new instruction from being fetched in the current cycle*/
+    cpu->fetch_from_next_cycle = TRUE;
 
+    /* Flush previous stages */
+    cpu->decode.has_insn = FALSE;
+    cpu->decode_v.has_insn = FALSE;
+    cpu->decode.stalling_value = 0;
+    cpu->fetch.stalling_value = 0;
 
+    /* Make sure fetch stage is enabled to start fetching from new PC */
+    cpu->fetch.has_insn = TRUE;
+}
 
-            if(cpu->fetch.opcode == OPCODE_BNZ || cpu->fetch.opcode == OPCODE_BZ || cpu->fetch.opcode == OPCODE_BNP || cpu->fetch.opcode == OPCODE_BP){
+/*
+ * Pushes the return address of a fetched JALR and predicts a fetched
+ * return from the RAS. Records the RAS state the instruction leaves behind.
+ */
+static void
+predict_return_address(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int return_pc;
 
-    // Search for the entry in the BTB
-    // print btb_index, outcome_bit, calc_target_address
-    // printf("BTB INDEX: %d\n", search_entry_in_btb(cpu, cpu->fetch.pc));
-   
+    stage->ras_predicted = FALSE;
+    if (cpu->config.ras_depth && stage->opcode == OPCODE_JALR)
+    {
+        cpu->stats.ras_pushes++;
+        if (APEX_ras_push(&cpu->ras, stage->pc + 4))
+        {
+            cpu->stats.ras_overflows++;
+        }
+    }
+    else if (cpu->config.ras_depth && APEX_is_return(stage->opcode, stage->imm))
+    {
+        if (APEX_ras_pop(&cpu->ras, &return_pc))
+        {
+            cpu->stats.ras_pops++;
+            stage->ras_predicted = TRUE;
+            cpu->pc = return_pc;
+        }
+        else
+        {
+            cpu->stats.ras_underflows++;
+        }
+    }
+    APEX_ras_save(&cpu->ras, &stage->ras);
+}
 
-            int btb_index = search_entry_in_btb(cpu, cpu->pc);
-            if(btb_index >= 0){
-                // Check if the opcode is BNZ or BP and the outcome bit is not 0
-                if( (cpu->fetch.opcode == OPCODE_BNZ || cpu->fetch.opcode == OPCODE_BP) && cpu->BTB_array[btb_index].outcome_bit != 0 ){
-                    cpu->pc = cpu->BTB_array[btb_index].calc_target_address;
-                }
-                // Check if the opcode is BZ or BNP and the outcome bit is 2
-                else if((cpu->fetch.opcode == OPCODE_BZ || cpu->fetch.opcode == OPCODE_BNP) && cpu->BTB_array[btb_index].outcome_bit == 2 ){
-                    cpu->pc = cpu->BTB_array[btb_index].calc_target_address;
-                }
-                else{
-                    cpu->pc += 4;
-                }
-                        }
-                                    
-            else{
-                // Add the entry in the BTB
-                // add_entry_in_BTB(cpu, cpu->pc);
+/*
+ * Chooses the PC to fetch after the instruction just fetched into stage,
+ * which is at cpu->pc, and advances cpu->pc to it
+ */
+void
+APEX_predict_next_pc(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    // fetch code for BTB
+    // BTB will be used for - BNZ, BZ, BNP and BP, only entries whose
+    // target has been resolved once are used for prediction
+    // the direction comes from the predictor chosen by config.bpred
+    cpu->pc += 4;
+    stage->bpred_history = cpu->bpred.history;
+    stage->bpred_taken = FALSE;
+    if (APEX_is_btb_branch(stage->opcode))
+    {
+        int btb_index = search_entry_in_btb(cpu, stage->pc);
+        const BTB_entry *entry = NULL;
 
-                cpu->pc += 4;
-            }
+        if (btb_index >= 0 && cpu->BTB_array[btb_index].completion_status == 1)
+        {
+            cpu->stats.btb_hits++;
+            touch_btb_entry(cpu, btb_index);
+            entry = &cpu->BTB_array[btb_index];
         }
-        else{
-            cpu->pc += 4;
+        else
+        {
+            cpu->stats.btb_misses++;
         }
-        
 
-        
-        if(!cpu->decode.stalling_value)
+        stage->bpred_taken = APEX_bpred_predict(&cpu->bpred, stage->pc,
+                                                stage->opcode, entry);
+        if (entry && stage->bpred_taken)
         {
-            // cpu->pc += 4;
-            cpu->decode = cpu->fetch;
+            cpu->pc = entry->calc_target_address;
+        }
+        APEX_bpred_push(&cpu->bpred, cpu->pc != stage->pc + 4);
+    }
+    predict_return_address(cpu, stage);
+    stage->predicted_pc = cpu->pc;
+}
+
+/* Fetches the instruction at cpu->pc, which is at code_index, into a latch */
+static void
+fill_fetch_latch(APEX_CPU *cpu, CPU_Stage *latch, int code_index)
+{
+    const APEX_Instruction *current_ins = &cpu->code_memory[code_index];
+
+    latch->has_insn = TRUE;
+    latch->stalling_value = 0;
+    latch->pc = cpu->pc;
+    latch->seq = cpu->next_seq++;
+    latch->code_index = code_index;
+    latch->opcode = current_ins->opcode;
+    latch->rd = current_ins->rd;
+    latch->rs1 = current_ins->rs1;
+    latch->rs2 = current_ins->rs2;
+    latch->imm = current_ins->imm;
+
+    APEX_predict_next_pc(cpu, latch);
+}
+
+/*
+ * Fetch of the dual-issue pipeline: fetches an instruction for every free
+ * decode slot, U first, and stops after a predicted taken control transfer.
+ * Decode always empties the U slot first, so nothing is held in fetch.
+ */
+static void
+fetch_pair(APEX_CPU *cpu)
+{
+    CPU_Stage *latches[APEX_MAX_ISSUE_WIDTH] = { &cpu->fetch, &cpu->fetch_v };
+    CPU_Stage *latch;
+    CPU_Stage *slot;
+    int code_index;
+    int n;
+
+    cpu->outputDisplay[0].has_insn = FALSE;
+    cpu->outputDisplay_v[0].has_insn = FALSE;
+    if (!cpu->fetch.has_insn)
+    {
+        return;
+    }
+
+    /* This fetches new branch target instruction from next cycle */
+    if (cpu->fetch_from_next_cycle == TRUE)
+    {
+        cpu->fetch_from_next_cycle = FALSE;
+        cpu->fetch_redirected = TRUE;
+        return;
+    }
+
+    for (n = 0; n < APEX_MAX_ISSUE_WIDTH; ++n)
+    {
+        slot = !cpu->decode.has_insn ? &cpu->decode
+               : !cpu->decode_v.has_insn ? &cpu->decode_v : NULL;
+        code_index = get_code_memory_index_from_pc(cpu->pc);
+        if (!slot || code_index < 0 || code_index >= cpu->code_memory_size
+            || !APEX_fetch_ready(cpu))
+        {
+            break;
         }
 
+        latch = latches[n];
+        fill_fetch_latch(cpu, latch, code_index);
+        *slot = *latch;
+        if (n == 0)
+        {
+            cpu->outputDisplay[0] = *latch;
+        }
         else
         {
-            cpu->fetch.stalling_value = 1;
+            cpu->outputDisplay_v[0] = *latch;
         }
-        outputDisplay[0] = cpu->fetch;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_FETCH, latch->pc))
         {
-            print_stage_content("Fetch", &cpu->fetch);
+            APEX_print_stage("Fetch", latch);
         }
 
         /* Stop fetching new instructions if HALT is fetched */
-        if (cpu->fetch.opcode == OPCODE_HALT && !cpu->decode.stalling_value)
+        if (latch->opcode == OPCODE_HALT)
         {
-            cpu->decode = cpu->fetch; 
-            // whaa??
             cpu->fetch.has_insn = FALSE;
+            break;
+        }
+        if (latch->predicted_pc != latch->pc + 4)
+        {
+            break;
         }
     }
-    // else{
-       outputDisplay[0] = cpu->fetch; //fetch
-    // }
 }
 
+/* Returns TRUE if decode fuses compares with their branch */
+static int
+fusion_active(const APEX_CPU *cpu)
+{
+    return cpu->config.fusion && cpu->config.issue_width == 1;
+}
+
+static int
+is_compare(int opcode)
+{
+    return opcode == OPCODE_CMP || opcode == OPCODE_CML;
+}
 
 /*
- * Decode Stage of APEX Pipeline
+ * Fusion: when decode just took a compare, fetches the conditional branch
+ * after it into the V decode slot in the same cycle, so that decode sees
+ * the pair as one compare-and-branch micro-op
+ */
+static void
+fetch_fused_branch(APEX_CPU *cpu)
+{
+    int code_index = get_code_memory_index_from_pc(cpu->pc);
+
+    if (!fusion_active(cpu) || !is_compare(cpu->decode.opcode)
+        || cpu->pc != cpu->decode.pc + 4
+        || code_index < 0 || code_index >= cpu->code_memory_size
+        || !(cpu->code_memory[code_index].operand_class & APEX_OPND_USES_FLAGS)
+        || !APEX_fetch_ready(cpu))
+    {
+        return;
+    }
+
+    fill_fetch_latch(cpu, &cpu->fetch_v, code_index);
+    cpu->decode_v = cpu->fetch_v;
+    cpu->outputDisplay_v[0] = cpu->fetch_v;
+    if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_FETCH, cpu->fetch_v.pc))
+    {
+        APEX_print_stage("Fetch (fused)", &cpu->fetch_v);
+    }
+}
+
+/*
+ * Fetch Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static void
-APEX_decode(APEX_CPU *cpu)
+APEX_fetch(APEX_CPU *cpu)
 {
+    APEX_Instruction *current_ins;
+    int code_index;
 
+    if (cpu->config.issue_width > 1)
+    {
+        fetch_pair(cpu);
+        return;
+    }
 
-    if (cpu->decode.has_insn)
+    /* Hand over the instruction held while decode was stalled */
+    if (cpu->fetch.has_insn && cpu->fetch.stalling_value)
     {
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
+        if (!cpu->decode.stalling_value)
         {
-            
+            cpu->fetch.stalling_value = 0;
+            cpu->decode = cpu->fetch;
+            fetch_fused_branch(cpu);
 
-            case OPCODE_LOADP:
+            /* Stop fetching new instructions if HALT is fetched */
+            if (cpu->fetch.opcode == OPCODE_HALT)
             {
-                // implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get 1 VAL from immediate
-
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-
-                break;
+                cpu->fetch.has_insn = FALSE;
             }
+        }
+        cpu->outputDisplay[0] = cpu->fetch;
+        return;
+    }
 
-           
+    if (cpu->fetch.has_insn)
+    {
+        /* This fetches new branch target instruction from next cycle */
+        if (cpu->fetch_from_next_cycle == TRUE)
+        {
+            cpu->fetch_from_next_cycle = FALSE;
+            cpu->fetch_redirected = TRUE;
 
-            case OPCODE_STOREP:
-            {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                //will get 1 VAL from immediate
+            /* Skip this cycle*/
+             cpu->outputDisplay[0].has_insn = 0; //fetch
+            return;
+        }
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if(cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                
+        /* Nothing to fetch outside code memory, wait for a redirect */
+        code_index = get_code_memory_index_from_pc(cpu->pc);
+        if (code_index < 0 || code_index >= cpu->code_memory_size)
+        {
+            cpu->outputDisplay[0].has_insn = 0;
+            return;
+        }
 
-                break;
-            }
+        /* Bubble while the L1I line is missing */
+        if (!APEX_fetch_ready(cpu))
+        {
+            cpu->outputDisplay[0].has_insn = 0;
+            return;
+        }
 
+        /* Store current PC in fetch latch */
+        cpu->fetch.pc = cpu->pc;
+        cpu->fetch.seq = cpu->next_seq++;
 
+        /* Index into code memory using this pc and copy all instruction fields
+         * into fetch latch  */
+        cpu->fetch.code_index = code_index;
+        current_ins = &cpu->code_memory[code_index];
+        cpu->fetch.opcode = current_ins->opcode;
+        cpu->fetch.rd = current_ins->rd;
+        cpu->fetch.rs1 = current_ins->rs1;
+        cpu->fetch.rs2 = current_ins->rs2;
+        cpu->fetch.imm = current_ins->imm;
 
+        APEX_predict_next_pc(cpu, &cpu->fetch);
 
-            case OPCODE_ADD:
-           {
+        if(!cpu->decode.stalling_value)
+        {
+            cpu->decode = cpu->fetch;
+            fetch_fused_branch(cpu);
+        }
 
-            // implement forwarding 
-            cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-            cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+        else
+        {
+            cpu->fetch.stalling_value = 1;
+        }
+        cpu->outputDisplay[0] = cpu->fetch;
 
-            if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-            {
-                cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-            }
-            if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-            {
-                cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-            }
-            break;
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_FETCH, cpu->fetch.pc))
+        {
+            APEX_print_stage("Fetch", &cpu->fetch);
+        }
 
-           }
+        /* Stop fetching new instructions if HALT is fetched */
+        if (cpu->fetch.opcode == OPCODE_HALT && !cpu->fetch.stalling_value)
+        {
+            cpu->fetch.has_insn = FALSE;
+        }
+    }
+    cpu->outputDisplay[0] = cpu->fetch; //fetch
+}
 
-            case OPCODE_SUB:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            
-            }
-            
-            case OPCODE_MUL:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+/* Function unit which executes an instruction */
+static int
+fu_of(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            
-            }
-            
+    if (operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+    {
+        return APEX_FU_AGU;
+    }
+    if (operand_class & APEX_OPND_CTRL)
+    {
+        return APEX_FU_BRANCH;
+    }
+    if (stage->opcode == OPCODE_MUL)
+    {
+        return APEX_FU_MUL;
+    }
+    if (stage->opcode == OPCODE_DIV)
+    {
+        return APEX_FU_DIV;
+    }
+    return APEX_FU_ALU;
+}
 
-            case OPCODE_DIV:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+/* Execute cycles of an instruction whose operands have been read */
+static int
+unit_latency(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    switch (fu_of(cpu, stage))
+    {
+        case APEX_FU_MUL:
+            return cpu->config.mul_latency;
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            
-            }
+        case APEX_FU_DIV:
+            return APEX_div_latency(&cpu->config, stage->rs1_value, stage->rs2_value);
+    }
+    return 1;
+}
 
-            case OPCODE_SUBL:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
+/* Returns TRUE if the instruction writes reg */
+static int
+writes_register(const APEX_CPU *cpu, const CPU_Stage *stage, int reg)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                break;
-            
-            }
+    return ((operand_class & APEX_OPND_RD) && stage->rd == reg)
+           || ((operand_class & APEX_OPND_POST_INC)
+               && APEX_post_inc_reg(stage->opcode, stage->rs1, stage->rs2) == reg);
+}
 
-            case OPCODE_ADDL:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
-
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                break;
-            
-            }
-
-            case OPCODE_AND:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            
-            }
-
-            case OPCODE_OR:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+/*
+ * Returns TRUE if a control transfer in decode would execute before the
+ * youngest older instruction which sets the flags. Register sources are
+ * covered by the forwarding state.
+ */
+static int
+execute_hazard(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    const CPU_Stage *setter = NULL;
+    int i;
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            
-            }
+    if (!(cpu->code_memory[stage->code_index].operand_class & APEX_OPND_USES_FLAGS))
+    {
+        return FALSE;
+    }
 
-            case OPCODE_XOR:
-            {
-                //implement forwarding 
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+    for (i = 0; i < cpu->fu_window_count; ++i)
+    {
+        if (cpu->code_memory[cpu->fu_window[i].code_index].operand_class
+            & APEX_OPND_SETS_FLAGS)
+        {
+            setter = &cpu->fu_window[i];
+        }
+    }
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-                
-            }
+    /* Instructions of the same cycle execute oldest first */
+    return setter && setter->fu_latency - setter->exec_cycles > unit_latency(cpu, stage);
+}
 
-           
-        
+/*
+ * Reads the source operands of the instruction in a decode latch and sets
+ * its stalling_value. Returns FALSE if a source is not available yet.
+ */
+static int
+decode_operands(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
+    int operands_ready = TRUE;
 
-            case OPCODE_LOAD:
-            {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                break;
-            }
+    /* Read operands from register file based on the instruction type */
+    if (operand_class & APEX_OPND_RS1)
+    {
+        operands_ready &= read_source_register(cpu, stage->rs1, &stage->rs1_value);
+    }
+    if (operand_class & APEX_OPND_RS2)
+    {
+        operands_ready &= read_source_register(cpu, stage->rs2, &stage->rs2_value);
+    }
 
-            case OPCODE_STORE:
-            {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                //will get from immediate
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if(cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
-            }
+    // stall until a value which is not produced yet can be forwarded
+    if (!operands_ready
+        && APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_FORWARDING, stage->pc))
+    {
+        printf("Forward        : pc(%d) waits for a source operand\n", stage->pc);
+    }
+    if (operands_ready && execute_hazard(cpu, stage))
+    {
+        operands_ready = FALSE;
+        if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_FORWARDING, stage->pc))
+        {
+            printf("Forward        : pc(%d) waits for an older multi-cycle result\n",
+                   stage->pc);
+        }
+    }
+    stage->stalling_value = !operands_ready;
 
-            
-            
-            
+    switch (stage->opcode)
+    {
+        case OPCODE_MOVC:
+        {
+            /* MOVC doesn't have register operands, it waits for an
+             * older MOVC to the same register */
+            stage->stalling_value = cpu->flags_for_regs[stage->rd]
+                                    || !operands_ready;
+            break;
+        }
 
-            case OPCODE_MOVC:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BZ:
+        {
+            // first time this branch is seen - add it to the BTB
+            if (search_entry_in_btb(cpu, stage->pc) == -1)
             {
-                /* MOVC doesn't have register operands */
-                if (!cpu->flags_for_regs[cpu->decode.rd])
-                {
-                    cpu->flags_for_regs[cpu->decode.rd] = 1;
-                    cpu->decode.stalling_value = 0;
-                }
-                else
-                {
-                    cpu->decode.stalling_value = 1;
-                }
-
-                break;
+                add_btb_branch(cpu, stage->pc, stage->opcode);
             }
+            break;
+        }
+    }
 
-            case OPCODE_CMP:
-            {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
+    return operands_ready;
+}
 
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                if (cpu->regs_status_pending[cpu->decode.rs2] == 1)
-                {
-                    cpu->decode.rs2_value = cpu->regs_value_pending[cpu->decode.rs2];
-                }
-                break;
+/* Address the MSHRs track: the L1D line, or the word without an L1D */
+static int
+mshr_line(const APEX_CPU *cpu, int address)
+{
+    return cpu->config.l1d.size ? address & ~(cpu->config.l1d.line_size - 1)
+                                : address;
+}
 
-                
-            }
+/* Index of the MSHR of line, or -1 */
+static int
+find_mshr(const APEX_CPU *cpu, int line)
+{
+    int i;
 
-            case OPCODE_CML:
-            {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                break;
-            }
+    for (i = 0; i < cpu->mshrs.count; ++i)
+    {
+        if (cpu->mshrs.entries[i].line == line)
+        {
+            return i;
+        }
+    }
 
-            case OPCODE_NOP:
-            {
-                /* NOP doesn't have register operands */
-                break;
-            }
+    return -1;
+}
 
-            case OPCODE_JUMP:
-            {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
-                {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
-                }
-                break;
-            }
+/* Returns TRUE if a source of the instruction is a load waiting in an MSHR */
+static int
+waits_for_mshr(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
+    int sources[2];
+    int num_sources = 0;
+    int i;
+    int j;
+    int k;
 
-            case OPCODE_JALR:
+    if (operand_class & APEX_OPND_RS1)
+    {
+        sources[num_sources++] = stage->rs1;
+    }
+    if (operand_class & APEX_OPND_RS2)
+    {
+        sources[num_sources++] = stage->rs2;
+    }
+    for (k = 0; k < num_sources; ++k)
+    {
+        if (cpu->regs_status_pending[sources[k]] != PENDING_WAIT)
+        {
+            continue;
+        }
+        for (i = 0; i < cpu->mshrs.count; ++i)
+        {
+            for (j = 0; j < cpu->mshrs.entries[i].num_targets; ++j)
             {
-                //implement forwarding
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                //will get from immediate
-                if(cpu->regs_status_pending[cpu->decode.rs1] == 1)
+                if (cpu->mshrs.entries[i].targets[j].seq
+                    == cpu->regs_pending_seq[sources[k]])
                 {
-                    cpu->decode.rs1_value = cpu->regs_value_pending[cpu->decode.rs1];
+                    return TRUE;
                 }
-                break;
             }
+        }
+    }
 
-            case OPCODE_BNZ:
-            {
-                int btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                if (btb_index==-1)
-                {
-                    update_btb_entry(cpu, cpu->decode.pc,-1);
-                    btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                    // cpu->BTB_array[btb_index].outcome_bit = 0;
-                    cpu->BTB_array[btb_index].outcome_bit = 2;
-                    
-                    cpu->BTB_array[btb_index].completion_status = 0;
-                    // cpu->BTB_array[btb_index].calc_target_address = cpu->decode.pc + cpu->decode.imm;
+    return FALSE;
+}
 
-                }
-                break;
-                
-            }
+/* Moves a decoded instruction into an execute latch */
+static void
+issue_to_execute(APEX_CPU *cpu, CPU_Stage *stage, CPU_Stage *execute)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
 
-            case OPCODE_BP:
-            {
-                 int btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                if (btb_index==-1)
-                {
-                    update_btb_entry(cpu, cpu->decode.pc,-1);
-                    btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                    // cpu->BTB_array[btb_index].outcome_bit = 0;
-                    cpu->BTB_array[btb_index].outcome_bit = 2;
-                    
-                    cpu->BTB_array[btb_index].completion_status = 0;
-                    // cpu->BTB_array[btb_index].calc_target_address = cpu->decode.pc + cpu->decode.imm;
+    if (stage->opcode == OPCODE_MOVC)
+    {
+        cpu->flags_for_regs[stage->rd] = 1;
+    }
 
-                }
-                break;
-                
-            }
-            
-            
-            case OPCODE_BNP:
-            {
-                int btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                if (btb_index==-1)
-                {
-                    update_btb_entry(cpu, cpu->decode.pc,-1);
-                    btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                    // cpu->BTB_array[btb_index].outcome_bit = 0;
-                    cpu->BTB_array[btb_index].outcome_bit = 0;
-                    
-                    cpu->BTB_array[btb_index].completion_status = 0;
-                    // cpu->BTB_array[btb_index].calc_target_address = cpu->decode.pc + cpu->decode.imm;
+    /* Younger readers wait until the result is produced */
+    if (operand_class & APEX_OPND_RD)
+    {
+        mark_result_pending(cpu, stage, stage->rd);
+    }
+    if (operand_class & APEX_OPND_POST_INC)
+    {
+        mark_result_pending(cpu, stage,
+                            APEX_post_inc_reg(stage->opcode, stage->rs1, stage->rs2));
+    }
 
-                }
-                break;
-            }
-            case OPCODE_BZ:
-            {
-                int btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                if (btb_index==-1)
-                {
-                    update_btb_entry(cpu, cpu->decode.pc,-1);
-                    btb_index = search_entry_in_btb(cpu, cpu->decode.pc);
-                    // cpu->BTB_array[btb_index].outcome_bit = 0;
-                    cpu->BTB_array[btb_index].outcome_bit = 0;
-                    
-                    cpu->BTB_array[btb_index].completion_status = 0;
-                    // cpu->BTB_array[btb_index].calc_target_address = cpu->decode.pc + cpu->decode.imm;
+    *execute = *stage;
+    stage->has_insn = FALSE;
+}
 
-                }
-                break;
-                
-            }
-            
+/*
+ * Returns the APEX_PAIR_* reason why the instruction in the V decode slot
+ * can not issue together with the one which just left the U slot, or -1.
+ * Compare and branch may pair: execute runs the U pipe first.
+ */
+static int
+pairing_failure(APEX_CPU *cpu, const CPU_Stage *u, CPU_Stage *v)
+{
+    int u_class = cpu->code_memory[u->code_index].operand_class;
+    int v_class;
 
+    if (!v->has_insn)
+    {
+        return APEX_PAIR_NO_SECOND;
+    }
 
+    v_class = cpu->code_memory[v->code_index].operand_class;
+    if ((u_class & APEX_OPND_CTRL) || u->opcode == OPCODE_HALT
+        || v->opcode == OPCODE_HALT)
+    {
+        return APEX_PAIR_CONTROL;
+    }
 
+    /* V can not use the results of U, and a branch in V would read the
+     * flags before a multi-cycle U sets them */
+    if (((v_class & APEX_OPND_RS1) && writes_register(cpu, u, v->rs1))
+        || ((v_class & APEX_OPND_RS2) && writes_register(cpu, u, v->rs2))
+        || ((v_class & APEX_OPND_RD) && writes_register(cpu, u, v->rd))
+        || ((v_class & APEX_OPND_POST_INC)
+            && writes_register(cpu, u, APEX_post_inc_reg(v->opcode, v->rs1, v->rs2)))
+        || ((u_class & APEX_OPND_SETS_FLAGS) && unit_latency(cpu, u) > 1
+            && (v_class & APEX_OPND_USES_FLAGS)))
+    {
+        return APEX_PAIR_DEPENDENCY;
+    }
 
-        }
-      outputDisplay[1] = cpu->decode; //decode
-        /* Copy data from decode latch to execute latch*/
-        // only execute when the register is not busy
-        
-        // cpu->execute = cpu->decode;
-        // cpu->decode.has_insn = FALSE;
+    decode_operands(cpu, v);
+    if (v->stalling_value)
+    {
+        return APEX_PAIR_OPERANDS;
+    }
+    if (fu_of(cpu, u) == fu_of(cpu, v))
+    {
+        return APEX_PAIR_UNIT;
+    }
+    return -1;
+}
 
-     // if decode.stalling_value is 0 then only copy the data from decode to execute
-     if(!cpu->decode.stalling_value)
-        {
-            cpu->execute = cpu->decode;
-            cpu->decode.has_insn = FALSE;
-        }
-        
-        
-          
+/*
+ * Issues the V slot next to the instruction which just issued from the U
+ * slot, or moves it up to the U slot for the next cycle
+ */
+static void
+issue_second(APEX_CPU *cpu)
+{
+    int reason = pairing_failure(cpu, &cpu->execute, &cpu->decode_v);
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Decode/RF", &cpu->decode);
-        }
+    if (reason < 0)
+    {
+        issue_to_execute(cpu, &cpu->decode_v, &cpu->execute_v);
+        cpu->stats.pairs_issued++;
+        return;
     }
-    else{
-        outputDisplay[1] = cpu->decode; //decode
+
+    cpu->stats.pair_failures[reason]++;
+    if (cpu->decode_v.has_insn)
+    {
+        cpu->decode = cpu->decode_v;
+        cpu->decode.stalling_value = 0;
+        cpu->decode_v.has_insn = FALSE;
     }
 }
 
+/*
+ * Fusion: issues the branch fetched with the compare which just left decode
+ * in the same slot. Execute resolves it right after the compare sets the
+ * flags. A branch which would have to wait splits the pair and stays in
+ * decode on its own.
+ */
+static void
+issue_fused(APEX_CPU *cpu)
+{
+    if (is_compare(cpu->execute.opcode))
+    {
+        cpu->stats.fusion_compares++;
+    }
+    if (!cpu->decode_v.has_insn)
+    {
+        return;
+    }
 
+    decode_operands(cpu, &cpu->decode_v);
+    if (!cpu->decode_v.stalling_value)
+    {
+        issue_to_execute(cpu, &cpu->decode_v, &cpu->execute_v);
+        cpu->stats.fused_pairs++;
+        return;
+    }
 
+    /* Stalled, so that fetch does not replace it this cycle */
+    cpu->decode = cpu->decode_v;
+    cpu->decode.stalling_value = 1;
+    cpu->decode_v.has_insn = FALSE;
+}
 
 /*
- * Execute Stage of APEX Pipeline
+ * Decode Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
 static void
-APEX_execute(APEX_CPU *cpu)
+APEX_decode(APEX_CPU *cpu)
 {
-    if (cpu->execute.has_insn)
+    cpu->outputDisplay_v[1] = cpu->decode_v;
+    if (cpu->decode.has_insn)
     {
-        /* Execute logic based on instruction type */
-        switch (cpu->execute.opcode)
-        {
+        int operands_ready = decode_operands(cpu, &cpu->decode);
 
-             case OPCODE_LOADP:
+        /* Execute is still busy with a multi-cycle instruction */
+        if (cpu->execute.has_insn)
         {
-
-            cpu->execute.memory_address = cpu->execute.rs1_value + cpu->execute.imm;
-            
-
-
-           cpu->execute.buff_temp = cpu->execute.rs1_value+4;
-            
-            break;
+            cpu->decode.stalling_value = 1;
         }
+        cpu->outputDisplay[1] = cpu->decode; //decode
 
-        case OPCODE_STOREP:
+     // if decode.stalling_value is 0 then only copy the data from decode to execute
+     if(!cpu->decode.stalling_value)
         {
-            // cpu->execute.result_buffer = cpu->execute.rs1_value + cpu->execute.imm;
-            
-            cpu->execute.memory_address = cpu->execute.rs2_value + cpu->execute.imm;
-
-           cpu->execute.buff_temp = cpu->execute.rs2_value+4;
-            
-            break;
+            issue_to_execute(cpu, &cpu->decode, &cpu->execute);
+            cpu->stats.slots[APEX_SLOT_RETIRING]++;
+            if (cpu->config.issue_width > 1)
+            {
+                issue_second(cpu);
+            }
+            else if (fusion_active(cpu))
+            {
+                issue_fused(cpu);
+            }
         }
-
-            case OPCODE_ADD:
+        else
+        {
+            cpu->stats.decode_stalls++;
+            if (cpu->decode.opcode == OPCODE_MOVC
+                && cpu->flags_for_regs[cpu->decode.rd])
             {
-              
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-
-
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-                }
-
-                // the below part is not required as we are setting the zero flag in the setZeroFlag function
-                // if (cpu->execute.result_buffer == 0)
-                // {
-                //     cpu->zero_flag = TRUE;
-                // } 
-                // else 
-                // {
-                //     cpu->zero_flag = FALSE;
-                // }
-                // break;
-            // }
-            
-
-            case OPCODE_SUB:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
+                cpu->stats.slots[APEX_SLOT_MOVC_INTERLOCK]++;
             }
-
-            case OPCODE_MUL:
+            else if (!operands_ready)
             {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value * cpu->execute.rs2_value;
-
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                break;
-
-                
+                cpu->stats.slots[APEX_SLOT_OPERAND_WAIT]++;
+                cpu->stats.mshr_use_stalls += waits_for_mshr(cpu, &cpu->decode);
             }
-
-            case OPCODE_DIV:
+            else
             {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value / cpu->execute.rs2_value;
+                cpu->stats.slots[APEX_SLOT_BACKEND]++;
+            }
+        }
 
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_DECODE,
+                         cpu->outputDisplay[1].pc))
+        {
+            APEX_print_stage("Decode/RF", &cpu->outputDisplay[1]);
+        }
+        if (cpu->execute_v.has_insn && cpu->execute_v.seq == cpu->outputDisplay_v[1].seq
+            && APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_DECODE,
+                            cpu->execute_v.pc))
+        {
+            APEX_print_stage("Decode/RF (V)", &cpu->execute_v);
+        }
+    }
+    else{
+        cpu->outputDisplay[1] = cpu->decode; //decode
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                  cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-            }
+        /* A redirect leaves decode empty in its own and the next cycle */
+        if (cpu->fetch_from_next_cycle || cpu->fetch_redirected)
+        {
+            cpu->stats.slots[APEX_SLOT_BAD_SPECULATION]++;
+        }
+        else if (!cpu->fetch.has_insn)
+        {
+            /* Fetch only stops after HALT */
+            cpu->stats.slots[APEX_SLOT_HALT_DRAIN]++;
+        }
+        else
+        {
+            cpu->stats.slots[APEX_SLOT_FRONTEND]++;
+        }
+    }
+    cpu->fetch_redirected = FALSE;
+}
 
-            case OPCODE_AND:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value & cpu->execute.rs2_value;
+/*
+ * Resolves BZ, BNZ, BP, BNP, BN, BNN, JUMP and JALR in execute. Fetch is
+ * redirected only if it did not already continue at the correct PC.
+ */
+static void
+resolve_control_transfer(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int taken = TRUE;
+    int target;
+    int next_pc;
 
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-                
+    switch (stage->opcode)
+    {
+        case OPCODE_JALR:
+        {
+            stage->result_buffer = stage->pc + 4;
+            forward_result(cpu, stage, stage->rd, stage->result_buffer);
+            target = APEX_add(stage->rs1_value, stage->imm);
+            break;
+        }
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-            }
+        case OPCODE_JUMP:
+        {
+            target = APEX_add(stage->rs1_value, stage->imm);
+            break;
+        }
 
-            case OPCODE_OR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value | cpu->execute.rs2_value;
+        default:
+        {
+            target = stage->pc + stage->imm;
+            taken = APEX_branch_taken(stage->opcode, cpu);
+            break;
+        }
+    }
 
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-                
+    if (APEX_is_btb_branch(stage->opcode))
+    {
+        BTB_entry *entry = update_btb_outcome(cpu, stage->pc, taken, target);
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-            }
+        APEX_bpred_update(&cpu->bpred, stage->pc, stage->opcode,
+                          stage->bpred_history, entry, taken);
+        cpu->stats.direction_predictions++;
+        if (stage->bpred_taken != taken)
+        {
+            cpu->stats.direction_mispredictions++;
+        }
+    }
 
-            case OPCODE_XOR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
+    cpu->stats.branches++;
+    next_pc = taken ? target : stage->pc + 4;
+    if (stage->ras_predicted && next_pc != stage->predicted_pc)
+    {
+        cpu->stats.ras_mispredictions++;
+    }
+    if (next_pc != stage->predicted_pc)
+    {
+        cpu->stats.mispredictions++;
+        redirect_fetch(cpu, next_pc);
+        APEX_bpred_repair(&cpu->bpred, stage->bpred_history,
+                          APEX_is_btb_branch(stage->opcode), taken);
 
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-                
+        /* Undo the pushes and pops of the squashed instructions */
+        if (cpu->config.ras_depth)
+        {
+            cpu->stats.ras_repairs += APEX_ras_repair(&cpu->ras, &stage->ras);
+        }
+    }
+}
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-            }
+/*
+ * Returns FALSE if a younger instruction already set the flags because it
+ * finished in a faster function unit, otherwise the flags are its own
+ */
+static int
+claim_flags(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    if (stage->seq < cpu->flags_seq)
+    {
+        return FALSE;
+    }
+    cpu->flags_seq = stage->seq;
+    return TRUE;
+}
 
+/*
+ * Works on an instruction in a function unit, the result is computed in
+ * the last cycle of its latency. Returns TRUE once it is done.
+ */
+static int
+execute_insn(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    stage->exec_cycles++;
+    if (stage->exec_cycles == stage->fu_latency)
+    {
+        /* Execute logic based on instruction type */
+        switch (stage->opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            case OPCODE_ADDL:
             case OPCODE_SUBL:
             {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.imm;
+                stage->result_buffer = APEX_alu_result(stage->opcode, stage->rs1_value,
+                                                       stage->rs2_value, stage->imm);
 
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
+                /* Set the flags based on the result buffer */
+                if (claim_flags(cpu, stage))
                 {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
+                    APEX_set_flags(cpu, stage->result_buffer);
                 }
-                
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
+                forward_result(cpu, stage, stage->rd, stage->result_buffer);
                 break;
             }
 
-            case OPCODE_ADDL:
+            case OPCODE_MOVC:
             {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-
-                /* Set the zero flag based on the result buffer */
-                // Setzero_Flag(cpu);
-
-                // print result buffer
-                // printf("Result buffer is %d\n", cpu->execute.result_buffer);
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                
-                else if (cpu->execute.result_buffer > 0) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
-                }
-
+                stage->result_buffer = stage->imm;
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
+                // no flags for MOVC, LOAD, LOADP, STORE, STOREP
+                forward_result(cpu, stage, stage->rd, stage->result_buffer);
                 break;
             }
 
             case OPCODE_CMP:
             {
                 //update flags based on comparison
-                if (cpu->execute.rs1_value == cpu->execute.rs2_value)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else if (cpu->execute.rs1_value > cpu->execute.rs2_value) 
+                if (claim_flags(cpu, stage))
                 {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
+                    APEX_compare(cpu, stage->rs1_value, stage->rs2_value);
                 }
-
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-                
                 break;
             }
 
             case OPCODE_CML:
             {
                 //update flags based on comparison
-                if (cpu->execute.rs1_value == cpu->execute.imm)
-                {
-                    cpu->zero_flag = TRUE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else if (cpu->execute.rs1_value > cpu->execute.imm) 
-                {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = TRUE;
-                    cpu -> neg_flag = FALSE;
-                } 
-                else 
+                if (claim_flags(cpu, stage))
                 {
-                    cpu->zero_flag = FALSE;
-                    cpu -> pos_flag = FALSE;
-                    cpu -> neg_flag = TRUE;
+                    APEX_compare(cpu, stage->rs1_value, stage->imm);
                 }
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-
                 break;
             }
 
-
-            case OPCODE_BP:
+            case OPCODE_LOAD:
             {
-                int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
-
-                //PRINT POS FLAG VALUE 
-                // printf("------------------------------------");
-                // printf("POS FLAG VALUE: %d\n", cpu->pos_flag);
-                
-
-                if(cpu->pos_flag == 1)
-                {
-                    update_branch_BP_BNZ(cpu);
-                }
-
-                else if( cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].outcome_bit == 0)
-                {
-
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                stage->memory_address = APEX_add(stage->rs1_value, stage->imm);
+                mark_result_pending(cpu, stage, stage->rd);
                 break;
             }
-            
-            case OPCODE_BZ:
-            {
-                int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
 
-                if (cpu->zero_flag == TRUE)
-                {
-
-                    update_branch_BZ_BNP(cpu);
-                }
+            case OPCODE_LOADP:
+            {
+                stage->memory_address = APEX_add(stage->rs1_value, stage->imm);
+                mark_result_pending(cpu, stage, stage->rd);
 
-                else if( cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].outcome_bit == 2)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                // rs1 is incremented in parallel with the address calculation
+                stage->buff_temp = APEX_add(stage->rs1_value, 4);
+                forward_result(cpu, stage, stage->rs1, stage->buff_temp);
                 break;
             }
 
-            case OPCODE_BNZ:
-            
+            case OPCODE_STORE:
             {
-
-             int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
-                if(cpu->zero_flag ==0)
+                // print to check if it is working
+                if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_MEMORY, stage->pc))
                 {
-                    update_branch_BP_BNZ(cpu);
+                    printf("STORE result buffer: %d\n", stage->result_buffer);
                 }
+                stage->result_buffer = stage->rs1_value;
 
-
-                //   or flush
-            // else if( cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].outcome_bit == 2)
-            
-            else if( cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].outcome_bit != 0)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc +4;
-                    // cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                stage->memory_address = APEX_add(stage->rs2_value, stage->imm);
                 break;
             }
 
-            case OPCODE_BNP:
+            case OPCODE_STOREP:
             {
-                int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
+                stage->memory_address = APEX_add(stage->rs2_value, stage->imm);
 
-                if(cpu->pos_flag == FALSE)
-                {
-                    update_branch_BZ_BNP(cpu);
-                }
-
-                else if( cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].outcome_bit == 2){
-
-                
-
-
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                // rs2 is incremented in parallel with the address calculation
+                stage->buff_temp = APEX_add(stage->rs2_value, 4);
+                forward_result(cpu, stage, stage->rs2, stage->buff_temp);
                 break;
             }
 
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_BP:
+            case OPCODE_BNP:
             case OPCODE_BN:
-            {
-                if(cpu->neg_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
             case OPCODE_BNN:
-            {
-                if(cpu->neg_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
-                break;
-            }
-
             case OPCODE_JUMP:
-            {
-                cpu->pc = cpu->execute.rs1_value + cpu->execute.imm;
-                    
-                /* Since we are using reverse callbacks for pipeline stages, 
-                 * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
-                // cpu->regs_status_pending[cpu->execute.rd] = 1;
-                // cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                break;
-            }
-
             case OPCODE_JALR:
             {
-                cpu->execute.result_buffer = cpu->execute.pc + 4;
-                cpu->pc = cpu->execute.rs1_value + cpu->execute.imm;
-                    
-                /* Since we are using reverse callbacks for pipeline stages, 
-                 * this will prevent the new instruction from being fetched in the current cycle*/
-                cpu->fetch_from_next_cycle = TRUE;
-
-                /* Flush previous stages */
-                cpu->decode.has_insn = FALSE;
-
-                /* Make sure fetch stage is enabled to start fetching from new PC */
-                cpu->fetch.has_insn = TRUE;
-
-                // cpu->regs_status_pending[cpu->execute.rd] = 1;
-                // cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
-
+                resolve_control_transfer(cpu, stage);
                 break;
             }
 
@@ -1416,449 +1291,1216 @@ APEX_execute(APEX_CPU *cpu)
                 /* NOP doesn't have any operation */
                 break;
             }
+        }
+    }
 
-            case OPCODE_STORE:
-            {
-                // print to check if it is working
-                printf("STORE result buffer: %d\n", cpu->execute.result_buffer);
-                cpu->execute.result_buffer = cpu->execute.rs1_value;
-                
-                cpu->execute.memory_address
-                    = cpu->execute.rs2_value + cpu->execute.imm;
-            
-                break;
-            }
+    return stage->exec_cycles >= stage->fu_latency;
+}
 
+/*
+ * Iterative divider with early out: it produces ceil(32 / div_latency)
+ * quotient bits per cycle and stops once the remaining bits are known to be
+ * zero, so small quotients take a single cycle
+ */
+int
+APEX_div_latency(const APEX_Config *config, int rs1_value, int rs2_value)
+{
+    unsigned int dividend = rs1_value < 0 ? 0u - (unsigned int)rs1_value
+                                          : (unsigned int)rs1_value;
+    unsigned int divisor = rs2_value < 0 ? 0u - (unsigned int)rs2_value
+                                         : (unsigned int)rs2_value;
+    int bits_per_cycle = (32 + config->div_latency - 1) / config->div_latency;
+    int quotient_bits = 1;
+
+    /* Division by zero produces 0 at once */
+    if (!divisor)
+    {
+        return 1;
+    }
+    while (quotient_bits < 32 && (divisor << 1) > divisor
+           && (divisor << 1) <= dividend)
+    {
+        divisor <<= 1;
+        quotient_bits++;
+    }
+    return (quotient_bits + bits_per_cycle - 1) / bits_per_cycle;
+}
 
+/* Instructions a function unit can hold, the multiplier is pipelined */
+static int
+fu_capacity(const APEX_CPU *cpu, int fu)
+{
+    return fu == APEX_FU_MUL ? cpu->config.mul_latency : 1;
+}
 
-            case OPCODE_LOAD:
-            { 
-                cpu->execute.memory_address
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-                break;
-            }
+static int
+fu_occupancy(const APEX_CPU *cpu, int fu)
+{
+    int count = 0;
+    int i;
 
-            
-            case OPCODE_MOVC: 
-            {
-                cpu->execute.result_buffer = cpu->execute.imm;
+    for (i = 0; i < cpu->fu_window_count; ++i)
+    {
+        count += cpu->fu_window[i].fu == fu;
+    }
+    return count;
+}
 
-                // no flags for MOVC, LOAD, LOADP, STORE, STOREP
+/* Moves an execute latch into its function unit */
+static void
+issue_to_unit(APEX_CPU *cpu, CPU_Stage *latch, int v_pipe)
+{
+    CPU_Stage *entry = &cpu->fu_window[cpu->fu_window_count++];
+
+    *entry = *latch;
+    entry->fu = fu_of(cpu, latch);
+    entry->fu_latency = unit_latency(cpu, latch);
+    entry->v_pipe = v_pipe;
+    cpu->stats.fu_issued[entry->fu]++;
+    latch->has_insn = FALSE;
+}
 
-                cpu->regs_status_pending[cpu->execute.rd] = 1;
-                cpu->regs_value_pending[cpu->execute.rd] = cpu->execute.result_buffer;
+/*
+ * Issues the execute latches to their function units, both instructions of
+ * a pair in the same cycle. Returns FALSE on a structural hazard.
+ */
+static int
+issue_to_units(APEX_CPU *cpu)
+{
+    int u_fu = fu_of(cpu, &cpu->execute);
 
-                break;
-                
-            }
-        
+    if (fu_occupancy(cpu, u_fu) >= fu_capacity(cpu, u_fu))
+    {
+        cpu->stats.fu_stalls[u_fu]++;
+        return FALSE;
+    }
+    if (cpu->execute_v.has_insn)
+    {
+        int v_fu = fu_of(cpu, &cpu->execute_v);
 
-        
+        if (fu_occupancy(cpu, v_fu) >= fu_capacity(cpu, v_fu))
+        {
+            cpu->stats.fu_stalls[v_fu]++;
+            return FALSE;
+        }
+    }
 
-        
+    issue_to_unit(cpu, &cpu->execute, FALSE);
+    if (cpu->execute_v.has_insn)
+    {
+        issue_to_unit(cpu, &cpu->execute_v, TRUE);
+    }
+    return TRUE;
+}
 
-        }
-         outputDisplay[2] = cpu->execute;
+/*
+ * Shows the youngest instructions in execute, those of the latches if a
+ * structural hazard holds them
+ */
+static void
+display_execute(APEX_CPU *cpu)
+{
+    int youngest = cpu->fu_window_count - 1;
+
+    if (cpu->execute.has_insn || youngest < 0)
+    {
+        cpu->outputDisplay[2] = cpu->execute;
+        cpu->outputDisplay_v[2] = cpu->execute_v;
+    }
+    else if (cpu->fu_window[youngest].v_pipe)
+    {
+        cpu->outputDisplay[2] = cpu->fu_window[youngest - 1];
+        cpu->outputDisplay_v[2] = cpu->fu_window[youngest];
+    }
+    else
+    {
+        cpu->outputDisplay[2] = cpu->fu_window[youngest];
+        cpu->outputDisplay_v[2].has_insn = FALSE;
+    }
+}
+
+/*
+ * Execute Stage of APEX Pipeline. The latches issue to the function units
+ * in order, all units work in parallel, and the oldest instruction (or
+ * pair) moves on to memory once it is done, so results complete in order.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+APEX_execute(APEX_CPU *cpu)
+{
+    CPU_Stage *window = cpu->fu_window;
+    int counted[APEX_NUM_FUS] = { 0 };
+    int num_done = 0;
+    int leaving;
+    int i;
 
-        /* Copy data from execute latch to memory latch*/
-        cpu->memory = cpu->execute;
-        cpu->execute.has_insn = FALSE;
+    if (cpu->execute.has_insn)
+    {
+        issue_to_units(cpu);
+    }
 
-        if (ENABLE_DEBUG_MESSAGES)
+    /* Older instructions first, they may set the flags a branch reads */
+    for (i = 0; i < cpu->fu_window_count; ++i)
+    {
+        if (execute_insn(cpu, &window[i]) && num_done == i)
         {
-            print_stage_content("Execute", &cpu->execute);
+            num_done++;
+        }
+        if (!counted[window[i].fu])
+        {
+            counted[window[i].fu] = TRUE;
+            cpu->stats.fu_busy[window[i].fu]++;
         }
     }
-     else{
-        outputDisplay[2] = cpu->execute;
+    display_execute(cpu);
+
+    /* Hold the instruction until it is done and memory is free */
+    leaving = (cpu->fu_window_count > 1 && window[1].v_pipe) ? 2 : 1;
+    if (num_done < leaving || cpu->memory.has_insn)
+    {
+        return;
+    }
+
+    /* Copy data from execute latch to memory latch*/
+    cpu->memory = window[0];
+    cpu->memory_v = window[1];
+    cpu->memory_v.has_insn = leaving == 2;
+    cpu->fu_window_count -= leaving;
+    memmove(window, window + leaving, cpu->fu_window_count * sizeof(CPU_Stage));
+
+    if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_EXECUTE, cpu->memory.pc))
+    {
+        APEX_print_stage("Execute", &cpu->memory);
+    }
+    if (cpu->memory_v.has_insn
+        && APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_EXECUTE, cpu->memory_v.pc))
+    {
+        APEX_print_stage("Execute (V)", &cpu->memory_v);
     }
 }
 
 /*
- * Memory Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
+ * Delivers the data of the MSHRs whose line has arrived by now, or of all
+ * of them. A load writes rd unless a younger producer of rd has issued.
  */
 static void
-APEX_memory(APEX_CPU *cpu)
+complete_mshrs(APEX_CPU *cpu, int all)
 {
-    if (cpu->memory.has_insn)
+    APEX_Mshr_File *mshrs = &cpu->mshrs;
+    int kept = 0;
+    int i;
+    int j;
+
+    for (i = 0; i < mshrs->count; ++i)
     {
-        switch (cpu->memory.opcode)
+        const APEX_Mshr *mshr = &mshrs->entries[i];
+
+        if (!all && mshr->ready > cpu->clock)
         {
-           
-            case OPCODE_STORE:
+            mshrs->entries[kept++] = *mshr;
+            continue;
+        }
+        for (j = 0; j < mshr->num_targets; ++j)
+        {
+            const APEX_Mshr_Target *target = &mshr->targets[j];
+
+            if (target->rd >= 0 && cpu->regs_pending_seq[target->rd] == target->seq)
             {
-                /* Store */
-                cpu->data_memory[cpu->memory.memory_address]
-                    = cpu->memory.rs1_value;
-                    //rs1
-                break;
+                cpu->regs[target->rd] = target->value;
+                cpu->regs_status_pending[target->rd] = PENDING_NONE;
             }
+        }
+    }
+    mshrs->count = kept;
+}
 
-            case OPCODE_LOAD:
+/*
+ * Starts a load entering memory. A load of a buffered store takes a cycle.
+ * With MSHRs a load which takes longer, or whose line is already on its
+ * way, reads its value now and leaves memory after a cycle, and its MSHR
+ * writes rd once the line arrives; younger instructions only wait if they
+ * read rd. Hits go ahead under misses. Returns FALSE if the load has to wait
+ * for a free MSHR.
+ */
+static int
+start_load(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int address = stage->memory_address;
+    int line = mshr_line(cpu, address);
+    int index = find_mshr(cpu, line);
+    int full = cpu->mshrs.count == cpu->config.mshrs;
+    APEX_Mshr *mshr;
+    APEX_Mshr_Target *target;
+    int latency;
+
+    if (cpu->config.store_buffer && APEX_store_buffer_find(cpu, address) >= 0)
+    {
+        cpu->stats.sb_forwards++;
+        stage->mem_latency = 1;
+        return TRUE;
+    }
+    if (!cpu->config.mshrs)
+    {
+        stage->mem_latency = APEX_data_access(cpu, stage->pc, address, FALSE);
+        return TRUE;
+    }
+
+    if ((index < 0 && full
+         && !(cpu->config.l1d.size && APEX_cache_contains(&cpu->l1d, address)))
+        || (index >= 0 && cpu->mshrs.entries[index].num_targets == APEX_MSHR_TARGETS))
+    {
+        cpu->stats.mshr_full_stalls++;
+        return FALSE;
+    }
+
+    latency = APEX_data_access(cpu, stage->pc, address, FALSE);
+    if (index < 0 && (latency == 1 || full))
+    {
+        /* A hit, or a slow hit on a prefetch in flight with no MSHR free */
+        stage->mem_latency = latency;
+        return TRUE;
+    }
+    stage->mem_latency = 1;
+
+    if (index < 0)
+    {
+        mshr = &cpu->mshrs.entries[cpu->mshrs.count++];
+        mshr->line = line;
+        mshr->ready = cpu->clock + latency - 1;
+        mshr->num_targets = 0;
+    }
+    else
+    {
+        mshr = &cpu->mshrs.entries[index];
+        if (cpu->clock + latency - 1 > mshr->ready)
+        {
+            mshr->ready = cpu->clock + latency - 1;
+        }
+        cpu->stats.mshr_merged++;
+    }
+
+    /* The LOADP increment wins when rd and rs1 are the same */
+    target = &mshr->targets[mshr->num_targets++];
+    target->seq = stage->seq;
+    target->rd = (stage->opcode == OPCODE_LOADP && stage->rd == stage->rs1)
+                 ? -1 : stage->rd;
+    target->value = APEX_read_data(cpu, address);
+    stage->in_mshr = TRUE;
+    cpu->stats.mshr_loads++;
+    return TRUE;
+}
+
+/*
+ * Works on the instruction in a memory latch. A load or store looks up the
+ * L1D when it enters and accesses data memory in the last cycle of its
+ * latency. With a store buffer a store instead waits for a free entry and
+ * leaves after a cycle, and with MSHRs a load may leave before its data
+ * (start_load). HALT waits until no store or load is outstanding. Returns
+ * TRUE once it is done.
+ */
+static int
+memory_insn(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
+    int buffered = cpu->config.store_buffer > 0;
+
+    if (stage->mem_cycles == 0)
+    {
+        /* Faults when it reaches writeback, without touching memory */
+        stage->fault = (operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+                       && !APEX_data_address_valid(stage->memory_address);
+        if (stage->fault)
+        {
+            stage->mem_latency = 1;
+        }
+        else if (operand_class & APEX_OPND_LOAD)
+        {
+            if (!start_load(cpu, stage))
             {
-                /* Read from data memory */
-                cpu->memory.result_buffer = cpu->data_memory[cpu->memory.memory_address];
-                break;
+                return FALSE;
             }
+        }
+        else if ((operand_class & APEX_OPND_STORE) && buffered)
+        {
+            if (!APEX_store_buffer_insert(cpu, stage->pc, stage->memory_address,
+                                          stage->rs1_value))
+            {
+                cpu->stats.sb_full_stalls++;
+                return FALSE;
+            }
+            stage->mem_latency = 1;
+        }
+        else if (operand_class & APEX_OPND_STORE)
+        {
+            stage->mem_latency = APEX_data_access(cpu, stage->pc,
+                                                  stage->memory_address, TRUE);
+        }
+        else if (stage->opcode == OPCODE_HALT
+                 && (cpu->store_buffer.count || cpu->mshrs.count))
+        {
+            return FALSE;
+        }
+        else
+        {
+            stage->mem_latency = 1;
+        }
+    }
 
-            case OPCODE_LOADP:
+    stage->mem_cycles++;
+    if (stage->mem_cycles == stage->mem_latency)
+    {
+        switch (stage->opcode)
+        {
+            case OPCODE_STORE:
+            case OPCODE_STOREP:
             {
-                /* Read from data memory */
-                cpu->memory.result_buffer= cpu->data_memory[cpu->memory.memory_address];
+                /* Store data from rs1 to data memory, or the store buffer did */
+                if (!buffered && !stage->fault)
+                {
+                    cpu->data_memory[stage->memory_address] = stage->rs1_value;
+                }
                 break;
             }
 
-            case OPCODE_STOREP:
+            case OPCODE_LOAD:
+            case OPCODE_LOADP:
             {
-                /* Store */
-                /*Store data from destination register to data memory */
-                 cpu->data_memory[cpu->memory.memory_address]  = cpu->memory.rs1_value;
-                
-                // cpu->data_memory[cpu->memory.memory_address] = cpu->memory.rs2_value;
+                if (stage->in_mshr || stage->fault)
+                {
+                    break;
+                }
+
+                /* Read from data memory, or a buffered store */
+                stage->result_buffer = APEX_read_data(cpu, stage->memory_address);
+
+                /* The LOADP increment wins when rd and rs1 are the same */
+                if (!(stage->opcode == OPCODE_LOADP && stage->rd == stage->rs1)
+                    && cpu->regs_pending_seq[stage->rd] == stage->seq)
+                {
+                    forward_result(cpu, stage, stage->rd, stage->result_buffer);
+                }
                 break;
             }
         }
- outputDisplay[3] = cpu->memory;
+    }
+
+    return stage->mem_cycles >= stage->mem_latency;
+}
+
+/*
+ * Memory Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static void
+APEX_memory(APEX_CPU *cpu)
+{
+    if (cpu->config.store_buffer)
+    {
+        APEX_store_buffer_cycle(cpu);
+    }
+    if (cpu->mshrs.count)
+    {
+        cpu->stats.mshr_busy_cycles++;
+        cpu->stats.mshr_outstanding += cpu->mshrs.count;
+        complete_mshrs(cpu, FALSE);
+    }
+
+    if (cpu->memory.has_insn)
+    {
+        int done = memory_insn(cpu, &cpu->memory);
+
+        /* The second of a pair must not access memory if the first faults */
+        if (cpu->memory_v.has_insn && !cpu->memory.fault
+            && !memory_insn(cpu, &cpu->memory_v))
+        {
+            done = FALSE;
+        }
+ cpu->outputDisplay[3] = cpu->memory;
+        cpu->outputDisplay_v[3] = cpu->memory_v;
+        if (!done)
+        {
+            return;
+        }
+
         /* Copy data from memory latch to writeback latch*/
         cpu->writeback = cpu->memory;
+        cpu->writeback_v = cpu->memory_v;
         cpu->memory.has_insn = FALSE;
+        cpu->memory_v.has_insn = FALSE;
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_MEMORY, cpu->memory.pc))
+        {
+            APEX_print_stage("Memory", &cpu->memory);
+        }
+        if (cpu->writeback_v.has_insn
+            && APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_MEMORY,
+                            cpu->memory_v.pc))
         {
-            print_stage_content("Memory", &cpu->memory);
+            APEX_print_stage("Memory (V)", &cpu->memory_v);
         }
     } else{
-        outputDisplay[3] = cpu->memory;
+        cpu->outputDisplay[3] = cpu->memory;
+        cpu->outputDisplay_v[3] = cpu->memory_v;
     }
 }
 
+/* Retires the instruction in a writeback latch */
+static void
+writeback_insn(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
+
+    /* Write result to register file based on instruction type */
+    switch (stage->opcode)
+    {
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+        {
+            // print to say we have reached writeback stage
+            if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_WRITEBACK, stage->pc))
+            {
+                printf("Reached writeback stage\n");
+            }
+            break;
+        }
+
+        case OPCODE_LOAD:
+        {
+            //print to check if this is working
+            if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_MEMORY, stage->pc))
+            {
+                printf("LOAD result buffer: %d\n", stage->result_buffer);
+            }
+            break;
+        }
+    }
+
+    /* An MSHR writes rd of a load which left memory before its data */
+    if ((operand_class & APEX_OPND_RD) && !stage->in_mshr)
+    {
+        cpu->regs[stage->rd] = stage->result_buffer;
+
+        //unlock the register
+        cpu->flags_for_regs[stage->rd] = 0;
+        release_pending(cpu, stage, stage->rd);
+    }
+
+    /* LOADP and STOREP also update the address register */
+    if (operand_class & APEX_OPND_POST_INC)
+    {
+        int reg = APEX_post_inc_reg(stage->opcode, stage->rs1, stage->rs2);
+
+        cpu->regs[reg] = stage->buff_temp;
+        cpu->flags_for_regs[reg] = 0;
+        release_pending(cpu, stage, reg);
+    }
+
+    cpu->last_retired_pc = stage->pc;
+    if (stage->pc == cpu->stop_pc)
+    {
+        cpu->stop_pc_retired = TRUE;
+    }
+    cpu->insn_completed++;
+    stage->has_insn = FALSE;
+}
+
 /*
- * Writeback Stage of APEX Pipeline
+ * Writeback Stage of APEX Pipeline, retires the U and then the V pipe
  *
  * Note: You are free to edit this function according to your implementation
  */
 static int
 APEX_writeback(APEX_CPU *cpu)
 {
+    cpu->outputDisplay[4] = cpu->writeback;
+    cpu->outputDisplay_v[4] = cpu->writeback_v;
     if (cpu->writeback.has_insn)
     {
-        /* Write result to register file based on instruction type */
-        switch (cpu->writeback.opcode)
+        if (cpu->writeback.fault)
         {
-            case OPCODE_ADD:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
-            
-            case OPCODE_SUB:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
+            APEX_cpu_fault(cpu, APEX_FAULT_DATA, cpu->writeback.pc,
+                           cpu->writeback.memory_address);
+            return TRUE;
+        }
+        writeback_insn(cpu, &cpu->writeback);
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_WRITEBACK,
+                         cpu->writeback.pc))
+        {
+            APEX_print_stage("Writeback", &cpu->writeback);
+        }
 
-                break;
-            }
-            
-            case OPCODE_MUL:
+        if (cpu->writeback_v.has_insn)
+        {
+            if (cpu->writeback_v.fault)
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
+                APEX_cpu_fault(cpu, APEX_FAULT_DATA, cpu->writeback_v.pc,
+                               cpu->writeback_v.memory_address);
+                return TRUE;
             }
-            case OPCODE_SUBL:
+            writeback_insn(cpu, &cpu->writeback_v);
+            if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_WRITEBACK,
+                             cpu->writeback_v.pc))
             {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
+                APEX_print_stage("Writeback (V)", &cpu->writeback_v);
             }
-            case OPCODE_ADDL:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update the flags
+        }
 
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
+        /* HALT never pairs, so it always retires from the U pipe */
+        if (cpu->writeback.opcode == OPCODE_HALT)
+        {
+            /* Stop the APEX simulator */
+            return TRUE;
+        }
+    }
 
-            case OPCODE_DIV:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
-            case OPCODE_AND:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
+    /* Default */
+    return 0;
+}
 
-            case OPCODE_OR:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
-            case OPCODE_XOR:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                     cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
-            
-            case OPCODE_CMP:
-            {
-                //FOR TESTING PRINT STATEMENT
-                // printf("CMP result buffer: %d\n", cpu->writeback.result_buffer);
-                // cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
+/*
+ * This function creates and initializes APEX cpu.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+APEX_CPU *
+APEX_cpu_init(const char *filename)
+{
+    APEX_CPU *cpu;
 
-                break;
-            }
-            case OPCODE_CML:
-            {
-                //FOR TESTING PRINT STATEMENT
-                // printf("CML result buffer: %d\n", cpu->writeback.result_buffer);
-                // cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0; 
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
+    if (!filename)
+    {
+        return NULL;
+    }
 
-                break;
-            }
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            case OPCODE_BP:
-            case OPCODE_BNP:
-            case OPCODE_BN:
-            case OPCODE_BNN:
-            {
-                break;
-            }
-            case OPCODE_JUMP:
-            {
-                // print to say we have reached writeback stage
-                printf("Reached writeback stage\n");
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
-                break;
-            }
-            case OPCODE_JALR:
-            {
-                // print to say we have reached writeback stage
-                printf("Reached writeback stage\n");
+    cpu = calloc(1, sizeof(APEX_CPU));
 
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
+    if (!cpu)
+    {
+        return NULL;
+    }
 
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
+    /* Initialize PC, Registers and all pipeline stages */
+    APEX_cpu_setup(cpu);
 
-                break;
-            }
-            case OPCODE_NOP:
-            {
-                break;
-            }
+    /* Parse input file and create code memory */
+    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size,
+                                          &cpu->code_text);
+    if (!cpu->code_memory)
+    {
+        free(cpu);
+        return NULL;
+    }
+    cpu->owns_code_memory = TRUE;
 
-            case OPCODE_LOAD:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //print to check if this is working
-                printf("LOAD result buffer: %d\n", cpu->writeback.result_buffer);
-                
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
-
-                
-                break;
-            }
+    return cpu;
+}
 
-            case OPCODE_STORE:
-            {
-                // cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                // //print to check if this is working
-                // printf("STORE result buffer: %d\n", cpu->writeback.result_buffer);
-                // update flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                // cpu->fetch.stalling_value = 0;
-                // cpu->decode.stalling_value = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
+/* Prints the code memory of a newly initialized CPU at the summary level */
+void
+APEX_cpu_print_program(const APEX_CPU *cpu)
+{
+    int i;
 
-                break;
-            }
+    if (APEX_TRACING_SUMMARY(cpu))
+    {
+        fprintf(stderr,
+                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
+                cpu->code_memory_size);
+        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
+        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
+        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
+               "imm");
 
-            case OPCODE_MOVC: 
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->regs_status_pending[cpu->writeback.rd] = 0;
+        for (i = 0; i < cpu->code_memory_size; ++i)
+        {
+            printf("%-9s %-9d %-9d %-9d %-9d\n",
+                   get_opcode_str(cpu->code_memory[i].opcode),
+                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
+                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+        }
+    }
+}
 
-                break;
-            }
+/*
+ * Prints where the cycles went: the top-down breakdown of the decode issue
+ * slot and the busy and stalled cycles of every stage
+ */
+static void
+print_cpi_stack(const APEX_CPU *cpu)
+{
+    static const char *const slot_names[APEX_NUM_SLOT_KINDS] = {
+        "Retiring", "Frontend bound", "Bad speculation", "  operand wait",
+        "  MOVC interlock", "Backend bound", "HALT drain"
+    };
+    static const char *const stage_names[5] = {
+        "Fetch", "Decode/RF", "Execute", "Memory", "Writeback"
+    };
+    const uint64_t *slots = cpu->stats.slots;
+    uint64_t cycles = 0;
+    int i;
 
-             case OPCODE_LOADP:
-            {
+    for (i = 0; i < APEX_NUM_SLOT_KINDS; ++i)
+    {
+        cycles += slots[i];
+    }
+    if (!cycles || !cpu->insn_completed)
+    {
+        return;
+    }
 
-                // //print value of memory address
-                // printf("LOADP memory address: %d\n", cpu->writeback.memory_address);
-                // // print valye at memory address
-                // printf("LOADP value at memory address: %d\n", cpu->data_memory[cpu->writeback.memory_address]);
+    printf("APEX_CPU: Top-down CPI stack, %llu cycles, CPI = %.3f\n",
+           (unsigned long long)cycles, (double)cycles / cpu->insn_completed);
+    for (i = 0; i < APEX_NUM_SLOT_KINDS; ++i)
+    {
+        if (i == APEX_SLOT_OPERAND_WAIT)
+        {
+            uint64_t data = slots[APEX_SLOT_OPERAND_WAIT]
+                            + slots[APEX_SLOT_MOVC_INTERLOCK];
 
-                
-                //update value of rd with the value at memory address
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+            printf("  %-18s %10llu %6.1f%%  CPI %.3f\n", "Data-hazard bound",
+                   (unsigned long long)data, 100.0 * data / cycles,
+                   (double)data / cpu->insn_completed);
+        }
+        printf("  %-18s %10llu %6.1f%%  CPI %.3f\n", slot_names[i],
+               (unsigned long long)slots[i], 100.0 * slots[i] / cycles,
+               (double)slots[i] / cpu->insn_completed);
+    }
 
-                
-                cpu->regs[cpu->writeback.rs1] = cpu->writeback.buff_temp;
+    printf("APEX_CPU: %-11s %10s %10s\n", "Stage", "busy", "stalled");
+    for (i = 0; i < 5; ++i)
+    {
+        printf("          %-11s %10llu %10llu\n", stage_names[i],
+               (unsigned long long)cpu->stats.stage_busy[i],
+               (unsigned long long)cpu->stats.stage_stalled[i]);
+    }
+}
 
-                // //update the value of rd with the value in memory buffer
-                // cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
+/* Prints the use of every function unit of the in-order pipeline */
+static void
+print_function_units(const APEX_CPU *cpu)
+{
+    static const char *const fu_names[APEX_NUM_FUS] = {
+        "ALU", "Multiplier", "Divider", "AGU", "Branch"
+    };
+    int i;
 
+    printf("APEX_CPU: %-11s %10s %10s %7s %12s\n", "Unit", "issued", "busy",
+           "util", "struct stall");
+    for (i = 0; i < APEX_NUM_FUS; ++i)
+    {
+        printf("          %-11s %10llu %10llu %6.1f%% %12llu\n", fu_names[i],
+               (unsigned long long)cpu->stats.fu_issued[i],
+               (unsigned long long)cpu->stats.fu_busy[i],
+               cpu->clock ? 100.0 * cpu->stats.fu_busy[i] / cpu->clock : 0.0,
+               (unsigned long long)cpu->stats.fu_stalls[i]);
+    }
+}
 
+/* Prints how often dual issue paired and why it did not */
+static void
+print_pairing(const APEX_CPU *cpu)
+{
+    static const char *const reason_names[APEX_NUM_PAIR_FAILURES] = {
+        "no second", "control", "dependency", "operands", "same unit"
+    };
+    uint64_t single = 0;
+    int i;
 
-                //update the flags
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->flags_for_regs[cpu->writeback.rs1] = 0;
-                break;
-            }
+    for (i = 0; i < APEX_NUM_PAIR_FAILURES; ++i)
+    {
+        single += cpu->stats.pair_failures[i];
+    }
+    printf("APEX_CPU: Dual issue: %llu pairs, %llu single",
+           (unsigned long long)cpu->stats.pairs_issued, (unsigned long long)single);
+    if (cpu->stats.pairs_issued + single)
+    {
+        printf(" (%.1f%% paired)",
+               100.0 * cpu->stats.pairs_issued / (cpu->stats.pairs_issued + single));
+    }
+    printf("\n");
+    for (i = 0; i < APEX_NUM_PAIR_FAILURES; ++i)
+    {
+        printf("          %-11s %10llu\n", reason_names[i],
+               (unsigned long long)cpu->stats.pair_failures[i]);
+    }
+}
 
-            case OPCODE_STOREP:
-            {
-                
-                cpu->regs[cpu->writeback.rs2] = cpu->writeback.buff_temp;
-                //update the value of rd with the value in memory buffer
-                // cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                
+/* Prints how many compares issued together with their branch */
+static void
+print_fusion(const APEX_CPU *cpu)
+{
+    printf("APEX_CPU: Fusion: %llu compare-and-branch pairs of %llu compares",
+           (unsigned long long)cpu->stats.fused_pairs,
+           (unsigned long long)cpu->stats.fusion_compares);
+    if (cpu->stats.fusion_compares)
+    {
+        printf(" (%.1f%% fused)",
+               100.0 * cpu->stats.fused_pairs / cpu->stats.fusion_compares);
+    }
+    printf(", %llu issue slots saved\n", (unsigned long long)cpu->stats.fused_pairs);
+}
+
+/* Prints the event counters at the summary level */
+void
+APEX_cpu_print_stats(const APEX_CPU *cpu)
+{
+    if (!APEX_TRACING_SUMMARY(cpu))
+    {
+        return;
+    }
+
+    printf("APEX_CPU: Branches = %llu, mispredicted = %llu\n",
+           (unsigned long long)cpu->stats.branches,
+           (unsigned long long)cpu->stats.mispredictions);
+    printf("APEX_CPU: BTB hits = %llu, misses = %llu, allocations = %llu,"
+           " evictions = %llu\n",
+           (unsigned long long)cpu->stats.btb_hits,
+           (unsigned long long)cpu->stats.btb_misses,
+           (unsigned long long)cpu->stats.btb_allocations,
+           (unsigned long long)cpu->stats.btb_evictions);
+    printf("APEX_CPU: Direction predictor %s: %llu predicted, %llu wrong\n",
+           APEX_bpred_name(cpu->config.bpred),
+           (unsigned long long)cpu->stats.direction_predictions,
+           (unsigned long long)cpu->stats.direction_mispredictions);
+    if (cpu->config.ras_depth)
+    {
+        printf("APEX_CPU: RAS depth %d: pushes = %llu, pops = %llu,"
+               " mispredicted = %llu, overflows = %llu, underflows = %llu,"
+               " repairs = %llu\n", cpu->config.ras_depth,
+               (unsigned long long)cpu->stats.ras_pushes,
+               (unsigned long long)cpu->stats.ras_pops,
+               (unsigned long long)cpu->stats.ras_mispredictions,
+               (unsigned long long)cpu->stats.ras_overflows,
+               (unsigned long long)cpu->stats.ras_underflows,
+               (unsigned long long)cpu->stats.ras_repairs);
+    }
+    printf("APEX_CPU: Decode stall cycles = %llu\n",
+           (unsigned long long)cpu->stats.decode_stalls);
+    APEX_memsys_print_stats(cpu);
+    if (cpu->config.backend == APEX_BACKEND_INORDER)
+    {
+        print_function_units(cpu);
+    }
+    if (cpu->config.issue_width > 1 && cpu->config.backend == APEX_BACKEND_INORDER)
+    {
+        print_pairing(cpu);
+    }
+    if (fusion_active(cpu) && cpu->config.backend == APEX_BACKEND_INORDER)
+    {
+        print_fusion(cpu);
+    }
+    if (cpu->config.backend == APEX_BACKEND_OOO)
+    {
+        APEX_ooo_print_stats(cpu);
+    }
+    print_cpi_stack(cpu);
+}
+
+/*
+ * Puts a CPU into the reset state: PC 4000, empty pipeline, zeroed registers
+ * and data memory and the default configuration. Code memory is not touched.
+ */
+void
+APEX_cpu_setup(APEX_CPU *cpu)
+{
+    cpu->pc = 4000;
+    cpu->next_seq = 1;
+    cpu->stop_pc = -1;
+    APEX_trace_default(&cpu->trace);
+    cpu->single_step = ENABLE_SINGLE_STEP;
+    APEX_config_default(&cpu->config);
+    APEX_bpred_init(&cpu->bpred, cpu->config.bpred);
+    APEX_ras_init(&cpu->ras, cpu->config.ras_depth);
 
-                
-                //update the flags
-            cpu->flags_for_regs[cpu->writeback.rd] = 0;
+    /* Can not fail, the default configuration has no caches */
+    APEX_memsys_init(cpu);
+    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
+    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
+
+    /* To start fetch stage */
+    cpu->fetch.has_insn = TRUE;
+}
+
+/* Default configuration, the pipeline described in the project */
+void
+APEX_config_default(APEX_Config *config)
+{
+    config->btb_size = BTB_adding_4_buffer;
+    config->btb_ways = BTB_adding_4_buffer;
+    config->btb_policy = APEX_BTB_FIFO;
+    config->forwarding = TRUE;
+    config->mul_latency = 1;
+    config->div_latency = 1;
+    config->mem_latency = 1;
+    config->bpred = APEX_BPRED_LEGACY;
+    config->ras_depth = 8;
+    config->backend = APEX_BACKEND_INORDER;
+    config->issue_width = 1;
+    config->fusion = FALSE;
+    config->l1d.size = 0;
+    config->l1d.ways = 4;
+    config->l1d.line_size = 16;
+    config->l1d.hit_latency = 1;
+    config->l1d.policy = APEX_CACHE_LRU;
+    config->l1d.write_back = TRUE;
+    config->l1d.write_allocate = TRUE;
+    config->l1i = config->l1d;
+    config->l1i_prefetch = FALSE;
+    config->l2 = config->l1d;
+    config->l2.ways = 8;
+    config->l2.hit_latency = 8;
+    config->dram.banks = 0;
+    config->dram.row_size = 256;
+    config->dram.cas_latency = 10;
+    config->dram.activate_latency = 10;
+    config->dram.precharge_latency = 10;
+    config->dram.burst_cycles = 4;
+    config->stride.entries = 0;
+    config->stride.degree = 2;
+    config->stride.distance = 4;
+    config->store_buffer = 0;
+    config->mshrs = 0;
+    config->ooo_width = 2;
+    config->rob_size = 32;
+    config->iq_size = 16;
+    config->lsq_size = 8;
+    config->phys_regs = 64;
+    config->fu_count[APEX_OOO_FU_ALU] = 2;
+    config->fu_count[APEX_OOO_FU_MUL] = 1;
+    config->fu_count[APEX_OOO_FU_MEM] = 1;
+}
+
+static const char *const backend_names[APEX_NUM_BACKENDS] = { "inorder", "ooo" };
+
+/* Returns the APEX_BACKEND_* called name, or -1 */
+int
+APEX_backend_parse(const char *name)
+{
+    int backend;
+
+    for (backend = 0; backend < APEX_NUM_BACKENDS; ++backend)
+    {
+        if (strcmp(name, backend_names[backend]) == 0)
+        {
+            return backend;
+        }
+    }
+
+    return -1;
+}
 
+const char *
+APEX_backend_name(int backend)
+{
+    return (backend >= 0 && backend < APEX_NUM_BACKENDS) ? backend_names[backend]
+                                                         : "?";
+}
 
-             
-                //unlock the registers
-                cpu->flags_for_regs[cpu->writeback.rd] = 0;
-                cpu->flags_for_regs[cpu->writeback.rs1] = 0;
-                cpu->flags_for_regs[cpu->writeback.rs2] = 0;
+/* Returns the option of the first out-of-order size out of range. They are
+ * checked even when the in-order backend is used. */
+static const char *
+ooo_config_error(const APEX_Config *config)
+{
+    static const char *fu_options[APEX_OOO_NUM_FU_KINDS] = {
+        "--alus", "--muls", "--mem-ports"
+    };
+    int i;
+
+    for (i = 0; i < APEX_OOO_NUM_FU_KINDS; ++i)
+    {
+        if (config->fu_count[i] < 1 || config->fu_count[i] > APEX_OOO_MAX_UNITS)
+        {
+            return fu_options[i];
+        }
+    }
+
+    if (config->ooo_width < 1 || config->ooo_width > APEX_OOO_MAX_WIDTH)
+    {
+        return "--ooo-width";
+    }
+    if (config->rob_size < 1 || config->rob_size > APEX_OOO_MAX_ROB)
+    {
+        return "--rob-size";
+    }
+    if (config->iq_size < 1 || config->iq_size > APEX_OOO_MAX_IQ)
+    {
+        return "--iq-size";
+    }
+    if (config->lsq_size < 1 || config->lsq_size > APEX_OOO_MAX_LSQ)
+    {
+        return "--lsq-size";
+    }
+    if (config->phys_regs < APEX_OOO_ARCH_REGS + 3
+        || config->phys_regs > APEX_OOO_MAX_PHYS_REGS)
+    {
+        return "--phys-regs";
+    }
+
+    return NULL;
+}
+
+/* Returns the option of the first core parameter out of range */
+static const char *
+core_config_error(const APEX_Config *config)
+{
+    int num_sets = (config->btb_ways > 0) ? config->btb_size / config->btb_ways : 0;
+
+    if (config->btb_size < 1 || config->btb_size > APEX_BTB_MAX_ENTRIES)
+    {
+        return "--btb-size";
+    }
+    if (config->btb_ways < 1 || num_sets * config->btb_ways != config->btb_size
+        || (num_sets & (num_sets - 1)) != 0)
+    {
+        return "--btb-ways";
+    }
+    if (config->btb_policy < 0 || config->btb_policy >= APEX_NUM_BTB_POLICIES)
+    {
+        return "--btb-policy";
+    }
+    if (config->mul_latency < 1 || config->mul_latency > APEX_MAX_FU_LATENCY)
+    {
+        return "--mul-latency";
+    }
+    if (config->div_latency < 1 || config->div_latency > APEX_MAX_FU_LATENCY)
+    {
+        return "--div-latency";
+    }
+    if (config->bpred < 0 || config->bpred >= APEX_NUM_BPREDS)
+    {
+        return "--bpred";
+    }
+    if (config->ras_depth < 0 || config->ras_depth > APEX_RAS_MAX_DEPTH)
+    {
+        return "--ras-depth";
+    }
+    if (config->backend < 0 || config->backend >= APEX_NUM_BACKENDS)
+    {
+        return "--backend";
+    }
+    if (config->issue_width < 1 || config->issue_width > APEX_MAX_ISSUE_WIDTH)
+    {
+        return "--issue-width";
+    }
+
+    return ooo_config_error(config);
+}
+
+/*
+ * Returns 0 if every parameter of a configuration is in range, else -1 and
+ * names the first one which is not in error (of size bytes, may be NULL).
+ */
+int
+APEX_config_check(const APEX_Config *config, char *error, size_t size)
+{
+    const char *option = core_config_error(config);
+
+    if (option)
+    {
+        snprintf(error, size, "%s is out of range", option);
+        return -1;
+    }
+
+    return APEX_memsys_config_check(config, error, size);
+}
+
+/* Returns TRUE if every parameter of a configuration is in range */
+int
+APEX_config_valid(const APEX_Config *config)
+{
+    return APEX_config_check(config, NULL, 0) == 0;
+}
+
+/*
+ * Changes the configuration of a CPU which has not started simulating.
+ * Returns 0 on success, -1 if a parameter is out of range (which
+ * APEX_config_check() names) or the caches are out of memory.
+ */
+int
+APEX_cpu_configure(APEX_CPU *cpu, const APEX_Config *config)
+{
+    if (!APEX_config_valid(config))
+    {
+        return -1;
+    }
+
+    cpu->config = *config;
+    initialize_btb(cpu);
+    APEX_bpred_init(&cpu->bpred, config->bpred);
+    APEX_ras_init(&cpu->ras, config->ras_depth);
+    cpu->ooo.active = FALSE;
+    return APEX_memsys_init(cpu);
+}
+
+/*
+ * Empties all pipeline latches and forwarding state, keeping the
+ * architectural state, BTB and counters. Fetch restarts at cpu->pc.
+ */
+void
+APEX_cpu_reset_pipeline(APEX_CPU *cpu)
+{
+    /* Buffered stores and loads in MSHRs have retired, so they are
+     * architectural state */
+    APEX_store_buffer_flush(cpu);
+    complete_mshrs(cpu, TRUE);
+    memset(&cpu->fetch, 0, sizeof(CPU_Stage));
+    memset(&cpu->decode, 0, sizeof(CPU_Stage));
+    memset(&cpu->execute, 0, sizeof(CPU_Stage));
+    memset(&cpu->memory, 0, sizeof(CPU_Stage));
+    memset(&cpu->writeback, 0, sizeof(CPU_Stage));
+    memset(&cpu->fetch_v, 0, sizeof(CPU_Stage));
+    memset(&cpu->decode_v, 0, sizeof(CPU_Stage));
+    memset(&cpu->execute_v, 0, sizeof(CPU_Stage));
+    memset(&cpu->memory_v, 0, sizeof(CPU_Stage));
+    memset(&cpu->writeback_v, 0, sizeof(CPU_Stage));
+    cpu->fu_window_count = 0;
+    memset(cpu->outputDisplay, 0, sizeof(cpu->outputDisplay));
+    memset(cpu->outputDisplay_v, 0, sizeof(cpu->outputDisplay_v));
+    memset(cpu->flags_for_regs, 0, sizeof(cpu->flags_for_regs));
+    memset(cpu->regs_status_pending, 0, sizeof(cpu->regs_status_pending));
+    cpu->fetch_from_next_cycle = FALSE;
+    cpu->fetch_redirected = FALSE;
+    cpu->icache_pending = FALSE;
+    cpu->ooo.active = FALSE;
 
-                break;
-            }   
+    /* To start fetch stage */
+    cpu->fetch.has_insn = TRUE;
+}
 
-           
+/* Returns TRUE if the instruction is still in a function unit */
+static int
+in_function_unit(const APEX_CPU *cpu, uint64_t seq)
+{
+    int i;
 
-            
+    for (i = 0; i < cpu->fu_window_count; ++i)
+    {
+        if (cpu->fu_window[i].seq == seq)
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
 
+/*
+ * Counts the stages which held an instruction in the cycle just simulated,
+ * and which of them still hold the same instruction because it could not
+ * move on. Only writeback runs in the cycle HALT retires.
+ */
+static void
+account_stages(APEX_CPU *cpu, int halted)
+{
+    const CPU_Stage *latches[5] = { &cpu->fetch, &cpu->decode, &cpu->execute,
+                                    &cpu->memory, &cpu->writeback };
+    int i;
 
+    if (halted)
+    {
+        cpu->stats.stage_busy[4]++;
+        cpu->stats.slots[APEX_SLOT_HALT_DRAIN]++;
+        return;
+    }
 
-        }
-outputDisplay[4] = cpu->writeback;
-        cpu->insn_completed++;
-        cpu->writeback.has_insn = FALSE;
+    for (i = 0; i < 5; ++i)
+    {
+        const CPU_Stage *shown = &cpu->outputDisplay[i];
 
-        if (ENABLE_DEBUG_MESSAGES)
+        if (!shown->has_insn)
         {
-            print_stage_content("Writeback", &cpu->writeback);
+            continue;
         }
 
-        if (cpu->writeback.opcode == OPCODE_HALT)
+        cpu->stats.stage_busy[i]++;
+
+        /* The fetch latch keeps the last fetched instruction anyway */
+        if ((latches[i]->has_insn && latches[i]->seq == shown->seq
+             && (i != 0 || latches[i]->stalling_value))
+            || (i == 2 && in_function_unit(cpu, shown->seq)))
         {
-            /* Stop the APEX simulator */
-            return TRUE;
+            cpu->stats.stage_stalled[i]++;
         }
     }
-else{
-        outputDisplay[4] = cpu->writeback;
-    }
-
-    /* Default */
-    return 0;
 }
 
 /*
- * This function creates and initializes APEX cpu.
- *
- * Note: You are free to edit this function according to your implementation
+ * Faults when fetch waits at a PC outside code memory and no instruction is
+ * left in flight which could redirect it
  */
-APEX_CPU *
-APEX_cpu_init(const char *filename)
+static void
+check_fetch_fault(APEX_CPU *cpu)
 {
-    int i;
-    APEX_CPU *cpu;
-
-    if (!filename)
+    int code_index = get_code_memory_index_from_pc(cpu->pc);
+
+    if (!cpu->fetch.has_insn || (code_index >= 0 && code_index < cpu->code_memory_size)
+        || cpu->decode.has_insn || cpu->decode_v.has_insn
+        || cpu->execute.has_insn || cpu->execute_v.has_insn
+        || cpu->memory.has_insn || cpu->memory_v.has_insn
+        || cpu->writeback.has_insn || cpu->writeback_v.has_insn
+        || cpu->mshrs.count)
     {
-        return NULL;
+        return;
     }
 
-    cpu = calloc(1, sizeof(APEX_CPU));
+    APEX_cpu_fault(cpu, APEX_FAULT_CODE, cpu->pc, 0);
+}
 
-    if (!cpu)
+/*
+ * Simulates one clock cycle of the pipeline.
+ * Returns TRUE when HALT retires or the CPU faults in this cycle, or without
+ * simulating anything if it had halted before, as a restored CPU can have.
+ */
+int
+APEX_cpu_cycle(APEX_CPU *cpu)
+{
+    int halted;
+
+    if (cpu->halted)
     {
-        return NULL;
+        return TRUE;
     }
 
-    /* Initialize PC, Registers and all pipeline stages */
-    cpu->pc = 4000;
-    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
-    cpu->single_step = ENABLE_SINGLE_STEP;
-
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+    if (cpu->config.backend == APEX_BACKEND_OOO)
     {
-        free(cpu);
-        return NULL;
+        halted = APEX_ooo_cycle(cpu);
     }
-
-    if (ENABLE_DEBUG_MESSAGES)
+    else
     {
-        fprintf(stderr,
-                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
-        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
-        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
-               "imm");
-
-        for (i = 0; i < cpu->code_memory_size; ++i)
+        halted = APEX_writeback(cpu);
+        if (!halted)
         {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+            APEX_memory(cpu);
+            APEX_execute(cpu);
+            APEX_decode(cpu);
+            APEX_fetch(cpu);
+            check_fetch_fault(cpu);
         }
+        halted = halted || cpu->fault;
+        account_stages(cpu, halted);
+    }
+    if (halted)
+    {
+        cpu->halted = TRUE;
     }
 
-    /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
-    return cpu;
+    cpu->clock++;
+
+    /* Same cycles as display mode shows */
+    if (cpu->bintrace && !halted)
+    {
+        APEX_bintrace_cycle(cpu->bintrace, cpu);
+    }
+    if (cpu->kanata)
+    {
+        APEX_kanata_cycle(cpu->kanata, cpu, halted);
+    }
+    if (cpu->profile)
+    {
+        APEX_profile_cycle(cpu->profile, cpu, halted);
+    }
+    return halted;
 }
 
 /*
@@ -1873,33 +2515,37 @@ APEX_cpu_run(APEX_CPU *cpu)
 
     while (TRUE)
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        int trace_regs = APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_REGS, -1);
+
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_ALL, -1))
         {
             printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock+1);
+            printf("Clock Cycle #: %llu\n", (unsigned long long)cpu->clock + 1);
             printf("--------------------------------------------\n");
         }
 
-        if (APEX_writeback(cpu))
+        if (APEX_cpu_cycle(cpu))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+            /* Halt in writeback stage, or a fault */
+            APEX_cpu_print_fault(cpu);
+            printf("APEX_CPU: Simulation Complete, cycles = %llu instructions = %llu\n",
+                   (unsigned long long)cpu->clock,
+                   (unsigned long long)cpu->insn_completed);
+            APEX_cpu_print_stats(cpu);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-
-        print_reg_file(cpu);
+        if (trace_regs)
+        {
+            print_reg_file(cpu);
 
-          // print the value of flags 
-        printf("\n");
-        printf("Zero flag: %d\n", cpu->zero_flag);
-        printf("Positive flag: %d\n", cpu->pos_flag);
-        printf("Negative flag: %d\n", cpu->neg_flag);
-printf("\n");
+            // print the value of flags
+            printf("\n");
+            printf("Zero flag: %d\n", cpu->zero_flag);
+            printf("Positive flag: %d\n", cpu->pos_flag);
+            printf("Negative flag: %d\n", cpu->neg_flag);
+            printf("\n");
+        }
 
         if (cpu->single_step)
         {
@@ -1908,12 +2554,46 @@ printf("\n");
 
             if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
             {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+                printf("APEX_CPU: Simulation Stopped, cycles = %llu instructions = %llu\n",
+                       (unsigned long long)cpu->clock,
+                       (unsigned long long)cpu->insn_completed);
+                APEX_cpu_print_stats(cpu);
                 break;
             }
         }
+    }
+}
+
+/*
+ * Stops the CPU at an instruction which accessed memory outside code or data
+ * memory, like a retired HALT would. Only the first fault is kept.
+ */
+void
+APEX_cpu_fault(APEX_CPU *cpu, int fault, int pc, int address)
+{
+    if (cpu->fault)
+    {
+        return;
+    }
 
-        cpu->clock++;
+    cpu->fault = fault;
+    cpu->fault_pc = pc;
+    cpu->fault_address = address;
+    cpu->halted = TRUE;
+}
+
+/* Prints why the CPU faulted, if it did */
+void
+APEX_cpu_print_fault(const APEX_CPU *cpu)
+{
+    if (cpu->fault == APEX_FAULT_CODE)
+    {
+        fprintf(stderr, "APEX_Error: PC %d is outside code memory\n", cpu->fault_pc);
+    }
+    else if (cpu->fault == APEX_FAULT_DATA)
+    {
+        fprintf(stderr, "APEX_Error: PC %d accesses address %d outside data memory\n",
+                cpu->fault_pc, cpu->fault_address);
     }
 }
 
@@ -1925,17 +2605,79 @@ printf("\n");
 void
 APEX_cpu_stop(APEX_CPU *cpu)
 {
-    free(cpu->code_memory);
+    if (cpu->bintrace)
+    {
+        APEX_bintrace_close(cpu->bintrace);
+    }
+    if (cpu->kanata)
+    {
+        APEX_kanata_close(cpu->kanata);
+    }
+    if (cpu->profile)
+    {
+        APEX_profile_close(cpu->profile, cpu);
+    }
+    if (cpu->owns_code_memory)
+    {
+        free_code_text(cpu->code_text, cpu->code_memory_size);
+        free(cpu->code_memory);
+    }
+    APEX_memsys_free(cpu);
     free(cpu);
 }
-void displaySequence()
-{ printf("\n");
+
+/*
+ * Makes dst a copy of src with caches of its own. dst must be zeroed or a
+ * CPU, whose caches are replaced. The code memory and the traces stay
+ * shared with src. Returns 0, or -1 if out of memory.
+ */
+int
+APEX_cpu_copy(APEX_CPU *dst, const APEX_CPU *src)
+{
+    APEX_Cache l1d = dst->l1d;
+    APEX_Cache l1i = dst->l1i;
+    APEX_Cache l2 = dst->l2;
+
+    *dst = *src;
+    dst->l1d = l1d;
+    dst->l1i = l1i;
+    dst->l2 = l2;
+    if (APEX_cache_copy(&dst->l1d, &src->l1d) != 0
+        || APEX_cache_copy(&dst->l1i, &src->l1i) != 0
+        || APEX_cache_copy(&dst->l2, &src->l2) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Frees a CPU made by APEX_cpu_copy(), not what it shares */
+void
+APEX_cpu_free_copy(APEX_CPU *cpu)
+{
+    if (cpu)
+    {
+        APEX_memsys_free(cpu);
+        free(cpu);
+    }
+}
+/*
+ * Prints the instruction in every stage for display mode. Also used by
+ * apex_tracedump to render binary traces.
+ */
+void
+APEX_display_stages(const CPU_Stage display[5])
+{
+    static const char stages[5][20] = { "FETCH_ ","DECODE_RF_","EX_","MEMORY_","WRITEBACK_"};
+
+    printf("\n");
     for(int i = 0; i < 5; i++)
     {
-        if(outputDisplay[i].has_insn){
+        if(display[i].has_insn){
             printf("\n");
-            printf("%d.  %-15s--->: (l%d: %d) ",i+1, stages[i], (outputDisplay[i].rd>0 ? outputDisplay[i].rd:0),outputDisplay[i].pc);
-            print_instruction(&outputDisplay[i]);
+            printf("%d.  %-15s--->: (l%d: %d) ",i+1, stages[i], (display[i].rd>0 ? display[i].rd:0),display[i].pc);
+            print_instruction(&display[i]);
             printf("\n");
         } else{
             printf("%d.   %-15s--->:   NA \n",i+1, stages[i]);
@@ -1943,6 +2685,25 @@ void displaySequence()
     }
 }
 
+/* Pipes display mode shows: 1, or 2 when the V pipe is in use */
+int
+APEX_cpu_display_pipes(const APEX_CPU *cpu)
+{
+    return ((cpu->config.issue_width > 1 || fusion_active(cpu))
+            && cpu->config.backend == APEX_BACKEND_INORDER) ? 2 : 1;
+}
+
+static void
+displaySequence(const APEX_CPU *cpu)
+{
+    APEX_display_stages(cpu->outputDisplay);
+    if (APEX_cpu_display_pipes(cpu) > 1)
+    {
+        printf("\nV pipe:");
+        APEX_display_stages(cpu->outputDisplay_v);
+    }
+}
+
 
 void Registers_state(APEX_CPU* cpu) {
   printf("\n== STATE REGISTER FILE ====\n");
@@ -1956,7 +2717,7 @@ void State_data_memory(APEX_CPU* cpu) {
   printf("\n=TATE OF DATA MEMORY ==\n");
   int index;
   for(index = 0; index < 100; ++index) {
-    printf("|\tMEM[%d]\t|\tData Value = %d\t|\n", index, cpu->data_memory[index]);
+    printf("|\tMEM[%d]\t|\tData Value = %d\t|\n", index, APEX_read_data(cpu, index));
   }
 }
 
@@ -1966,31 +2727,36 @@ void APEX_cpu_simulate(APEX_CPU *cpu, int cycles,const char *filename)
 
     while (cycles != 0)
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_ALL, -1))
         {
-            printf("---Clock Cycle #:%d------\n", cpu->clock+1);
+            printf("---Clock Cycle #:%llu------\n", (unsigned long long)cpu->clock + 1);
         }
 
-        if (APEX_writeback(cpu))
+        if (APEX_cpu_cycle(cpu))
         {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock+1, cpu->insn_completed);
+            /* Halt in writeback stage, or a fault */
+            APEX_cpu_print_fault(cpu);
+            printf("APEX_CPU: Simulation Complete, cycles = %llu instructions = %llu\n",
+                   (unsigned long long)cpu->clock,
+                   (unsigned long long)cpu->insn_completed);
             break;
         }
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
-        
-        displaySequence();
+        /* A binary trace replaces the text */
+        if (!cpu->bintrace)
+        {
+            displaySequence(cpu);
+        }
 
-        cpu->clock++;
         cycles -= 1;
     }
-    if(strcmp(filename, "simulate") == 0){
+    if(strcmp(filename, "simulate") == 0 && !cpu->halted){
         APEX_cpu_run(cpu);
     }
+    else
+    {
+        APEX_cpu_print_stats(cpu);
+    }
     Registers_state(cpu);
     State_data_memory(cpu);
 }
@@ -2004,90 +2770,170 @@ void APEX_cpu_simulate(APEX_CPU *cpu, int cycles,const char *filename)
 // search for the branch in the BTB to check for entry in BTB
 // search_entry_in_btb - inputs apex cpu, instruction address
 
-int search_entry_in_btb(APEX_CPU *cpu, int instruction_addr)
+static const char *const btb_policy_names[APEX_NUM_BTB_POLICIES] = {
+    "fifo", "lru", "random"
+};
+
+// returns the APEX_BTB_* replacement policy called name, or -1
+int APEX_btb_parse_policy(const char *name)
 {
-    // printf("search_entry_in_btb\n");
+    for (int policy = 0; policy < APEX_NUM_BTB_POLICIES; policy++)
+    {
+        if (strcmp(name, btb_policy_names[policy]) == 0)
+        {
+            return policy;
+        }
+    }
+    return -1;
+}
 
-    for (int i = 0; i < BTB_adding_4_buffer; i++)
+const char *APEX_btb_policy_name(int policy)
+{
+    return (policy >= 0 && policy < APEX_NUM_BTB_POLICIES)
+           ? btb_policy_names[policy] : "?";
+}
+
+// the BTB has btb_size / btb_ways sets (a power of two) of btb_ways entries,
+// a branch can only be in the set selected by the low bits of pc / 4
+
+static int
+btb_set_base(const APEX_CPU *cpu, int instruction_addr)
+{
+    int num_sets = cpu->config.btb_size / cpu->config.btb_ways;
+
+    return (((unsigned)instruction_addr >> 2) & (num_sets - 1))
+           * cpu->config.btb_ways;
+}
+
+static int
+find_btb_entry(const APEX_CPU *cpu, int instruction_addr)
+{
+    int base = btb_set_base(cpu, instruction_addr);
+
+    for (int i = base; i < base + cpu->config.btb_ways; i++)
     {
-        if (cpu->BTB_array[i].address == instruction_addr)
+        if (cpu->BTB_array[i].valid_bit
+            && cpu->BTB_array[i].address == instruction_addr)
         {
-            // printf("search_entry_in_btb - found entry in BTB\n");
             return i;
         }
     }
-    //printing for testing 
-    printf("search_entry_in_btb - entry not found in BTB\n");
     return -1;
 }
 
-// initialize_btb - inputs apex cpu
-void initialize_btb(APEX_CPU *cpu)
+int search_entry_in_btb(APEX_CPU *cpu, int instruction_addr)
 {
-    // printf("initialize_btb test AAAAAAAAAAAAAAAAAAAAAAAAA \n");
-    for (int i = 0; i < BTB_adding_4_buffer; i++)
-    {
+    // printf("search_entry_in_btb\n");
 
-        cpu->BTB_array[i].outcome_bit=0;
-        cpu->BTB_array[i].completion_status=0;
-        cpu->BTB_array[i].branch_taken=0;
-        // cpu->BTB_array[i].address = -1;
-        // cpu->BTB_array[i].calc_target_address = -1;
-        // cpu->BTB_array[i].prediction = -1;
-        // cpu->BTB_array[i].valid = 0;
+    int index = find_btb_entry(cpu, instruction_addr);
+    if (index == -1
+        && APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_BTB, instruction_addr))
+    {
+        //printing for testing
+        printf("search_entry_in_btb - entry not found in BTB\n");
     }
+    return index;
 }
 
+// marks a BTB entry as used now, for LRU replacement
+void touch_btb_entry(APEX_CPU *cpu, int btb_index)
+{
+    cpu->BTB_array[btb_index].last_use = ++cpu->btb_clock;
+}
 
-// update_btb_entry - inputs apex cpu, instruction address, calc target address
-// void update_btb_entry(APEX_CPU *cpu, int instruction_addr, int calc_target_address)
-// {
-//     // printf("update_btb_entry\n");
-//     int index = search_entry_in_btb(cpu, instruction_addr);
-//     if (index != -1)
-//     {
-//         // printf("update_btb_entry - updating entry in BTB\n");
-//         cpu->BTB_array[index].address = instruction_addr;
-//         cpu->BTB_array[index].calc_target_address = calc_target_address;
-//         cpu->BTB_array[index].prediction = 1;
-//         cpu->BTB_array[index].valid = 1;
-//     }
-//     else
-//     {
-//         // printf("update_btb_entry - adding entry in BTB\n");
-//         for (int i = 0; i < BTB_adding_4_buffer; i++)
-//         {
-//             if (cpu->BTB_array[i].valid == 0)
-//             {
-//                 cpu->BTB_array[i].address = instruction_addr;
-//                 cpu->BTB_array[i].calc_target_address = calc_target_address;
-//                 cpu->BTB_array[i].prediction = 1;
-//                 cpu->BTB_array[i].valid = 1;
-//                 break;
-//             }
-//         }
-//     }
-// }
-
+// add_btb_branch - adds a branch seen for the first time to the BTB
+// BNZ and BP start out predicting taken, BZ and BNP not taken
+void add_btb_branch(APEX_CPU *cpu, int instruction_addr, int opcode)
+{
+    int btb_index = update_btb_entry(cpu, instruction_addr, -1);
 
+    if (opcode == OPCODE_BNZ || opcode == OPCODE_BP)
+    {
+        cpu->BTB_array[btb_index].outcome_bit = 2;
+    }
+    else
+    {
+        cpu->BTB_array[btb_index].outcome_bit = 0;
+    }
+}
+// initialize_btb - inputs apex cpu
+void initialize_btb(APEX_CPU *cpu)
+{
+    memset(cpu->BTB_array, 0, sizeof(cpu->BTB_array));
+    cpu->btb_clock = 0;
+}
 
-// update_btb_entry - inputs apex cpu, instruction address, calc target address
-void update_btb_entry(APEX_CPU *cpu, int instruction_addr, int calc_target_address)
+// chooses the entry of the set of instruction_addr to replace: a free one,
+// else the one picked by config.btb_policy
+static int
+choose_btb_victim(APEX_CPU *cpu, int instruction_addr)
 {
-    // printf("update_btb_entry AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA \n");
-    cpu->BTB_array[cpu->head_of_BTB].address = instruction_addr;
-    cpu->BTB_array[cpu->head_of_BTB].calc_target_address = calc_target_address;
-    // cpu->BTB_array[cpu->head_of_BTB].prediction = 1;
-    cpu->BTB_array[cpu->head_of_BTB].completion_status = 0  ;
-    cpu->BTB_array[cpu->head_of_BTB].branch_taken = 0;
+    int base = btb_set_base(cpu, instruction_addr);
+    int victim = base;
+
+    for (int i = base; i < base + cpu->config.btb_ways; i++)
+    {
+        if (!cpu->BTB_array[i].valid_bit)
+        {
+            return i;
+        }
+    }
 
-    //adddng entry to BTB 
+    cpu->stats.btb_evictions++;
+    switch (cpu->config.btb_policy)
+    {
+        case APEX_BTB_LRU:
+        case APEX_BTB_FIFO:
+        {
+            for (int i = base + 1; i < base + cpu->config.btb_ways; i++)
+            {
+                uint64_t age_i = (cpu->config.btb_policy == APEX_BTB_LRU)
+                                 ? cpu->BTB_array[i].last_use
+                                 : cpu->BTB_array[i].inserted;
+                uint64_t age_victim = (cpu->config.btb_policy == APEX_BTB_LRU)
+                                      ? cpu->BTB_array[victim].last_use
+                                      : cpu->BTB_array[victim].inserted;
 
-    cpu->head_of_BTB = (cpu->head_of_BTB + 1) % BTB_adding_4_buffer;
+                if (age_i < age_victim)
+                {
+                    victim = i;
+                }
+            }
+            break;
+        }
 
-    // printf("update_btb_entry - adding entry in BTB\n");
-    // uhhhhhhhhhhhhhh moving to the next entry in BTB somehow?????
+        case APEX_BTB_RANDOM:
+        {
+            // xorshift32, part of the CPU state so runs are repeatable
+            uint32_t x = cpu->btb_random ? cpu->btb_random : 2463534242u;
+
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            cpu->btb_random = x;
+            victim = base + (int)(x % (uint32_t)cpu->config.btb_ways);
+            break;
+        }
+    }
+    return victim;
+}
 
+// update_btb_entry - inputs apex cpu, instruction address, calc target address
+// allocates an entry for the branch and returns its index
+int update_btb_entry(APEX_CPU *cpu, int instruction_addr, int calc_target_address)
+{
+    int btb_index = choose_btb_victim(cpu, instruction_addr);
+    BTB_entry *entry = &cpu->BTB_array[btb_index];
+
+    entry->address = instruction_addr;
+    entry->calc_target_address = calc_target_address;
+    entry->valid_bit = 1;
+    entry->completion_status = 0;
+    entry->branch_taken = 0;
+    entry->inserted = ++cpu->btb_clock;
+    entry->last_use = entry->inserted;
+    cpu->stats.btb_allocations++;
+    return btb_index;
 }
 
 
@@ -2116,126 +2962,58 @@ int change_btb_0(int current_bits)
 
 }
 
-// code for BP_BNZ
-
-
-void update_branch_BP_BNZ(APEX_CPU* cpu)
+// records the target of a resolved BNZ, BZ, BP or BNP, returns its entry
+// so the direction predictor can train it (the outcome bits are trained
+// by the legacy predictor in apex_bpred.c)
+BTB_entry *update_btb_outcome(APEX_CPU *cpu, int instruction_addr, int taken,
+                              int calc_target_address)
 {
-    // Calculate the target address
-    int target_address = cpu->execute.pc + cpu->execute.imm;
-    // Search for the entry in the BTB
-    int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
-
-    // Check if the BTB entry is unresolved or if it's resolved but the calculated address doesn't match and the outcome bit is 0
-    if (cpu->BTB_array[btb_index].completion_status == 0 || (cpu->BTB_array[btb_index].completion_status == 1  && cpu->BTB_array[btb_index].calc_target_address != target_address && cpu->BTB_array[btb_index].outcome_bit == 0)){
-        // Update the BTB entry
-        cpu->BTB_array[btb_index].completion_status = 1;
-        cpu->BTB_array[btb_index].calc_target_address = target_address;
-        cpu->BTB_array[btb_index].outcome_bit = 2;
-
-        // cpu->BTB_array[btb_index].outcome_bit = change_btb_2(cpu->BTB_array[btb_index].outcome_bit);
-
-        cpu->pc = target_address;
-
-        // this will remain the same for all the cases
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
+    int btb_index = find_btb_entry(cpu, instruction_addr);
 
-        cpu->fetch.has_insn = TRUE;
-    }
-    // Check if the BTB entry is resolved, the calculated address matches and the outcome bit is 0
-    else if (cpu->BTB_array[btb_index].completion_status == 1  && cpu->BTB_array[btb_index].calc_target_address == target_address && cpu->BTB_array[btb_index].outcome_bit == 0  ){
-        // Increment the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_2(cpu->BTB_array[btb_index].outcome_bit);
-        
-        cpu->pc = target_address;
-
-        // this will remain the same for all the cases
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE;
+    // the entry may have been replaced since the branch was decoded
+    if (btb_index == -1)
+    {
+        return NULL;
     }
-    // Check if the BTB entry is resolved, the calculated address doesn't match and the outcome bit is not 0
-    else if( cpu->BTB_array[btb_index].completion_status == 1  && cpu->BTB_array[btb_index].calc_target_address != target_address && cpu->BTB_array[btb_index].outcome_bit != 0 ){
-        // Decrement the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_0(cpu->BTB_array[btb_index].outcome_bit);
-        
-        cpu->pc = target_address;
 
-        // this will remain the same for all the cases
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE;
-    }
-    // Check if the BTB entry is resolved, the calculated address matches and the outcome bit is not 0
-    else if(cpu->BTB_array[btb_index].completion_status == 1  && cpu->BTB_array[btb_index].calc_target_address == target_address && cpu->BTB_array[btb_index].outcome_bit != 0) {
-        // Increment the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_2(cpu->BTB_array[btb_index].outcome_bit);
-    }
+    cpu->BTB_array[btb_index].completion_status = 1;
+    cpu->BTB_array[btb_index].calc_target_address = calc_target_address;
+    cpu->BTB_array[btb_index].branch_taken = taken;
+    touch_btb_entry(cpu, btb_index);
+    return &cpu->BTB_array[btb_index];
 }
 
+/*
+ * Trains the BTB and the direction predictor for a branch executed by the
+ * functional simulator, the same way decode and execute would have, so the
+ * pipeline starts with warm state.
+ * A JALR pushes the RAS and a JUMP, which is only passed for returns, pops it.
+ */
+void
+APEX_warm_branch(APEX_CPU *cpu, int pc, int opcode, int taken, int target)
+{
+    uint64_t history = cpu->bpred.history;
+    BTB_entry *entry;
+    int return_pc;
 
-
-void update_branch_BZ_BNP(APEX_CPU* cpu){
-    // Calculate the target address
-    int target_address = cpu->execute.pc + cpu->execute.imm;
-    // Search for the entry in the BTB
-    int btb_index = search_entry_in_btb(cpu, cpu->execute.pc);
-
-    // Check if the BTB entry is unresolved or if it's resolved but the calculated address doesn't match and the outcome bit is 0
-    if (cpu->BTB_array[btb_index].completion_status == 0 || (cpu->BTB_array[btb_index].completion_status == 1  && cpu->BTB_array[btb_index].calc_target_address != target_address && cpu->BTB_array[btb_index].outcome_bit == 0)){
-        // Update the BTB entry
-        cpu->BTB_array[btb_index].completion_status = 1;
-        cpu->BTB_array[btb_index].calc_target_address = target_address;
-
-        // cpu->BTB_array[btb_index].outcome_bit= 0;
-        // this is giving some error that i am not able to figure out... changibg this to 1 for now --- CHANGE THIS BACK :( ????????
-
-        cpu->BTB_array[btb_index].outcome_bit= 1;
-        cpu->pc = target_address;
-
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE;
+    if (cpu->config.ras_depth && opcode == OPCODE_JALR)
+    {
+        APEX_ras_push(&cpu->ras, pc + 4);
     }
-    // Check if the BTB entry is resolved, the calculated address doesn't match and the outcome bit is 2
-    else if(cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].calc_target_address != target_address && cpu->BTB_array[btb_index].outcome_bit == 2  ){
-        // Decrement the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_0(cpu->BTB_array[btb_index].outcome_bit);
-        cpu->pc = target_address;
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE; 
+    else if (cpu->config.ras_depth && opcode == OPCODE_JUMP)
+    {
+        APEX_ras_pop(&cpu->ras, &return_pc);
     }
-    // Check if the BTB entry is resolved, the calculated address doesn't match and the outcome bit is not 2
-    else if (cpu->BTB_array[btb_index].outcome_bit != 2 && cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].calc_target_address != target_address ){
-        // Decrement the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_0(cpu->BTB_array[btb_index].outcome_bit);
-        cpu->pc = target_address;
-        cpu->fetch_from_next_cycle = TRUE;
-
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE; 
+    if (!APEX_is_btb_branch(opcode))
+    {
+        return;
     }
-    // Check if the BTB entry is resolved, the calculated address matches and the outcome bit is not 2
-    else if(cpu->BTB_array[btb_index].outcome_bit != 2 && cpu->BTB_array[btb_index].completion_status == 1 && cpu->BTB_array[btb_index].calc_target_address == target_address){
-        // Increment the outcome bit
-        cpu->BTB_array[btb_index].outcome_bit = change_btb_2(cpu->BTB_array[btb_index].outcome_bit);
-        cpu->pc = target_address;
-        cpu->fetch_from_next_cycle = TRUE;
 
-        cpu->decode.has_insn = FALSE;
-
-        cpu->fetch.has_insn = TRUE; 
+    if (find_btb_entry(cpu, pc) == -1)
+    {
+        add_btb_branch(cpu, pc, opcode);
     }
+    entry = update_btb_outcome(cpu, pc, taken, target);
+    APEX_bpred_update(&cpu->bpred, pc, opcode, history, entry, taken);
+    APEX_bpred_push(&cpu->bpred, taken);
 }
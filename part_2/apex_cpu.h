@@ -9,9 +9,28 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "apex_bpred.h"
+#include "apex_cache.h"
+#include "apex_dram.h"
 #include "apex_macros.h"
+#include "apex_ras.h"
+#include "apex_stride.h"
+#include "apex_trace.h"
 // added for BTB
 #define BTB_adding_4_buffer 4
+#define APEX_BTB_MAX_ENTRIES 1024
+
+/* BTB replacement policies, APEX_Config.btb_policy */
+enum
+{
+    APEX_BTB_FIFO,                 /* Oldest allocation, the original BTB */
+    APEX_BTB_LRU,                  /* Least recently used */
+    APEX_BTB_RANDOM,
+    APEX_NUM_BTB_POLICIES
+};
 /* Format of an APEX instruction  */
 
 
@@ -30,31 +49,35 @@ typedef struct BTB_entry
     // to check if the branch is taken or not 
     int branch_taken;
 
+    uint64_t inserted;             /* btb_clock at allocation, for FIFO */
+    uint64_t last_use;             /* btb_clock at the last use, for LRU */
 } BTB_entry;
 
 
 
 
+/* Predecoded micro-op, one per line of the input file. The instruction text
+ * is kept in a separate side table (code_text) and is only used for printing */
 typedef struct APEX_Instruction
 {
-    char opcode_str[128];
-    int opcode;
-    int rd;
-    int rs1;
-    int rs2;
-    int rs3; //added for store
-    int imm;
+    int32_t imm;
+    uint16_t operand_class;        /* APEX_OPND_* bits */
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
 } APEX_Instruction;
 
 /* Model of CPU stage latch */
 typedef struct CPU_Stage
 {
     int pc;
-    char opcode_str[128];
+    int code_index;                /* Index of the micro-op in code memory */
+    uint64_t seq;                  /* Fetch order, tags forwarded results */
+    int predicted_pc;              /* Next PC chosen by fetch */
     int opcode;
     int rs1;
     int rs2;
-    int rs3; //added for store 
     int rd;
     int imm;
     int rs1_value;
@@ -66,35 +89,390 @@ typedef struct CPU_Stage
     int buff_temp; //added for STORE P AND LOAD P
 
     int stalling_value; //added for stalling
+
+    int exec_cycles;               /* Cycles spent in execute so far */
+    int fu;                        /* APEX_FU_* executing it */
+    int fu_latency;                /* Execute cycles in that unit */
+    int v_pipe;                    /* Issued as the second of a pair */
+    int mem_cycles;                /* Cycles spent in memory so far */
+    int mem_latency;               /* Memory cycles it needs, set on entry */
+    int in_mshr;                   /* A load whose data an MSHR delivers */
+    int fault;                     /* Its address is outside data memory, it
+                                      faults instead of retiring */
+
+    uint64_t bpred_history;        /* Global history when it was fetched */
+    int bpred_taken;               /* Direction predicted by APEX_Config.bpred */
+    int ras_predicted;             /* Return address taken from the RAS */
+    APEX_Ras_Snapshot ras;         /* RAS after its own push or pop */
 } CPU_Stage;
 
+/* Why a CPU stopped without HALT, APEX_CPU.fault */
+enum
+{
+    APEX_FAULT_NONE,
+    APEX_FAULT_CODE,               /* Execution reached a PC outside code memory */
+    APEX_FAULT_DATA                /* A load or store outside data memory retired */
+};
+
+/* Backends, APEX_Config.backend */
+enum
+{
+    APEX_BACKEND_INORDER,          /* The five stage pipeline */
+    APEX_BACKEND_OOO,              /* Out-of-order backend, apex_ooo.c */
+    APEX_NUM_BACKENDS
+};
+
+/* Function units of the in-order pipeline */
+enum
+{
+    APEX_FU_ALU,                   /* Arithmetic, logic, MOVC, compares, NOP, HALT */
+    APEX_FU_MUL,                   /* Pipelined multiplier, config.mul_latency */
+    APEX_FU_DIV,                   /* Iterative divider with early out */
+    APEX_FU_AGU,                   /* Addresses of loads and stores */
+    APEX_FU_BRANCH,                /* Control transfers */
+    APEX_NUM_FUS
+};
+
+#define APEX_MAX_FU_LATENCY 32     /* Of the multiplier and the divider */
+
+/* Instructions execute can hold: mul_latency in the multiplier, one in
+ * every other unit */
+#define APEX_FU_WINDOW (APEX_MAX_FU_LATENCY + APEX_NUM_FUS - 1)
+
+/* Why the second instruction of a dual-issue pair stayed in decode */
+enum
+{
+    APEX_PAIR_NO_SECOND,           /* Decode held a single instruction */
+    APEX_PAIR_CONTROL,             /* The first is a control transfer or HALT */
+    APEX_PAIR_DEPENDENCY,          /* The second reads or writes a result of the first */
+    APEX_PAIR_OPERANDS,            /* The second waits for an older result */
+    APEX_PAIR_UNIT,                /* Both need the same function unit */
+    APEX_NUM_PAIR_FAILURES
+};
+
+#define APEX_MAX_ISSUE_WIDTH 2     /* Of the in-order pipeline */
+#define APEX_STORE_BUFFER_MAX 32   /* Entries of the in-order store buffer */
+#define APEX_MAX_MSHRS 16          /* Lines the in-order pipeline can miss on */
+#define APEX_MSHR_TARGETS 4        /* Loads waiting for one line */
+
+/* Function unit kinds of the out-of-order backend */
+enum
+{
+    APEX_OOO_FU_ALU,               /* Arithmetic, logic, MOVC, compares, branches */
+    APEX_OOO_FU_MUL,               /* Pipelined MUL, iterative DIV */
+    APEX_OOO_FU_MEM,               /* Loads and stores */
+    APEX_OOO_NUM_FU_KINDS
+};
+
+/* Resources dispatch can run out of */
+enum
+{
+    APEX_OOO_STALL_ROB,
+    APEX_OOO_STALL_IQ,
+    APEX_OOO_STALL_LSQ,
+    APEX_OOO_STALL_REGS,           /* No free physical register */
+    APEX_OOO_NUM_STALLS
+};
+
+#define APEX_OOO_MAX_WIDTH 4
+#define APEX_OOO_MAX_UNITS 4       /* Of each function unit kind */
+#define APEX_OOO_MAX_ROB 128
+#define APEX_OOO_MAX_IQ 64
+#define APEX_OOO_MAX_LSQ 32
+#define APEX_OOO_MAX_PHYS_REGS 256
+#define APEX_OOO_FLAGS_REG REG_FILE_SIZE /* Architectural number of the flags */
+#define APEX_OOO_ARCH_REGS (REG_FILE_SIZE + 1)
+
+/* Microarchitectural parameters which can be changed at run time */
+typedef struct APEX_Config
+{
+    int btb_size;                  /* BTB entries, 1..APEX_BTB_MAX_ENTRIES */
+    int btb_ways;                  /* Entries per set, btb_size / btb_ways sets */
+    int btb_policy;                /* APEX_BTB_FIFO, APEX_BTB_LRU or APEX_BTB_RANDOM */
+    int forwarding;                /* FALSE: consumers wait for writeback */
+    int mul_latency;               /* Execute cycles of MUL, 1..APEX_MAX_FU_LATENCY */
+    int div_latency;               /* Worst case execute cycles of DIV */
+    int mem_latency;               /* Cycles of a memory access without the
+                                      DRAM model */
+    int bpred;                     /* Direction predictor, APEX_BPRED_* */
+    int ras_depth;                 /* RAS entries, 0..APEX_RAS_MAX_DEPTH */
+    int backend;                   /* APEX_BACKEND_INORDER or APEX_BACKEND_OOO */
+    int issue_width;               /* In-order pipeline: 1, or 2 for U/V pairs */
+    int fusion;                    /* Single issue: a compare and the branch
+                                      after it issue as one micro-op */
+    APEX_Cache_Config l1d;         /* Data cache, size 0 for none */
+    APEX_Cache_Config l1i;         /* Instruction cache, size 0 for none */
+    int l1i_prefetch;              /* Next-line prefetch into the L1I */
+    APEX_Cache_Config l2;          /* Unified L2, size 0 for none */
+    APEX_Dram_Config dram;         /* Banked DRAM, 0 banks for a flat
+                                      mem_latency */
+    APEX_Stride_Config stride;     /* Stride prefetch into the L1D, 0 entries
+                                      for none */
+    int store_buffer;              /* In-order pipeline: store buffer entries,
+                                      0 for stores waiting in memory */
+    int mshrs;                     /* In-order pipeline: outstanding load lines,
+                                      0 for loads waiting in memory */
+
+    /* Out-of-order backend only */
+    int ooo_width;                 /* Fetched, renamed and committed per cycle */
+    int rob_size;
+    int iq_size;
+    int lsq_size;
+    int phys_regs;                 /* Physical registers, the flags included */
+    int fu_count[APEX_OOO_NUM_FU_KINDS]; /* Function units of each kind */
+} APEX_Config;
+
+/*
+ * Top-down categories of the decode issue slot, every cycle is counted in
+ * exactly one of them
+ */
+enum
+{
+    APEX_SLOT_RETIRING,            /* An instruction issued to execute */
+    APEX_SLOT_FRONTEND,            /* Decode empty, fetch had nothing to give */
+    APEX_SLOT_BAD_SPECULATION,     /* Decode empty after a branch redirect */
+    APEX_SLOT_OPERAND_WAIT,        /* Waiting for a source to be forwarded */
+    APEX_SLOT_MOVC_INTERLOCK,      /* MOVC waiting for an older MOVC to rd */
+    APEX_SLOT_BACKEND,             /* Execute busy with an older instruction */
+    APEX_SLOT_HALT_DRAIN,          /* Older instructions drain after HALT */
+    APEX_NUM_SLOT_KINDS
+};
+
+/* Event counters of the pipeline */
+typedef struct APEX_Stats
+{
+    uint64_t branches;             /* Control transfers resolved in execute */
+    uint64_t mispredictions;       /* Branches which redirected fetch */
+    uint64_t btb_hits;             /* Fetch lookups which found a resolved entry */
+    uint64_t btb_misses;
+    uint64_t btb_allocations;      /* Branches entered by decode */
+    uint64_t btb_evictions;        /* ... which replaced a valid entry */
+    uint64_t direction_predictions; /* BZ, BNZ, BP and BNP predicted */
+    uint64_t direction_mispredictions;
+    uint64_t ras_pushes;           /* JALR fetched */
+    uint64_t ras_pops;             /* Returns predicted from the RAS */
+    uint64_t ras_overflows;        /* Pushes which overwrote the oldest entry */
+    uint64_t ras_underflows;       /* Returns fetched with an empty RAS */
+    uint64_t ras_mispredictions;   /* Popped addresses which were wrong */
+    uint64_t ras_repairs;          /* Redirects which undid squashed pushes or pops */
+    uint64_t decode_stalls;        /* Cycles an instruction waited in decode */
+    uint64_t slots[APEX_NUM_SLOT_KINDS]; /* Cycles per top-down category */
+    uint64_t stage_busy[5];        /* Cycles each stage held an instruction */
+    uint64_t stage_stalled[5];     /* ... which could not move on */
+    uint64_t fu_issued[APEX_NUM_FUS]; /* Instructions per function unit */
+    uint64_t fu_busy[APEX_NUM_FUS]; /* Cycles the unit held an instruction */
+    uint64_t fu_stalls[APEX_NUM_FUS]; /* Cycles execute waited for the unit */
+    uint64_t pairs_issued;         /* Dual issue: cycles both pipes issued */
+    uint64_t pair_failures[APEX_NUM_PAIR_FAILURES]; /* ... only the U pipe */
+    uint64_t fusion_compares;      /* Fusion: compares issued */
+    uint64_t fused_pairs;          /* ... together with their branch */
+    APEX_Cache_Stats l1d;
+    APEX_Cache_Stats l1i;
+    APEX_Cache_Stats l2;
+    APEX_Dram_Stats dram;
+    APEX_Stride_Stats stride;
+    uint64_t sb_stores;            /* Stores retired into the store buffer */
+    uint64_t sb_coalesced;         /* ... which overwrote a buffered store */
+    uint64_t sb_forwards;          /* Loads served by a buffered store */
+    uint64_t sb_full_stalls;       /* Cycles a store waited for a free entry */
+    uint64_t sb_drains;            /* Line writes to the L1D or memory */
+    uint64_t sb_occupancy[APEX_STORE_BUFFER_MAX + 1]; /* Cycles per count */
+    uint64_t mshr_loads;           /* Loads which left memory before their data */
+    uint64_t mshr_merged;          /* ... to a line already outstanding */
+    uint64_t mshr_full_stalls;     /* Cycles a load waited for an MSHR */
+    uint64_t mshr_use_stalls;      /* Cycles decode waited for an MSHR load */
+    uint64_t mshr_busy_cycles;     /* Cycles with an outstanding line */
+    uint64_t mshr_outstanding;     /* Sum of the outstanding lines over them */
+
+    /* Out-of-order backend only */
+    uint64_t ooo_dispatch_stalls[APEX_OOO_NUM_STALLS]; /* Cycles per full resource */
+    uint64_t ooo_issued[APEX_OOO_NUM_FU_KINDS]; /* Instructions per unit kind */
+    uint64_t ooo_squashed;         /* Instructions squashed by redirects */
+    uint64_t ooo_load_forwards;    /* Loads served by an older store */
+    uint64_t ooo_load_blocked;     /* Ready loads held for older store addresses */
+    uint64_t ooo_rob_occupancy;    /* Sum over all cycles */
+    uint64_t ooo_iq_occupancy;
+} APEX_Stats;
+
+/* Reorder buffer entry of the out-of-order backend */
+typedef struct APEX_Rob_Entry
+{
+    CPU_Stage insn;                /* As fetched, results filled in by issue */
+    int num_dests;                 /* rd, the post-increment register, flags */
+    int dest_arch[3];
+    int dest_phys[3];
+    int prev_phys[3];              /* Mapping to restore or free */
+    int dest_value[3];
+    int lsq_index;                 /* -1 if not a load or store */
+    int issued;
+    int completed;
+    uint64_t done_cycle;           /* Clock at which an issued entry completes */
+    int next_pc;                   /* Resolved successor of a control transfer */
+    int taken;                     /* ... and its direction */
+    int mispredicted;
+} APEX_Rob_Entry;
+
+/* Issue queue entry, waits until its sources are woken up */
+typedef struct APEX_Iq_Entry
+{
+    int rob_index;
+    int fu;                        /* APEX_OOO_FU_* */
+    uint64_t seq;                  /* Oldest ready entries are selected first */
+    int src_phys[3];               /* rs1, rs2 and flags, -1 if not read */
+    int src_ready[3];
+} APEX_Iq_Entry;
+
+/* Load-store queue entry, in program order */
+typedef struct APEX_Lsq_Entry
+{
+    int rob_index;
+    int is_store;
+    int address_known;
+    int address;
+    int value;                     /* Data of a store */
+} APEX_Lsq_Entry;
+
+/* A store which left the memory stage but not yet the store buffer */
+typedef struct APEX_Store_Buffer_Entry
+{
+    int pc;
+    int address;
+    int value;
+} APEX_Store_Buffer_Entry;
+
+/*
+ * Store buffer of the in-order pipeline, oldest entry first. The oldest
+ * entry drains together with all others of its line.
+ */
+typedef struct APEX_Store_Buffer
+{
+    APEX_Store_Buffer_Entry entries[APEX_STORE_BUFFER_MAX];
+    int count;
+    int draining;                  /* The oldest line is being written */
+    uint64_t drain_done;           /* Clock at which that write is done */
+} APEX_Store_Buffer;
+
+/* A load waiting for the line of an MSHR */
+typedef struct APEX_Mshr_Target
+{
+    uint64_t seq;
+    int rd;                        /* -1 when the load result is dropped */
+    int value;                     /* Read when the load left memory */
+} APEX_Mshr_Target;
+
+/* Miss status holding register, one line in flight */
+typedef struct APEX_Mshr
+{
+    int line;
+    uint64_t ready;                /* Clock at which the data arrives */
+    int num_targets;
+    APEX_Mshr_Target targets[APEX_MSHR_TARGETS];
+} APEX_Mshr;
+
+/* Outstanding lines of the in-order pipeline, oldest first */
+typedef struct APEX_Mshr_File
+{
+    APEX_Mshr entries[APEX_MAX_MSHRS];
+    int count;
+} APEX_Mshr_File;
+
+/*
+ * State of the out-of-order backend, a plain value so CPUs and checkpoints
+ * can copy it. It is rebuilt from the architectural state whenever active
+ * is FALSE.
+ */
+typedef struct APEX_Ooo
+{
+    int active;
+    int rat[APEX_OOO_ARCH_REGS];   /* Speculative register alias table */
+    int phys_value[APEX_OOO_MAX_PHYS_REGS];
+    uint8_t phys_ready[APEX_OOO_MAX_PHYS_REGS];
+    int free_list[APEX_OOO_MAX_PHYS_REGS]; /* Circular, in free order */
+    int free_head;
+    int free_count;
+    APEX_Rob_Entry rob[APEX_OOO_MAX_ROB];
+    int rob_head;
+    int rob_count;
+    APEX_Iq_Entry iq[APEX_OOO_MAX_IQ];
+    int iq_count;
+    APEX_Lsq_Entry lsq[APEX_OOO_MAX_LSQ];
+    int lsq_head;
+    int lsq_count;
+    CPU_Stage fetch_queue[2 * APEX_OOO_MAX_WIDTH];
+    int fq_head;
+    int fq_count;
+    int fetch_stopped;             /* HALT was fetched */
+    int recovering;                /* Nothing dispatched since a squash */
+    uint64_t div_done[APEX_OOO_MAX_UNITS]; /* Clock at which the DIV in each
+                                              MUL unit is done, the divider
+                                              is not pipelined */
+    APEX_Ras commit_ras;           /* RAS after the committed instructions */
+} APEX_Ooo;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
     int pc;                        /* Current program counter */
-    int clock;                     /* Clock cycles elapsed */
-    int insn_completed;            /* Instructions retired */
+    uint64_t clock;                /* Clock cycles elapsed */
+    uint64_t insn_completed;       /* Instructions retired */
+    int last_retired_pc;           /* PC of the last retired instruction */
+    int stop_pc;                   /* apex_run_until() PC or -1 */
+    int stop_pc_retired;           /* stop_pc retired, set at retire time */
+    int halted;                    /* HALT has retired or the CPU faulted */
+    int fault;                     /* APEX_FAULT_* which stopped it */
+    int fault_pc;                  /* PC of the faulting instruction, or the
+                                      PC outside code memory */
+    int fault_address;             /* Data address it accessed */
     int regs[REG_FILE_SIZE];       /* Integer register file */
     int code_memory_size;          /* Number of instruction in the input file */
     APEX_Instruction *code_memory; /* Code Memory */
+    char **code_text;              /* Source text of each instruction */
+    int owns_code_memory;          /* FALSE when shared with other CPUs */
     int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
     int single_step;               /* Wait for user input after every cycle */
+    APEX_Trace trace;              /* What the pipeline prints, apex_trace.h */
+    struct APEX_Bintrace *bintrace; /* Binary trace of every cycle or NULL */
+    struct APEX_Kanata *kanata;    /* Kanata log for Konata or NULL */
+    struct APEX_Profile *profile;  /* Per-instruction hotspot profile or NULL */
+    APEX_Config config;
+    APEX_Stats stats;
+    APEX_Bpred bpred;              /* Direction predictor state */
+    APEX_Ras ras;                  /* Return address stack */
+    APEX_Cache l1d;                /* Lines held by the data cache, see
+                                      APEX_cpu_copy() to copy a CPU */
+    APEX_Cache l1i;                /* ... by the instruction cache */
+    APEX_Cache l2;                 /* ... and by the L2 */
+    APEX_Dram dram;                /* Open rows and busy banks */
+    APEX_Stride stride;            /* Strides learnt per load and store */
+    APEX_Store_Buffer store_buffer; /* Retired stores not yet written */
+    APEX_Mshr_File mshrs;          /* Loads which retired before their data */
+    APEX_Ooo ooo;                  /* Out-of-order backend state */
     
     int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
     int pos_flag;                  /* {TRUE, FALSE} */
     int neg_flag;                  /* {TRUE, FALSE} */
+    uint64_t flags_seq;            /* seq of the instruction which set them */
 
     int fetch_from_next_cycle;
+    int fetch_redirected;          /* Fetch skipped the last cycle for a redirect */
+    int icache_pending;            /* Fetch waits for the L1I line of icache_pc */
+    int icache_pc;
+    uint64_t icache_ready;         /* Clock at which it can fetch icache_pc */
 
     int flags_for_regs[REG_FILE_SIZE]; //added for flags
 
     //for forwarding
-    // track pending result in execute stage
+    // PENDING_NONE, PENDING_FORWARD or PENDING_WAIT for each register
     int regs_status_pending[REG_FILE_SIZE];
 
-    // track pending result in memory stage
+    // youngest in-flight result of each register
     int regs_value_pending[REG_FILE_SIZE];
 
+    // seq of the youngest in-flight producer of each register
+    uint64_t regs_pending_seq[REG_FILE_SIZE];
+
+    uint64_t next_seq;             /* seq given to the next fetched instruction */
+
     /* Pipeline stages */
     CPU_Stage fetch;
     CPU_Stage decode;
@@ -102,21 +480,108 @@ typedef struct APEX_CPU
     CPU_Stage memory;
     CPU_Stage writeback;
 
+    /* Second (V) pipe of dual issue, it moves in lockstep with the stages
+     * above and holds the younger instruction of each pair */
+    CPU_Stage fetch_v;
+    CPU_Stage decode_v;
+    CPU_Stage execute_v;
+    CPU_Stage memory_v;
+    CPU_Stage writeback_v;
+
+    /* Instructions which left the execute latches and occupy a function
+     * unit, oldest first. They move on to memory in this order. */
+    CPU_Stage fu_window[APEX_FU_WINDOW];
+    int fu_window_count;
+
+    CPU_Stage outputDisplay[5];    /* Stage contents shown by display mode */
+    CPU_Stage outputDisplay_v[5];  /* ... and of the V pipe */
+
     // for BTB - head and array for BTB entries which will include BTB size for each entry
 
     // int BTB_size;
     // BTB_entry *BTB_array;
-    int head_of_BTB;
-    BTB_entry BTB_array[BTB_adding_4_buffer];
+    uint64_t btb_clock;            /* Stamps allocations and uses of entries */
+    uint32_t btb_random;           /* State of the random replacement */
+    BTB_entry BTB_array[APEX_BTB_MAX_ENTRIES]; /* config.btb_size are used */
 
 } APEX_CPU;
 
-APEX_Instruction *create_code_memory(const char *filename, int *size);
+APEX_Instruction *create_code_memory(const char *filename, int *size,
+                                     char ***code_text);
+void free_code_text(char **code_text, int size);
+const char *get_opcode_str(int opcode);
 APEX_CPU *APEX_cpu_init(const char *filename);
+void APEX_cpu_setup(APEX_CPU *cpu);
+void APEX_cpu_print_program(const APEX_CPU *cpu);
+void APEX_cpu_print_stats(const APEX_CPU *cpu);
+void APEX_display_stages(const CPU_Stage display[5]);
+int APEX_cpu_display_pipes(const APEX_CPU *cpu);
+void APEX_config_default(APEX_Config *config);
+int APEX_config_check(const APEX_Config *config, char *error, size_t size);
+int APEX_config_valid(const APEX_Config *config);
+int APEX_cpu_configure(APEX_CPU *cpu, const APEX_Config *config);
+int APEX_cpu_cycle(APEX_CPU *cpu);
 void APEX_cpu_run(APEX_CPU *cpu);
 void APEX_cpu_stop(APEX_CPU *cpu);
+int APEX_cpu_copy(APEX_CPU *dst, const APEX_CPU *src);
+void APEX_cpu_free_copy(APEX_CPU *cpu);
+void APEX_cpu_fault(APEX_CPU *cpu, int fault, int pc, int address);
+void APEX_cpu_print_fault(const APEX_CPU *cpu);
 
 void APEX_cpu_simulate(APEX_CPU *cpu, int cycles,const char *filename)  ; //added for simulate
+void Registers_state(APEX_CPU *cpu);
+void State_data_memory(APEX_CPU *cpu);
+
+void APEX_cpu_reset_pipeline(APEX_CPU *cpu);
+void APEX_print_stage(const char *name, const CPU_Stage *stage);
+void APEX_predict_next_pc(APEX_CPU *cpu, CPU_Stage *stage);
+int APEX_div_latency(const APEX_Config *config, int rs1_value, int rs2_value);
+int APEX_backend_parse(const char *name);
+const char *APEX_backend_name(int backend);
+
+/* Memory hierarchy, apex_memsys.c */
+int APEX_memsys_init(APEX_CPU *cpu);
+void APEX_memsys_free(APEX_CPU *cpu);
+int APEX_memsys_config_check(const APEX_Config *config, char *error, size_t size);
+int APEX_data_access(APEX_CPU *cpu, int pc, int address, int write);
+int APEX_fetch_ready(APEX_CPU *cpu);
+void APEX_warm_data(APEX_CPU *cpu, int pc, int address, int write);
+void APEX_warm_insn(APEX_CPU *cpu, int pc);
+int APEX_store_buffer_find(const APEX_CPU *cpu, int address);
+int APEX_store_buffer_insert(APEX_CPU *cpu, int pc, int address, int value);
+void APEX_store_buffer_cycle(APEX_CPU *cpu);
+void APEX_store_buffer_flush(APEX_CPU *cpu);
+int APEX_read_data(const APEX_CPU *cpu, int address);
+void APEX_memsys_print_stats(const APEX_CPU *cpu);
+
+/* Out-of-order backend, apex_ooo.c */
+int APEX_ooo_cycle(APEX_CPU *cpu);
+void APEX_ooo_print_stats(const APEX_CPU *cpu);
+
+/* Functional (ISA-only) simulator, apex_functional.c */
+typedef struct APEX_Functional_Hooks
+{
+    int warm;                      /* Train the predictors and fill the caches
+                                      like the pipeline would */
+
+    /* Called for every executed basic block (code index, length) */
+    void (*basic_block)(void *ctx, int start_index, int num_insns);
+    void *ctx;
+} APEX_Functional_Hooks;
+
+int APEX_functional_run(APEX_CPU *cpu, uint64_t max_insns,
+                        const APEX_Functional_Hooks *hooks, uint64_t *executed);
+int APEX_cpu_fast_forward(APEX_CPU *cpu, uint64_t num_insns, uint64_t *executed);
+
+/* Sampled simulation, apex_simpoint.c */
+int APEX_simpoint_run(const APEX_CPU *cpu, uint64_t interval_size, int max_k);
+
+/* Checkpoint and restore, apex_checkpoint.c */
+int APEX_cpu_checkpoint(const APEX_CPU *cpu, const char *filename);
+int APEX_cpu_restore(APEX_CPU *cpu, const char *filename);
+
+/* Warm-up of microarchitectural state during fast-forward */
+void APEX_warm_branch(APEX_CPU *cpu, int pc, int opcode, int taken, int target);
 
 //btb functions
 // int search_entry_in_BTB(APEX_CPU *cpu, int pc);
@@ -127,10 +592,14 @@ void initialize_btb(APEX_CPU *cpu);
 int change_btb_2(int current_bits);
 int change_btb_0(int current_bits);
 
-void update_branch_BP_BNZ(APEX_CPU* cpu);
-void update_branch_BZ_BNP(APEX_CPU* cpu);
+BTB_entry *update_btb_outcome(APEX_CPU *cpu, int instruction_addr, int taken,
+                              int calc_target_address);
 
-void update_btb_entry(APEX_CPU *cpu, int instruction_addr, int calc_target_address);
+int update_btb_entry(APEX_CPU *cpu, int instruction_addr, int calc_target_address);
+void touch_btb_entry(APEX_CPU *cpu, int btb_index);
+int APEX_btb_parse_policy(const char *name);
+const char *APEX_btb_policy_name(int policy);
+void add_btb_branch(APEX_CPU *cpu, int instruction_addr, int opcode);
 
 #endif
 
@@ -0,0 +1,146 @@
+/*
+ * apex_dram.c
+ * Contains the banked DRAM timing model
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "apex_dram.h"
+#include "apex_macros.h"
+
+/*
+ * Returns NULL if the organization can be modelled, 0 banks always can.
+ * Otherwise returns the option suffix of the first parameter which can not.
+ */
+const char *
+APEX_dram_config_error(const APEX_Dram_Config *config)
+{
+    if (!config->banks)
+    {
+        return NULL;
+    }
+    if (config->banks < 0 || config->banks > APEX_DRAM_MAX_BANKS
+        || (config->banks & (config->banks - 1)) != 0)
+    {
+        return "banks";
+    }
+    if (config->row_size <= 0 || (config->row_size & (config->row_size - 1)) != 0)
+    {
+        return "row";
+    }
+    if (config->cas_latency < 1)
+    {
+        return "cas";
+    }
+    if (config->activate_latency < 0)
+    {
+        return "activate";
+    }
+    if (config->precharge_latency < 0)
+    {
+        return "precharge";
+    }
+    if (config->burst_cycles < 1)
+    {
+        return "burst";
+    }
+
+    return NULL;
+}
+
+/* Closes all banks and sets the organization, which must be valid */
+void
+APEX_dram_init(APEX_Dram *dram, const APEX_Dram_Config *config)
+{
+    int i;
+
+    memset(dram, 0, sizeof(*dram));
+    dram->config = *config;
+    for (i = 0; i < APEX_DRAM_MAX_BANKS; ++i)
+    {
+        dram->banks[i].open_row = -1;
+    }
+    while (config->banks && (1 << dram->row_bits) < config->row_size)
+    {
+        dram->row_bits++;
+    }
+}
+
+/*
+ * Reads or writes the line of address, the request arriving at cycle now.
+ * Returns the cycles until its data has crossed the bus. Counts the access
+ * in stats unless it is NULL.
+ */
+int
+APEX_dram_access(APEX_Dram *dram, int address, int write, uint64_t now,
+                 APEX_Dram_Stats *stats)
+{
+    const APEX_Dram_Config *config = &dram->config;
+    uint32_t row_number = (uint32_t)address >> dram->row_bits;
+    APEX_Dram_Bank *bank = &dram->banks[row_number & (config->banks - 1)];
+    int row = (int)(row_number / config->banks);
+    uint64_t start = now > bank->busy_until ? now : bank->busy_until;
+    uint64_t data_ready;
+    uint64_t transfer;
+
+    if (stats)
+    {
+        stats->reads += !write;
+        stats->writes += write;
+        stats->row_hits += bank->open_row == row;
+        stats->row_empty += bank->open_row == -1;
+        stats->row_conflicts += bank->open_row != row && bank->open_row != -1;
+    }
+
+    data_ready = start + config->cas_latency;
+    if (bank->open_row != row)
+    {
+        data_ready += config->activate_latency;
+        if (bank->open_row != -1)
+        {
+            data_ready += config->precharge_latency;
+        }
+        bank->open_row = row;
+    }
+
+    /* One burst at a time on the shared bus */
+    transfer = data_ready > dram->bus_free ? data_ready : dram->bus_free;
+    dram->bus_free = transfer + config->burst_cycles;
+    bank->busy_until = dram->bus_free;
+
+    if (stats)
+    {
+        stats->cycles += dram->bus_free - now;
+        stats->bank_wait += start - now;
+        stats->bus_wait += transfer - data_ready;
+    }
+    return (int)(dram->bus_free - now);
+}
+
+/* Prints the organization and the counters of an enabled DRAM */
+void
+APEX_dram_print_stats(const APEX_Dram_Config *config,
+                      const APEX_Dram_Stats *stats)
+{
+    uint64_t accesses = stats->reads + stats->writes;
+
+    printf("APEX_CPU: DRAM %d banks, %d B rows, CAS %d, activate %d,"
+           " precharge %d, burst %d\n", config->banks, config->row_size,
+           config->cas_latency, config->activate_latency,
+           config->precharge_latency, config->burst_cycles);
+    printf("          reads = %llu, writes = %llu, row hits = %llu,"
+           " empty = %llu, conflicts = %llu",
+           (unsigned long long)stats->reads, (unsigned long long)stats->writes,
+           (unsigned long long)stats->row_hits,
+           (unsigned long long)stats->row_empty,
+           (unsigned long long)stats->row_conflicts);
+    if (accesses)
+    {
+        printf(", row hit rate %.1f%%\n", 100.0 * stats->row_hits / accesses);
+        printf("          average latency %.2f cycles (bank wait %.2f,"
+               " bus wait %.2f)", (double)stats->cycles / accesses,
+               (double)stats->bank_wait / accesses,
+               (double)stats->bus_wait / accesses);
+    }
+    printf("\n");
+}
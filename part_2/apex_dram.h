@@ -0,0 +1,65 @@
+/*
+ * apex_dram.h
+ * Contains the banked DRAM timing model
+ *
+ * Lines are interleaved over the banks row by row. Every bank keeps its last
+ * row open: an access to the open row only pays the column access, one to a
+ * closed bank also activates the row, and one to another row first closes
+ * the open one. All banks share one data bus which moves a line in
+ * burst_cycles, which limits the bandwidth. Like the caches the model only
+ * tracks timing, the data stays in APEX_CPU.data_memory.
+ */
+#ifndef _APEX_DRAM_H_
+#define _APEX_DRAM_H_
+
+#include <stdint.h>
+
+#define APEX_DRAM_MAX_BANKS 64
+
+/* Organization and timing in CPU cycles, part of APEX_Config */
+typedef struct APEX_Dram_Config
+{
+    int banks;                     /* A power of two, 0 disables the model */
+    int row_size;                  /* Bytes per row, a power of two */
+    int cas_latency;               /* Column access to an open row */
+    int activate_latency;          /* Opening a row */
+    int precharge_latency;         /* Closing the open row */
+    int burst_cycles;              /* Data bus cycles per access */
+} APEX_Dram_Config;
+
+/* Event counters, part of APEX_Stats */
+typedef struct APEX_Dram_Stats
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t row_hits;             /* The row was open */
+    uint64_t row_empty;            /* The bank had no open row */
+    uint64_t row_conflicts;        /* Another row was open */
+    uint64_t cycles;               /* Latency of all accesses */
+    uint64_t bank_wait;            /* ... spent waiting for a busy bank */
+    uint64_t bus_wait;             /* ... and for the data bus */
+} APEX_Dram_Stats;
+
+typedef struct APEX_Dram_Bank
+{
+    int open_row;                  /* -1 when the bank is closed */
+    uint64_t busy_until;           /* Cycle the bank takes the next access */
+} APEX_Dram_Bank;
+
+/* DRAM state, a plain value so CPUs and checkpoints can copy it */
+typedef struct APEX_Dram
+{
+    APEX_Dram_Config config;
+    int row_bits;                  /* log2(row_size) */
+    uint64_t bus_free;             /* Cycle the data bus is free */
+    APEX_Dram_Bank banks[APEX_DRAM_MAX_BANKS];
+} APEX_Dram;
+
+const char *APEX_dram_config_error(const APEX_Dram_Config *config);
+void APEX_dram_init(APEX_Dram *dram, const APEX_Dram_Config *config);
+int APEX_dram_access(APEX_Dram *dram, int address, int write, uint64_t now,
+                     APEX_Dram_Stats *stats);
+void APEX_dram_print_stats(const APEX_Dram_Config *config,
+                           const APEX_Dram_Stats *stats);
+
+#endif
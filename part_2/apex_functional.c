@@ -0,0 +1,272 @@
+/*
+ * apex_functional.c
+ * Contains the APEX functional (ISA-only) simulator. It executes the
+ * predecoded code memory directly on the architectural state of APEX_CPU
+ * (registers, flags and data memory) without modelling the pipeline, using
+ * the same instruction semantics as the pipeline stages (apex_isa.h).
+ */
+#include "apex_cpu.h"
+#include "apex_isa.h"
+#include "apex_macros.h"
+
+/*
+ * Executes up to max_insns instructions starting at cpu->pc. hooks may be
+ * NULL. With hooks->warm set, branches also train the BTB and the direction
+ * predictor, and calls and returns the RAS, like the pipeline would
+ * (APEX_warm_branch), instructions fill the L1I (APEX_warm_insn) and loads
+ * and stores fill the L1D and train the stride prefetcher (APEX_warm_data),
+ * both through the L2. hooks->basic_block is called whenever a control
+ * transfer or HALT ends a basic block, and for the partial block executed
+ * last when max_insns is reached.
+ *
+ * On return cpu->pc is the PC of the next instruction to execute (the HALT
+ * itself when HALT was reached) and *executed holds the number of
+ * instructions executed, HALT included. Returns TRUE if HALT was executed,
+ * or if execution stopped at a PC outside code memory or at a load or store
+ * outside data memory, which cpu->fault records (APEX_cpu_fault).
+ */
+int
+APEX_functional_run(APEX_CPU *cpu, uint64_t max_insns,
+                    const APEX_Functional_Hooks *hooks, uint64_t *executed)
+{
+    const APEX_Instruction *code = cpu->code_memory;
+    const int code_size = cpu->code_memory_size;
+    int *regs = cpu->regs;
+    int *data_memory = cpu->data_memory;
+    int index = APEX_code_index(cpu->pc);
+    const int warm = hooks && hooks->warm;
+    void (*basic_block)(void *, int, int) = hooks ? hooks->basic_block : NULL;
+    int block_start = index;
+    uint64_t count = 0;
+    int halted = FALSE;
+
+    while (count < max_insns)
+    {
+        const APEX_Instruction *ins;
+
+        if (index < 0 || index >= code_size)
+        {
+            APEX_cpu_fault(cpu, APEX_FAULT_CODE, APEX_code_pc(index), 0);
+            halted = TRUE;
+            break;
+        }
+
+        ins = &code[index];
+        if (ins->operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+        {
+            int base = (ins->operand_class & APEX_OPND_LOAD) ? regs[ins->rs1]
+                                                             : regs[ins->rs2];
+            int address = APEX_add(base, ins->imm);
+
+            if (!APEX_data_address_valid(address))
+            {
+                APEX_cpu_fault(cpu, APEX_FAULT_DATA, APEX_code_pc(index), address);
+                halted = TRUE;
+                break;
+            }
+        }
+        count++;
+        if (warm)
+        {
+            APEX_warm_insn(cpu, APEX_code_pc(index));
+        }
+
+        if (basic_block && (ins->operand_class & APEX_OPND_CTRL
+                            || ins->opcode == OPCODE_HALT))
+        {
+            basic_block(hooks->ctx, block_start, index - block_start + 1);
+        }
+
+        switch (ins->opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_SUB:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            case OPCODE_ADDL:
+            case OPCODE_SUBL:
+            {
+                int result = APEX_alu_result(ins->opcode, regs[ins->rs1],
+                                             regs[ins->rs2], ins->imm);
+
+                APEX_set_flags(cpu, result);
+                regs[ins->rd] = result;
+                index++;
+                break;
+            }
+
+            case OPCODE_MOVC:
+            {
+                regs[ins->rd] = ins->imm;
+                index++;
+                break;
+            }
+
+            case OPCODE_CMP:
+            {
+                APEX_compare(cpu, regs[ins->rs1], regs[ins->rs2]);
+                index++;
+                break;
+            }
+
+            case OPCODE_CML:
+            {
+                APEX_compare(cpu, regs[ins->rs1], ins->imm);
+                index++;
+                break;
+            }
+
+            case OPCODE_LOAD:
+            {
+                if (warm)
+                {
+                    APEX_warm_data(cpu, APEX_code_pc(index),
+                                   APEX_add(regs[ins->rs1], ins->imm), FALSE);
+                }
+                regs[ins->rd] = data_memory[APEX_add(regs[ins->rs1], ins->imm)];
+                index++;
+                break;
+            }
+
+            case OPCODE_LOADP:
+            {
+                int base = regs[ins->rs1];
+
+                if (warm)
+                {
+                    APEX_warm_data(cpu, APEX_code_pc(index),
+                                   APEX_add(base, ins->imm), FALSE);
+                }
+                regs[ins->rd] = data_memory[APEX_add(base, ins->imm)];
+                regs[ins->rs1] = APEX_add(base, 4);
+                index++;
+                break;
+            }
+
+            case OPCODE_STORE:
+            {
+                if (warm)
+                {
+                    APEX_warm_data(cpu, APEX_code_pc(index),
+                                   APEX_add(regs[ins->rs2], ins->imm), TRUE);
+                }
+                data_memory[APEX_add(regs[ins->rs2], ins->imm)] = regs[ins->rs1];
+                index++;
+                break;
+            }
+
+            case OPCODE_STOREP:
+            {
+                int base = regs[ins->rs2];
+
+                if (warm)
+                {
+                    APEX_warm_data(cpu, APEX_code_pc(index),
+                                   APEX_add(base, ins->imm), TRUE);
+                }
+                data_memory[APEX_add(base, ins->imm)] = regs[ins->rs1];
+                regs[ins->rs2] = APEX_add(base, 4);
+                index++;
+                break;
+            }
+
+            case OPCODE_BZ:
+            case OPCODE_BNZ:
+            case OPCODE_BP:
+            case OPCODE_BNP:
+            case OPCODE_BN:
+            case OPCODE_BNN:
+            {
+                int pc = APEX_code_pc(index);
+                int taken = APEX_branch_taken(ins->opcode, cpu);
+
+                if (warm)
+                {
+                    APEX_warm_branch(cpu, pc, ins->opcode, taken, pc + ins->imm);
+                }
+                index = APEX_code_index(taken ? pc + ins->imm : pc + 4);
+                block_start = index;
+                break;
+            }
+
+            case OPCODE_JUMP:
+            {
+                int target = APEX_add(regs[ins->rs1], ins->imm);
+
+                if (warm && APEX_is_return(ins->opcode, ins->imm))
+                {
+                    APEX_warm_branch(cpu, APEX_code_pc(index), ins->opcode, TRUE,
+                                     target);
+                }
+                index = APEX_code_index(target);
+                block_start = index;
+                break;
+            }
+
+            case OPCODE_JALR:
+            {
+                int target = APEX_add(regs[ins->rs1], ins->imm);
+
+                if (warm)
+                {
+                    APEX_warm_branch(cpu, APEX_code_pc(index), ins->opcode, TRUE,
+                                     target);
+                }
+                regs[ins->rd] = APEX_code_pc(index) + 4;
+                index = APEX_code_index(target);
+                block_start = index;
+                break;
+            }
+
+            case OPCODE_NOP:
+            {
+                index++;
+                break;
+            }
+
+            case OPCODE_HALT:
+            {
+                halted = TRUE;
+                break;
+            }
+        }
+
+        if (halted)
+        {
+            break;
+        }
+    }
+
+    if (basic_block && !halted && index > block_start)
+    {
+        basic_block(hooks->ctx, block_start, index - block_start);
+    }
+
+    cpu->pc = APEX_code_pc(index);
+    if (executed)
+    {
+        *executed = count;
+    }
+
+    return halted;
+}
+
+/*
+ * Fast-forwards num_insns instructions on the functional simulator while
+ * warming the branch predictors, the RAS, the caches and the stride table
+ * (see APEX_functional_run), then hands the architectural state to the
+ * pipeline which restarts with empty latches at cpu->pc. Returns TRUE if
+ * HALT was reached.
+ */
+int
+APEX_cpu_fast_forward(APEX_CPU *cpu, uint64_t num_insns, uint64_t *executed)
+{
+    APEX_Functional_Hooks hooks = { TRUE, NULL, NULL };
+    int halted = APEX_functional_run(cpu, num_insns, &hooks, executed);
+
+    APEX_cpu_reset_pipeline(cpu);
+    return halted;
+}
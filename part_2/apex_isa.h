@@ -0,0 +1,184 @@
+/*
+ * apex_isa.h
+ * Contains APEX instruction semantics shared by the pipeline model and the
+ * functional simulator, so that both always compute the same results
+ */
+#ifndef _APEX_ISA_H_
+#define _APEX_ISA_H_
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* First PC of code memory */
+#define APEX_CODE_BASE 4000
+
+/* Converts a PC(4000 series) into a code memory index and back */
+static inline int
+APEX_code_index(int pc)
+{
+    return (pc - APEX_CODE_BASE) / 4;
+}
+
+static inline int
+APEX_code_pc(int index)
+{
+    return APEX_CODE_BASE + index * 4;
+}
+
+/*
+ * 32-bit two's complement arithmetic which wraps around on overflow, as the
+ * hardware would, instead of the undefined behaviour of signed overflow in C
+ */
+static inline int
+APEX_add(int lhs, int rhs)
+{
+    return (int)((uint32_t)lhs + (uint32_t)rhs);
+}
+
+static inline int
+APEX_sub(int lhs, int rhs)
+{
+    return (int)((uint32_t)lhs - (uint32_t)rhs);
+}
+
+static inline int
+APEX_mul(int lhs, int rhs)
+{
+    return (int)((uint32_t)lhs * (uint32_t)rhs);
+}
+
+/* Returns TRUE if address is a word of data memory */
+static inline int
+APEX_data_address_valid(int address)
+{
+    return address >= 0 && address < DATA_MEMORY_SIZE;
+}
+
+/* Result of the arithmetic and logic instructions */
+static inline int
+APEX_alu_result(int opcode, int rs1_value, int rs2_value, int imm)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+            return APEX_add(rs1_value, rs2_value);
+
+        case OPCODE_SUB:
+            return APEX_sub(rs1_value, rs2_value);
+
+        case OPCODE_MUL:
+            return APEX_mul(rs1_value, rs2_value);
+
+        case OPCODE_DIV:
+            /*
+             * Division by zero produces 0 and INT_MIN / -1 wraps around to
+             * INT_MIN instead of trapping the host
+             */
+            if (!rs2_value)
+            {
+                return 0;
+            }
+            if (rs1_value == INT_MIN && rs2_value == -1)
+            {
+                return INT_MIN;
+            }
+            return rs1_value / rs2_value;
+
+        case OPCODE_AND:
+            return rs1_value & rs2_value;
+
+        case OPCODE_OR:
+            return rs1_value | rs2_value;
+
+        case OPCODE_XOR:
+            return rs1_value ^ rs2_value;
+
+        case OPCODE_ADDL:
+            return APEX_add(rs1_value, imm);
+
+        case OPCODE_SUBL:
+            return APEX_sub(rs1_value, imm);
+    }
+
+    return 0;
+}
+
+/* Sets zero/pos/neg flags from an arithmetic result */
+static inline void
+APEX_set_flags(APEX_CPU *cpu, int result)
+{
+    cpu->zero_flag = (result == 0);
+    cpu->pos_flag = (result > 0);
+    cpu->neg_flag = (result < 0);
+}
+
+/* Sets zero/pos/neg flags for CMP and CML */
+static inline void
+APEX_compare(APEX_CPU *cpu, int lhs, int rhs)
+{
+    cpu->zero_flag = (lhs == rhs);
+    cpu->pos_flag = (lhs > rhs);
+    cpu->neg_flag = (lhs < rhs);
+}
+
+/* Returns TRUE if a conditional branch is taken with the given flags */
+static inline int
+APEX_flags_taken(int opcode, int zero_flag, int pos_flag, int neg_flag)
+{
+    switch (opcode)
+    {
+        case OPCODE_BZ:
+            return zero_flag;
+
+        case OPCODE_BNZ:
+            return !zero_flag;
+
+        case OPCODE_BP:
+            return pos_flag;
+
+        case OPCODE_BNP:
+            return !pos_flag;
+
+        case OPCODE_BN:
+            return neg_flag;
+
+        case OPCODE_BNN:
+            return !neg_flag;
+    }
+
+    return FALSE;
+}
+
+/* Returns TRUE if a conditional branch is taken with the current flags */
+static inline int
+APEX_branch_taken(int opcode, const APEX_CPU *cpu)
+{
+    return APEX_flags_taken(opcode, cpu->zero_flag, cpu->pos_flag, cpu->neg_flag);
+}
+
+/* Returns TRUE for the conditional branches which are tracked in the BTB */
+static inline int
+APEX_is_btb_branch(int opcode)
+{
+    return opcode == OPCODE_BZ || opcode == OPCODE_BNZ || opcode == OPCODE_BP
+           || opcode == OPCODE_BNP;
+}
+
+/* Returns TRUE for the return idiom JUMP Rx,#0, popped from the RAS */
+static inline int
+APEX_is_return(int opcode, int imm)
+{
+    return opcode == OPCODE_JUMP && imm == 0;
+}
+
+/* Register which LOADP and STOREP increment by 4 */
+static inline int
+APEX_post_inc_reg(int opcode, int rs1, int rs2)
+{
+    return (opcode == OPCODE_LOADP) ? rs1 : rs2;
+}
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * apex_kanata.c
+ * Contains the Kanata (version 0004) log export
+ *
+ * After every cycle the stage contents shown by display mode are compared
+ * with the previous cycle. An instruction seen for the first time starts in
+ * its stage, one seen in another stage moves there, one in writeback
+ * retires, and one which is no longer in any stage was flushed by a branch
+ * redirect.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "apex_kanata.h"
+#include "apex_macros.h"
+
+/*
+ * Initial size of the live table, which doubles when instructions waiting in
+ * the function units and the stages do not fit
+ */
+#define KANATA_INITIAL_LIVE 16
+
+static const char *const kanata_stage_names[5] = { "F", "D", "X", "M", "W" };
+
+typedef struct Kanata_Insn
+{
+    uint64_t seq;
+    uint64_t id;                   /* Id in the log */
+    int stage;
+    int seen;                      /* Present in the current cycle */
+} Kanata_Insn;
+
+struct APEX_Kanata
+{
+    FILE *fp;
+    int started;
+    uint64_t last_cycle;
+    uint64_t next_id;
+    uint64_t next_retire_id;
+    Kanata_Insn *live;
+    int num_live;
+    int max_live;
+    int error;                     /* An instruction was left out */
+};
+
+/*
+ * Creates filename and writes the header. Returns NULL on error.
+ */
+APEX_Kanata *
+APEX_kanata_open(const char *filename)
+{
+    APEX_Kanata *log = calloc(1, sizeof(*log));
+
+    if (!log)
+    {
+        return NULL;
+    }
+
+    log->max_live = KANATA_INITIAL_LIVE;
+    log->live = malloc(sizeof(Kanata_Insn) * log->max_live);
+    log->fp = fopen(filename, "w");
+    if (!log->live || !log->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create %s\n", filename);
+        if (log->fp)
+        {
+            fclose(log->fp);
+        }
+        free(log->live);
+        free(log);
+        return NULL;
+    }
+
+    fprintf(log->fp, "Kanata\t0004\n");
+    return log;
+}
+
+static Kanata_Insn *
+find_insn(APEX_Kanata *log, uint64_t seq)
+{
+    int i;
+
+    for (i = 0; i < log->num_live; ++i)
+    {
+        if (log->live[i].seq == seq)
+        {
+            return &log->live[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* First appearance of an instruction. Returns NULL if out of memory */
+static Kanata_Insn *
+start_insn(APEX_Kanata *log, const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    Kanata_Insn *insn;
+
+    if (log->num_live == log->max_live)
+    {
+        Kanata_Insn *grown = realloc(log->live, sizeof(Kanata_Insn)
+                                                    * log->max_live * 2);
+
+        if (!grown)
+        {
+            if (!log->error)
+            {
+                fprintf(stderr, "APEX_Error: Out of memory, the Kanata log "
+                                "is incomplete\n");
+            }
+            log->error = TRUE;
+            return NULL;
+        }
+        log->live = grown;
+        log->max_live *= 2;
+    }
+
+    insn = &log->live[log->num_live++];
+    insn->seq = stage->seq;
+    insn->id = log->next_id++;
+    insn->stage = -1;
+
+    fprintf(log->fp, "I\t%llu\t%llu\t0\n", (unsigned long long)insn->id,
+            (unsigned long long)stage->seq);
+    fprintf(log->fp, "L\t%llu\t0\t%d: %s\n", (unsigned long long)insn->id,
+            stage->pc, cpu->code_text ? cpu->code_text[stage->code_index]
+                                      : get_opcode_str(stage->opcode));
+    fprintf(log->fp, "L\t%llu\t1\tseq %llu\n", (unsigned long long)insn->id,
+            (unsigned long long)stage->seq);
+    return insn;
+}
+
+/* Retires (flush FALSE) or flushes the instruction at live[index] */
+static void
+end_insn(APEX_Kanata *log, int index, int flush)
+{
+    Kanata_Insn *insn = &log->live[index];
+
+    fprintf(log->fp, "R\t%llu\t%llu\t%d\n", (unsigned long long)insn->id,
+            (unsigned long long)(flush ? 0 : log->next_retire_id++), flush);
+    log->live[index] = log->live[--log->num_live];
+}
+
+/*
+ * Logs the cycle that was just simulated. On the cycle HALT retires only
+ * writeback was evaluated.
+ */
+void
+APEX_kanata_cycle(APEX_Kanata *log, const APEX_CPU *cpu, int halted)
+{
+    uint64_t cycle = cpu->clock - 1;
+    int first_stage = halted ? 4 : 0;
+    int i;
+
+    if (!log->started)
+    {
+        fprintf(log->fp, "C=\t%llu\n", (unsigned long long)cycle);
+        log->started = TRUE;
+    }
+    else
+    {
+        fprintf(log->fp, "C\t%llu\n", (unsigned long long)(cycle - log->last_cycle));
+    }
+    log->last_cycle = cycle;
+
+    for (i = 0; i < log->num_live; ++i)
+    {
+        log->live[i].seen = FALSE;
+    }
+
+    for (i = first_stage; i < 5; ++i)
+    {
+        const CPU_Stage *stage = &cpu->outputDisplay[i];
+        Kanata_Insn *insn;
+
+        if (!stage->has_insn)
+        {
+            continue;
+        }
+
+        insn = find_insn(log, stage->seq);
+        if (!insn)
+        {
+            insn = start_insn(log, cpu, stage);
+            if (!insn)
+            {
+                continue;
+            }
+        }
+
+        /* A held instruction is shown in fetch and decode, keep the later */
+        if (i > insn->stage)
+        {
+            fprintf(log->fp, "S\t%llu\t0\t%s\n", (unsigned long long)insn->id,
+                    kanata_stage_names[i]);
+            insn->stage = i;
+        }
+        insn->seen = TRUE;
+    }
+
+    /*
+     * Instructions behind the one shown in execute wait in a function unit,
+     * or have just left it for memory without being shown
+     */
+    for (i = 0; i < cpu->fu_window_count + 2 && !halted; ++i)
+    {
+        const CPU_Stage *stage = (i < cpu->fu_window_count)
+                                     ? &cpu->fu_window[i]
+                                     : (i == cpu->fu_window_count)
+                                           ? &cpu->memory
+                                           : &cpu->memory_v;
+        Kanata_Insn *insn;
+
+        if (stage->has_insn && (insn = find_insn(log, stage->seq)) != NULL)
+        {
+            insn->seen = TRUE;
+        }
+    }
+
+    /* Writeback retires, vanished instructions were flushed */
+    for (i = log->num_live - 1; i >= 0; --i)
+    {
+        if (!log->live[i].seen && !halted)
+        {
+            end_insn(log, i, TRUE);
+        }
+        else if (log->live[i].seen && log->live[i].stage == 4)
+        {
+            end_insn(log, i, FALSE);
+        }
+    }
+}
+
+/*
+ * Closes the log. Returns 0 on success, -1 if writing failed or an
+ * instruction was left out.
+ */
+int
+APEX_kanata_close(APEX_Kanata *log)
+{
+    int status = (fclose(log->fp) != 0) ? -1 : 0;
+
+    if (status)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write the Kanata log\n");
+    }
+    if (log->error)
+    {
+        status = -1;
+    }
+
+    free(log->live);
+    free(log);
+    return status;
+}
@@ -0,0 +1,17 @@
+/*
+ * apex_kanata.h
+ * Contains the export of pipeline logs in the Kanata format, which can be
+ * opened in the Konata pipeline viewer
+ */
+#ifndef _APEX_KANATA_H_
+#define _APEX_KANATA_H_
+
+#include "apex_cpu.h"
+
+typedef struct APEX_Kanata APEX_Kanata;
+
+APEX_Kanata *APEX_kanata_open(const char *filename);
+void APEX_kanata_cycle(APEX_Kanata *log, const APEX_CPU *cpu, int halted);
+int APEX_kanata_close(APEX_Kanata *log);
+
+#endif
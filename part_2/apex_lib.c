@@ -0,0 +1,302 @@
+/*
+ * apex_lib.c
+ * Contains the embedding API of libapex (see apex_lib.h)
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_lib.h"
+#include "apex_macros.h"
+
+/*
+ * Parses an input file. Returns NULL if the file can not be read.
+ */
+APEX_Program *
+apex_program_load(const char *filename)
+{
+    APEX_Program *program = calloc(1, sizeof(*program));
+
+    if (!program)
+    {
+        return NULL;
+    }
+
+    program->code_memory = create_code_memory(filename,
+                                              &program->code_memory_size,
+                                              &program->code_text);
+    if (!program->code_memory)
+    {
+        free(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+/* Frees a program, after all CPUs using it have been destroyed */
+void
+apex_program_free(APEX_Program *program)
+{
+    if (!program)
+    {
+        return;
+    }
+
+    free_code_text(program->code_text, program->code_memory_size);
+    free(program->code_memory);
+    free(program);
+}
+
+/*
+ * Returns 0 if config can be simulated, else -1 and writes which option is
+ * out of range to error (of size bytes, may be NULL). Nothing is printed.
+ */
+int
+apex_config_check(const APEX_Config *config, char *error, size_t size)
+{
+    return APEX_config_check(config, error, size);
+}
+
+/*
+ * Creates a quiet CPU in the reset state which runs program. config may be
+ * NULL for the default configuration. Returns NULL on error, which for an
+ * invalid config apex_config_check() explains.
+ */
+APEX_CPU *
+apex_create(const APEX_Program *program, const APEX_Config *config)
+{
+    APEX_CPU *cpu;
+
+    if (!program)
+    {
+        return NULL;
+    }
+
+    cpu = calloc(1, sizeof(*cpu));
+    if (!cpu)
+    {
+        return NULL;
+    }
+
+    cpu->code_memory = program->code_memory;
+    cpu->code_text = program->code_text;
+    cpu->code_memory_size = program->code_memory_size;
+    cpu->owns_code_memory = FALSE;
+    apex_reset(cpu);
+
+    if (config && APEX_cpu_configure(cpu, config) != 0)
+    {
+        APEX_cpu_stop(cpu);
+        return NULL;
+    }
+
+    return cpu;
+}
+
+/*
+ * Restarts the program, keeping the configuration. Returns 0, or -1 if the
+ * caches are out of memory and the CPU can only be destroyed.
+ */
+int
+apex_reset(APEX_CPU *cpu)
+{
+    APEX_Instruction *code_memory = cpu->code_memory;
+    char **code_text = cpu->code_text;
+    int code_memory_size = cpu->code_memory_size;
+    int owns_code_memory = cpu->owns_code_memory;
+    APEX_Config config = cpu->config;
+    int configured = cpu->config.btb_size != 0;
+
+    APEX_memsys_free(cpu);
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->code_memory = code_memory;
+    cpu->code_text = code_text;
+    cpu->code_memory_size = code_memory_size;
+    cpu->owns_code_memory = owns_code_memory;
+    APEX_cpu_setup(cpu);
+    cpu->trace.level = APEX_TRACE_OFF;
+    cpu->single_step = FALSE;
+
+    /* Also sizes the BTB, predictor, RAS and caches for the configuration */
+    if (configured)
+    {
+        return APEX_cpu_configure(cpu, &config);
+    }
+    return 0;
+}
+
+void
+apex_destroy(APEX_CPU *cpu)
+{
+    if (cpu)
+    {
+        APEX_cpu_stop(cpu);
+    }
+}
+
+/*
+ * Simulates up to n_cycles cycles, less if HALT retires or the CPU faults.
+ * Returns the number of cycles simulated.
+ */
+uint64_t
+apex_step(APEX_CPU *cpu, uint64_t n_cycles)
+{
+    uint64_t done = 0;
+
+    while (done < n_cycles && !cpu->halted)
+    {
+        APEX_cpu_cycle(cpu);
+        done++;
+    }
+
+    return done;
+}
+
+/*
+ * Simulates until HALT, a fault or one of the conditions in cond is met.
+ * Conditions are checked after every cycle, so instructions retiring in the
+ * same cycle as the one at stop_pc (or as the max_insns-th) are retired as
+ * well.
+ */
+APEX_Stop_Reason
+apex_run_until(APEX_CPU *cpu, const APEX_Stop_Condition *cond)
+{
+    uint64_t start_cycles = cpu->clock;
+    uint64_t start_insns = cpu->insn_completed;
+    APEX_Stop_Reason reason = APEX_STOP_HALT;
+
+    /* Watched at retire time, several instructions can retire per cycle */
+    cpu->stop_pc = cond->stop_pc;
+    while (!cpu->halted)
+    {
+        if (cond->max_cycles && cpu->clock - start_cycles >= cond->max_cycles)
+        {
+            reason = APEX_STOP_CYCLES;
+            break;
+        }
+
+        cpu->stop_pc_retired = FALSE;
+        APEX_cpu_cycle(cpu);
+
+        /* The OOO backend can commit stop_pc together with HALT */
+        if (cpu->stop_pc_retired)
+        {
+            reason = APEX_STOP_PC;
+            break;
+        }
+        if (cpu->halted)
+        {
+            break;
+        }
+        if (cond->max_insns
+            && cpu->insn_completed - start_insns >= cond->max_insns)
+        {
+            reason = APEX_STOP_INSNS;
+            break;
+        }
+    }
+    cpu->stop_pc = -1;
+    if (reason == APEX_STOP_HALT && cpu->fault)
+    {
+        reason = APEX_STOP_FAULT;
+    }
+
+    return reason;
+}
+
+/* TRUE once HALT retired or the CPU faulted */
+int
+apex_halted(const APEX_CPU *cpu)
+{
+    return cpu->halted;
+}
+
+/*
+ * Returns the APEX_FAULT_* which stopped the CPU, APEX_FAULT_NONE if none
+ * did. pc and address may be NULL, they receive the PC of the faulting
+ * instruction (or the PC outside code memory) and the data address it
+ * accessed.
+ */
+int
+apex_fault(const APEX_CPU *cpu, int *pc, int *address)
+{
+    if (pc)
+    {
+        *pc = cpu->fault_pc;
+    }
+    if (address)
+    {
+        *address = cpu->fault_address;
+    }
+
+    return cpu->fault;
+}
+
+uint64_t
+apex_cycles(const APEX_CPU *cpu)
+{
+    return cpu->clock;
+}
+
+uint64_t
+apex_instructions(const APEX_CPU *cpu)
+{
+    return cpu->insn_completed;
+}
+
+double
+apex_ipc(const APEX_CPU *cpu)
+{
+    return cpu->clock ? (double)cpu->insn_completed / cpu->clock : 0.0;
+}
+
+/* PC of the next instruction to be fetched */
+int
+apex_pc(const APEX_CPU *cpu)
+{
+    return cpu->pc;
+}
+
+/* Architectural register value, 0 for an invalid register */
+int
+apex_reg(const APEX_CPU *cpu, int reg)
+{
+    if (reg < 0 || reg >= REG_FILE_SIZE)
+    {
+        return 0;
+    }
+
+    return cpu->regs[reg];
+}
+
+/* Data memory word, 0 for an invalid address */
+int
+apex_mem(const APEX_CPU *cpu, int address)
+{
+    if (address < 0 || address >= DATA_MEMORY_SIZE)
+    {
+        return 0;
+    }
+
+    return APEX_read_data(cpu, address);
+}
+
+void
+apex_flags(const APEX_CPU *cpu, int *zero, int *pos, int *neg)
+{
+    *zero = cpu->zero_flag;
+    *pos = cpu->pos_flag;
+    *neg = cpu->neg_flag;
+}
+
+const APEX_Stats *
+apex_stats(const APEX_CPU *cpu)
+{
+    return &cpu->stats;
+}
+
+const APEX_Config *
+apex_config(const APEX_CPU *cpu)
+{
+    return &cpu->config;
+}
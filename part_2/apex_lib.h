@@ -0,0 +1,73 @@
+/*
+ * apex_lib.h
+ * Embedding API of libapex
+ *
+ * A program is parsed once with apex_program_load() and can then be shared
+ * by any number of CPUs created with apex_create(). Every CPU keeps all of
+ * its state in its APEX_CPU, so CPUs can be simulated from different threads
+ * at the same time (a single CPU must not be used by two threads at once).
+ * Library CPUs never print and never wait for user input. A CPU whose
+ * program accesses memory outside code or data memory faults and stops,
+ * without affecting the other CPUs.
+ */
+#ifndef _APEX_LIB_H_
+#define _APEX_LIB_H_
+
+#include <stdint.h>
+
+#include "apex_cpu.h"
+
+/* Parsed input file, read-only once loaded */
+typedef struct APEX_Program
+{
+    APEX_Instruction *code_memory;
+    char **code_text;
+    int code_memory_size;
+} APEX_Program;
+
+/* Why apex_run_until() returned */
+typedef enum APEX_Stop_Reason
+{
+    APEX_STOP_HALT = 0,            /* HALT retired */
+    APEX_STOP_CYCLES,              /* max_cycles more cycles were simulated */
+    APEX_STOP_INSNS,               /* max_insns more instructions retired */
+    APEX_STOP_PC,                  /* The instruction at stop_pc retired,
+                                      apex_halted() tells if HALT did too */
+    APEX_STOP_FAULT                /* A load or store outside data memory, or
+                                      a jump outside code memory, see
+                                      apex_fault() */
+} APEX_Stop_Reason;
+
+/* Conditions of apex_run_until(), 0 or -1 disables a condition */
+typedef struct APEX_Stop_Condition
+{
+    uint64_t max_cycles;
+    uint64_t max_insns;
+    int stop_pc;
+} APEX_Stop_Condition;
+
+APEX_Program *apex_program_load(const char *filename);
+void apex_program_free(APEX_Program *program);
+
+int apex_config_check(const APEX_Config *config, char *error, size_t size);
+APEX_CPU *apex_create(const APEX_Program *program, const APEX_Config *config);
+int apex_reset(APEX_CPU *cpu);
+void apex_destroy(APEX_CPU *cpu);
+
+uint64_t apex_step(APEX_CPU *cpu, uint64_t n_cycles);
+APEX_Stop_Reason apex_run_until(APEX_CPU *cpu, const APEX_Stop_Condition *cond);
+
+/* Queries */
+int apex_halted(const APEX_CPU *cpu);
+int apex_fault(const APEX_CPU *cpu, int *pc, int *address);
+uint64_t apex_cycles(const APEX_CPU *cpu);
+uint64_t apex_instructions(const APEX_CPU *cpu);
+double apex_ipc(const APEX_CPU *cpu);
+int apex_pc(const APEX_CPU *cpu);
+int apex_reg(const APEX_CPU *cpu, int reg);
+int apex_mem(const APEX_CPU *cpu, int address);
+void apex_flags(const APEX_CPU *cpu, int *zero, int *pos, int *neg);
+const APEX_Stats *apex_stats(const APEX_CPU *cpu);
+const APEX_Config *apex_config(const APEX_CPU *cpu);
+
+#endif
@@ -63,13 +63,24 @@
 #define OPCODE_STOREP 0x18
 #define OPCODE_LOADP 0x19
 
-
-
-
-
-
-
-
+#define NUM_OPCODES 0x1a
+
+/* Operand class bits of a predecoded instruction */
+#define APEX_OPND_RD 0x1           /* Writes rd */
+#define APEX_OPND_RS1 0x2          /* Reads rs1 */
+#define APEX_OPND_RS2 0x4          /* Reads rs2 */
+#define APEX_OPND_IMM 0x8          /* Has a literal */
+#define APEX_OPND_SETS_FLAGS 0x10  /* Updates zero/pos/neg flags */
+#define APEX_OPND_USES_FLAGS 0x20  /* Conditional branch on the flags */
+#define APEX_OPND_LOAD 0x40        /* Reads data memory */
+#define APEX_OPND_STORE 0x80       /* Writes data memory */
+#define APEX_OPND_CTRL 0x100       /* Control transfer */
+#define APEX_OPND_POST_INC 0x200   /* Increments the address register by 4 */
+
+/* Forwarding status of a register (regs_status_pending) */
+#define PENDING_NONE 0    /* Register file holds the latest value */
+#define PENDING_FORWARD 1 /* Latest value is in regs_value_pending */
+#define PENDING_WAIT 2    /* Latest value is not produced yet */
 
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
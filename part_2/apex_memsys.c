@@ -0,0 +1,603 @@
+/*
+ * apex_memsys.c
+ * Contains the memory hierarchy behind fetch and the memory stage
+ *
+ * Fetch reads through the L1I and loads and stores through the L1D. The
+ * lines an L1 misses, writes back or writes through go to the unified L2 and
+ * from there to the DRAM. Every level is optional: without a cache its
+ * accesses go straight to the level below, and without the DRAM model the
+ * memory answers every access in config.mem_latency cycles. The latency of
+ * an access is computed when it starts, the DRAM keeping track of its banks
+ * and bus over time. The stride prefetcher learns from the loads and stores
+ * and prefetches into the L1D.
+ *
+ * With a store buffer the in-order pipeline retires a store into it instead
+ * of waiting for the L1D. The buffer writes its oldest line in the
+ * background, younger stores to a buffered address overwrite the entry and
+ * loads of one take the buffered value.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/*
+ * Empties the caches, the store buffer and the MSHRs and closes the DRAM
+ * banks for cpu->config. The caches are allocated for their geometry.
+ * Returns 0, or -1 if they are out of memory.
+ */
+int
+APEX_memsys_init(APEX_CPU *cpu)
+{
+    APEX_dram_init(&cpu->dram, &cpu->config.dram);
+    APEX_stride_init(&cpu->stride, &cpu->config.stride);
+    memset(&cpu->store_buffer, 0, sizeof(cpu->store_buffer));
+    memset(&cpu->mshrs, 0, sizeof(cpu->mshrs));
+    if (APEX_cache_init(&cpu->l1d, &cpu->config.l1d) != 0
+        || APEX_cache_init(&cpu->l1i, &cpu->config.l1i) != 0
+        || APEX_cache_init(&cpu->l2, &cpu->config.l2) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Frees the lines of the caches */
+void
+APEX_memsys_free(APEX_CPU *cpu)
+{
+    APEX_cache_free(&cpu->l1d);
+    APEX_cache_free(&cpu->l1i);
+    APEX_cache_free(&cpu->l2);
+}
+
+/* Writes the option of a memory system parameter out of range to error */
+static int
+bad_parameter(char *error, size_t size, const char *prefix, const char *name)
+{
+    snprintf(error, size, "--%s%s is out of range", prefix, name);
+    return -1;
+}
+
+/*
+ * Returns 0 if the memory system can be modelled, else -1 and names the
+ * first parameter which can not in error (of size bytes, may be NULL).
+ */
+int
+APEX_memsys_config_check(const APEX_Config *config, char *error, size_t size)
+{
+    const char *name;
+
+    if (config->mem_latency < 1)
+    {
+        return bad_parameter(error, size, "mem-", "latency");
+    }
+    if (config->store_buffer < 0 || config->store_buffer > APEX_STORE_BUFFER_MAX)
+    {
+        return bad_parameter(error, size, "store-", "buffer");
+    }
+    if (config->mshrs < 0 || config->mshrs > APEX_MAX_MSHRS)
+    {
+        return bad_parameter(error, size, "", "mshrs");
+    }
+    if ((name = APEX_cache_config_error(&config->l1d)))
+    {
+        return bad_parameter(error, size, "l1d-", name);
+    }
+    if ((name = APEX_cache_config_error(&config->l1i)))
+    {
+        return bad_parameter(error, size, "l1i-", name);
+    }
+    if ((name = APEX_cache_config_error(&config->l2)))
+    {
+        return bad_parameter(error, size, "l2-", name);
+    }
+    if ((name = APEX_dram_config_error(&config->dram)))
+    {
+        return bad_parameter(error, size, "dram-", name);
+    }
+    if ((name = APEX_stride_config_error(&config->stride)))
+    {
+        return bad_parameter(error, size, "stride-", name);
+    }
+
+    return 0;
+}
+
+/* Cycles of a line read or written in memory, the request arriving at now */
+static int
+memory_access(APEX_CPU *cpu, int address, int write, uint64_t now)
+{
+    if (!cpu->config.dram.banks)
+    {
+        return cpu->config.mem_latency;
+    }
+
+    return APEX_dram_access(&cpu->dram, address, write, now, &cpu->stats.dram);
+}
+
+/*
+ * Cycles of a line read or written below the L1s, the request arriving at
+ * now. An L2 miss reads the line from memory after writing back the victim.
+ */
+static int
+l2_access(APEX_CPU *cpu, int address, int write, uint64_t now)
+{
+    APEX_Cache_Outcome outcome;
+    int latency;
+
+    if (!cpu->config.l2.size)
+    {
+        return memory_access(cpu, address, write, now);
+    }
+
+    APEX_cache_access(&cpu->l2, address, write, &cpu->stats.l2, &outcome);
+    latency = cpu->config.l2.hit_latency;
+    if (outcome.victim >= 0)
+    {
+        latency += memory_access(cpu, outcome.victim, TRUE, now + latency);
+    }
+    if (outcome.fill)
+    {
+        latency += memory_access(cpu, address, FALSE, now + latency);
+    }
+    if (outcome.write_through)
+    {
+        latency += memory_access(cpu, address, TRUE, now + latency);
+    }
+
+    cpu->stats.l2.cycles += latency;
+    return latency;
+}
+
+/*
+ * Prefetches the lines the stride prefetcher predicted after the access to
+ * address, the requests leaving at cycle issue. The line arrives once the
+ * L2 or memory read it; the writeback of a dirty victim does not hold it up.
+ */
+static void
+stride_prefetch(APEX_CPU *cpu, int address, const int *addresses, int count,
+                uint64_t issue)
+{
+    int line_size = cpu->config.l1d.line_size;
+    int last_line = address & ~(line_size - 1);
+    APEX_Cache_Outcome outcome;
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        int line = addresses[i] & ~(line_size - 1);
+
+        /* Several predictions may fall in one line, or off the memory */
+        if (line == last_line || addresses[i] < 0
+            || addresses[i] >= DATA_MEMORY_SIZE)
+        {
+            continue;
+        }
+        last_line = line;
+
+        if (APEX_cache_contains(&cpu->l1d, line))
+        {
+            cpu->stats.stride.redundant++;
+            continue;
+        }
+        APEX_cache_prefetch(&cpu->l1d, line,
+                            issue - 1 + l2_access(cpu, line, FALSE, issue),
+                            &cpu->stats.l1d, &outcome);
+        if (outcome.victim >= 0)
+        {
+            l2_access(cpu, outcome.victim, TRUE, issue);
+        }
+    }
+}
+
+/*
+ * Cycles the load or store at pc spends in memory. Without an L1D every
+ * access goes to the L2 or memory. With one, a hit takes the hit latency,
+ * or waits for a prefetched line to arrive, and the writeback of a dirty
+ * victim, the line fill and a write-through are added one after the other.
+ * The access then trains the stride prefetcher.
+ */
+int
+APEX_data_access(APEX_CPU *cpu, int pc, int address, int write)
+{
+    APEX_Cache_Outcome outcome;
+    int addresses[APEX_STRIDE_MAX_DEGREE];
+    int latency;
+    int count;
+
+    if (!cpu->config.l1d.size)
+    {
+        return l2_access(cpu, address, write, cpu->clock);
+    }
+
+    APEX_cache_access(&cpu->l1d, address, write, &cpu->stats.l1d, &outcome);
+    latency = cpu->config.l1d.hit_latency;
+    if (outcome.victim >= 0)
+    {
+        latency += l2_access(cpu, outcome.victim, TRUE, cpu->clock + latency);
+    }
+    if (outcome.fill)
+    {
+        latency += l2_access(cpu, address, FALSE, cpu->clock + latency);
+    }
+    else if (outcome.ready + 1 > cpu->clock + latency)
+    {
+        latency = (int)(outcome.ready + 1 - cpu->clock);
+    }
+    if (outcome.write_through)
+    {
+        latency += l2_access(cpu, address, TRUE, cpu->clock + latency);
+    }
+    cpu->stats.l1d.cycles += latency;
+
+    if (cpu->config.stride.entries)
+    {
+        count = APEX_stride_train(&cpu->stride, pc, address, addresses,
+                                  &cpu->stats.stride);
+        stride_prefetch(cpu, address, addresses, count,
+                        cpu->clock + cpu->config.l1d.hit_latency);
+    }
+
+    return latency;
+}
+
+/*
+ * Looks up the L1I for the instruction at pc. Returns the cycles fetch needs
+ * for it: the hit latency, plus the L2 or memory access on a miss, or until
+ * a prefetched line arrives. With config.l1i_prefetch a miss, or the first
+ * use of a prefetched line, also prefetches the next line.
+ */
+static int
+insn_access(APEX_CPU *cpu, int pc)
+{
+    const APEX_Config *config = &cpu->config;
+    APEX_Cache_Outcome outcome;
+    int latency = config->l1i.hit_latency;
+
+    APEX_cache_access(&cpu->l1i, pc, FALSE, &cpu->stats.l1i, &outcome);
+    if (outcome.fill)
+    {
+        latency += l2_access(cpu, pc, FALSE, cpu->clock + latency);
+    }
+    else if (outcome.ready + 1 > cpu->clock + latency)
+    {
+        latency = (int)(outcome.ready + 1 - cpu->clock);
+    }
+    cpu->stats.l1i.cycles += latency;
+
+    if (config->l1i_prefetch && (outcome.fill || outcome.prefetch_hit))
+    {
+        int next_line = (pc & ~(config->l1i.line_size - 1)) + config->l1i.line_size;
+        uint64_t issue = cpu->clock + config->l1i.hit_latency;
+        APEX_Cache_Outcome prefetch;
+
+        /* Only lines the L1I does not hold go to the next level */
+        if (!APEX_cache_contains(&cpu->l1i, next_line))
+        {
+            APEX_cache_prefetch(&cpu->l1i, next_line,
+                                issue - 1 + l2_access(cpu, next_line, FALSE, issue),
+                                &cpu->stats.l1i, &prefetch);
+        }
+    }
+
+    return latency;
+}
+
+/*
+ * Returns TRUE if the instruction at cpu->pc can be fetched this cycle.
+ * Without an L1I it always can. Otherwise its lookup starts the first time
+ * fetch asks for it, or again after a redirect, and fetch bubbles until the
+ * line is there.
+ */
+int
+APEX_fetch_ready(APEX_CPU *cpu)
+{
+    if (!cpu->config.l1i.size)
+    {
+        return TRUE;
+    }
+
+    if (!cpu->icache_pending || cpu->icache_pc != cpu->pc)
+    {
+        cpu->icache_pending = TRUE;
+        cpu->icache_pc = cpu->pc;
+        cpu->icache_ready = cpu->clock + insn_access(cpu, cpu->pc) - 1;
+    }
+    if (cpu->clock < cpu->icache_ready)
+    {
+        return FALSE;
+    }
+
+    cpu->icache_pending = FALSE;
+    return TRUE;
+}
+
+/* Index of the buffered store to address, or -1 */
+int
+APEX_store_buffer_find(const APEX_CPU *cpu, int address)
+{
+    int i;
+
+    for (i = 0; i < cpu->store_buffer.count; ++i)
+    {
+        if (cpu->store_buffer.entries[i].address == address)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Buffers the store of value to address by the instruction at pc. A store
+ * to a buffered address replaces its value. Returns FALSE if the buffer is
+ * full.
+ */
+int
+APEX_store_buffer_insert(APEX_CPU *cpu, int pc, int address, int value)
+{
+    APEX_Store_Buffer *buffer = &cpu->store_buffer;
+    int index = APEX_store_buffer_find(cpu, address);
+
+    if (index >= 0)
+    {
+        buffer->entries[index].value = value;
+        cpu->stats.sb_stores++;
+        cpu->stats.sb_coalesced++;
+        return TRUE;
+    }
+    if (buffer->count == cpu->config.store_buffer)
+    {
+        return FALSE;
+    }
+
+    buffer->entries[buffer->count].pc = pc;
+    buffer->entries[buffer->count].address = address;
+    buffer->entries[buffer->count].value = value;
+    buffer->count++;
+    cpu->stats.sb_stores++;
+    return TRUE;
+}
+
+/*
+ * Writes the entries of the line of the oldest one to data memory and
+ * removes them from the buffer
+ */
+static void
+store_buffer_retire_line(APEX_CPU *cpu)
+{
+    APEX_Store_Buffer *buffer = &cpu->store_buffer;
+    int mask = ~(cpu->config.l1d.line_size - 1);
+    int line = buffer->entries[0].address & mask;
+    int kept = 0;
+    int i;
+
+    for (i = 0; i < buffer->count; ++i)
+    {
+        const APEX_Store_Buffer_Entry *entry = &buffer->entries[i];
+
+        if ((entry->address & mask) == line)
+        {
+            cpu->data_memory[entry->address] = entry->value;
+        }
+        else
+        {
+            buffer->entries[kept++] = *entry;
+        }
+    }
+    buffer->count = kept;
+}
+
+/*
+ * Advances the store buffer by a cycle: finishes the write of the oldest
+ * line once its L1D access is over and starts the next one, which writes
+ * all buffered stores of that line at once.
+ */
+void
+APEX_store_buffer_cycle(APEX_CPU *cpu)
+{
+    APEX_Store_Buffer *buffer = &cpu->store_buffer;
+
+    cpu->stats.sb_occupancy[buffer->count]++;
+    if (buffer->draining && cpu->clock >= buffer->drain_done)
+    {
+        store_buffer_retire_line(cpu);
+        buffer->draining = FALSE;
+    }
+    if (!buffer->draining && buffer->count)
+    {
+        const APEX_Store_Buffer_Entry *oldest = &buffer->entries[0];
+
+        buffer->drain_done = cpu->clock
+                             + APEX_data_access(cpu, oldest->pc, oldest->address,
+                                                TRUE);
+        buffer->draining = TRUE;
+        cpu->stats.sb_drains++;
+    }
+}
+
+/* Writes every buffered store to data memory at once, without timing */
+void
+APEX_store_buffer_flush(APEX_CPU *cpu)
+{
+    while (cpu->store_buffer.count)
+    {
+        store_buffer_retire_line(cpu);
+    }
+    cpu->store_buffer.draining = FALSE;
+}
+
+/* Architectural value of address, which may still be in the store buffer */
+int
+APEX_read_data(const APEX_CPU *cpu, int address)
+{
+    int index = APEX_store_buffer_find(cpu, address);
+
+    return index >= 0 ? cpu->store_buffer.entries[index].value
+                      : cpu->data_memory[address];
+}
+
+/* Brings a line an L1 filled or wrote back into the L2, without counting */
+static void
+warm_l2(APEX_CPU *cpu, const APEX_Cache_Outcome *outcome, int address)
+{
+    APEX_Cache_Outcome l2_outcome;
+
+    if (!cpu->config.l2.size)
+    {
+        return;
+    }
+    if (outcome->victim >= 0)
+    {
+        APEX_cache_access(&cpu->l2, outcome->victim, TRUE, NULL, &l2_outcome);
+    }
+    if (outcome->fill)
+    {
+        APEX_cache_access(&cpu->l2, address, FALSE, NULL, &l2_outcome);
+    }
+    if (outcome->write_through)
+    {
+        APEX_cache_access(&cpu->l2, address, TRUE, NULL, &l2_outcome);
+    }
+}
+
+/*
+ * Brings the line of the load or store at pc executed by the functional
+ * simulator into the L1D and the L2, and trains the stride prefetcher,
+ * without counting the access
+ */
+void
+APEX_warm_data(APEX_CPU *cpu, int pc, int address, int write)
+{
+    APEX_Cache_Outcome outcome;
+    int addresses[APEX_STRIDE_MAX_DEGREE];
+
+    if (!cpu->config.l1d.size)
+    {
+        if (cpu->config.l2.size)
+        {
+            APEX_cache_access(&cpu->l2, address, write, NULL, &outcome);
+        }
+        return;
+    }
+
+    APEX_cache_access(&cpu->l1d, address, write, NULL, &outcome);
+    warm_l2(cpu, &outcome, address);
+    if (cpu->config.stride.entries)
+    {
+        APEX_stride_train(&cpu->stride, pc, address, addresses, NULL);
+    }
+}
+
+/* Brings the line of an instruction executed functionally into the L1I */
+void
+APEX_warm_insn(APEX_CPU *cpu, int pc)
+{
+    APEX_Cache_Outcome outcome;
+
+    if (!cpu->config.l1i.size)
+    {
+        return;
+    }
+
+    APEX_cache_access(&cpu->l1i, pc, FALSE, NULL, &outcome);
+    warm_l2(cpu, &outcome, pc);
+}
+
+/* Prints the store buffer counters and its occupancy histogram */
+static void
+print_store_buffer_stats(const APEX_CPU *cpu)
+{
+    const APEX_Stats *stats = &cpu->stats;
+    uint64_t cycles = 0;
+    int i;
+
+    for (i = 0; i <= cpu->config.store_buffer; ++i)
+    {
+        cycles += stats->sb_occupancy[i];
+    }
+
+    printf("APEX_CPU: Store buffer %d entries: stores = %llu, coalesced = %llu,"
+           " load forwards = %llu, full stall cycles = %llu, line writes = %llu\n",
+           cpu->config.store_buffer, (unsigned long long)stats->sb_stores,
+           (unsigned long long)stats->sb_coalesced,
+           (unsigned long long)stats->sb_forwards,
+           (unsigned long long)stats->sb_full_stalls,
+           (unsigned long long)stats->sb_drains);
+    if (!cycles)
+    {
+        return;
+    }
+    printf("          occupancy");
+    for (i = 0; i <= cpu->config.store_buffer; ++i)
+    {
+        if (stats->sb_occupancy[i])
+        {
+            printf(" %d: %.1f%%", i, 100.0 * stats->sb_occupancy[i] / cycles);
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * Prints the MSHR counters. The memory-level parallelism is the average
+ * number of lines outstanding while at least one is.
+ */
+static void
+print_mshr_stats(const APEX_CPU *cpu)
+{
+    const APEX_Stats *stats = &cpu->stats;
+
+    printf("APEX_CPU: MSHRs %d: loads = %llu, merged = %llu, full stall cycles = %llu,"
+           " use stall cycles = %llu\n", cpu->config.mshrs,
+           (unsigned long long)stats->mshr_loads,
+           (unsigned long long)stats->mshr_merged,
+           (unsigned long long)stats->mshr_full_stalls,
+           (unsigned long long)stats->mshr_use_stalls);
+    if (stats->mshr_busy_cycles)
+    {
+        printf("          cycles with a miss outstanding = %llu (%.1f%%), MLP %.2f\n",
+               (unsigned long long)stats->mshr_busy_cycles,
+               cpu->clock ? 100.0 * stats->mshr_busy_cycles / cpu->clock : 0.0,
+               (double)stats->mshr_outstanding / stats->mshr_busy_cycles);
+    }
+}
+
+/* Prints the counters of every level which is enabled */
+void
+APEX_memsys_print_stats(const APEX_CPU *cpu)
+{
+    if (cpu->config.store_buffer && cpu->config.backend == APEX_BACKEND_INORDER)
+    {
+        print_store_buffer_stats(cpu);
+    }
+    if (cpu->config.mshrs && cpu->config.backend == APEX_BACKEND_INORDER)
+    {
+        print_mshr_stats(cpu);
+    }
+    if (cpu->config.l1i.size)
+    {
+        APEX_cache_print_stats("L1I", &cpu->config.l1i, &cpu->stats.l1i);
+    }
+    if (cpu->config.l1d.size)
+    {
+        APEX_cache_print_stats("L1D", &cpu->config.l1d, &cpu->stats.l1d);
+        if (cpu->config.stride.entries)
+        {
+            APEX_stride_print_stats(&cpu->config.stride, &cpu->stats.stride,
+                                    &cpu->stats.l1d);
+        }
+    }
+    if (cpu->config.l2.size)
+    {
+        APEX_cache_print_stats("L2", &cpu->config.l2, &cpu->stats.l2);
+    }
+    if (cpu->config.dram.banks)
+    {
+        APEX_dram_print_stats(&cpu->config.dram, &cpu->stats.dram);
+    }
+}
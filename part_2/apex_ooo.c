@@ -0,0 +1,1049 @@
+/*
+ * apex_ooo.c
+ * Contains the out-of-order backend
+ *
+ * With APEX_Config.backend set to APEX_BACKEND_OOO, APEX_cpu_cycle runs this
+ * model instead of the five stage pipeline. Every cycle, in reverse order:
+ *
+ *  - commit retires up to ooo_width completed instructions from the head of
+ *    the ROB into the architectural registers, flags and, for stores, data
+ *    memory, and trains the BTB and direction predictor
+ *  - complete writes the results of the function units to the physical
+ *    registers and wakes up the issue queue. A control transfer which went
+ *    to the wrong PC squashes the younger instructions, undoing their
+ *    renames by walking the ROB back from the tail
+ *  - issue selects the oldest ready instructions for the free function
+ *    units, which are pipelined. A load only issues once the addresses of
+ *    all older stores are known, and takes the data of the youngest older
+ *    store to the same address
+ *  - dispatch renames up to ooo_width instructions onto the physical
+ *    registers (the zero/pos/neg flags are one more renamed register) and
+ *    enters them into the ROB, issue queue and load-store queue
+ *  - fetch reads up to ooo_width instructions into the fetch queue, predicted
+ *    with the same BTB, direction predictor and RAS as the pipeline
+ *
+ * outputDisplay shows the instruction each step handled last: fetch,
+ * dispatch, the oldest issued, the oldest issued to a memory port, and
+ * commit.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_isa.h"
+#include "apex_macros.h"
+
+/* Bits of the renamed flags register */
+#define FLAG_ZERO 0x1
+#define FLAG_POS 0x2
+#define FLAG_NEG 0x4
+
+#define FETCH_QUEUE_SIZE (2 * APEX_OOO_MAX_WIDTH)
+
+/* What the steps of one cycle did, for the stage counters */
+typedef struct Ooo_Activity
+{
+    int fetched;
+    int fetch_blocked;             /* Fetch queue full */
+    int dispatched;
+    int dispatch_stalled;
+    int issued;
+    int memory_issued;
+    int loads_blocked;
+    int committed;
+} Ooo_Activity;
+
+static int
+encode_flags(int zero_flag, int pos_flag, int neg_flag)
+{
+    return (zero_flag ? FLAG_ZERO : 0) | (pos_flag ? FLAG_POS : 0)
+           | (neg_flag ? FLAG_NEG : 0);
+}
+
+/* Index of the n-th entry of a circular queue */
+static int
+ring(int head, int n, int size)
+{
+    return (head + n) % size;
+}
+
+static int
+alloc_phys(APEX_CPU *cpu)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int phys = ooo->free_list[ooo->free_head];
+
+    ooo->free_head = ring(ooo->free_head, 1, cpu->config.phys_regs);
+    ooo->free_count--;
+    ooo->phys_ready[phys] = FALSE;
+    return phys;
+}
+
+static void
+release_phys(APEX_CPU *cpu, int phys)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+
+    ooo->free_list[ring(ooo->free_head, ooo->free_count, cpu->config.phys_regs)]
+        = phys;
+    ooo->free_count++;
+}
+
+/*
+ * Empties the backend and maps every architectural register, and the
+ * flags, to the physical register of the same number holding its value
+ */
+static void
+rebuild_state(APEX_CPU *cpu)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int i;
+
+    memset(ooo, 0, sizeof(*ooo));
+    for (i = 0; i < REG_FILE_SIZE; ++i)
+    {
+        ooo->rat[i] = i;
+        ooo->phys_value[i] = cpu->regs[i];
+        ooo->phys_ready[i] = TRUE;
+    }
+    ooo->rat[APEX_OOO_FLAGS_REG] = APEX_OOO_FLAGS_REG;
+    ooo->phys_value[APEX_OOO_FLAGS_REG]
+        = encode_flags(cpu->zero_flag, cpu->pos_flag, cpu->neg_flag);
+    ooo->phys_ready[APEX_OOO_FLAGS_REG] = TRUE;
+
+    for (i = APEX_OOO_ARCH_REGS; i < cpu->config.phys_regs; ++i)
+    {
+        ooo->free_list[ooo->free_count++] = i;
+    }
+    ooo->commit_ras = cpu->ras;
+    ooo->active = TRUE;
+}
+
+/*
+ * Architectural registers an instruction writes, in the order issue fills
+ * dest_value: rd, the post-increment register, the flags
+ */
+static int
+dest_registers(const CPU_Stage *insn, int operand_class, int dests[3])
+{
+    int num_dests = 0;
+
+    if (operand_class & APEX_OPND_RD)
+    {
+        dests[num_dests++] = insn->rd;
+    }
+    if (operand_class & APEX_OPND_POST_INC)
+    {
+        dests[num_dests++] = APEX_post_inc_reg(insn->opcode, insn->rs1, insn->rs2);
+    }
+    if (operand_class & APEX_OPND_SETS_FLAGS)
+    {
+        dests[num_dests++] = APEX_OOO_FLAGS_REG;
+    }
+
+    return num_dests;
+}
+
+static int
+unit_of(int opcode, int operand_class)
+{
+    if (operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+    {
+        return APEX_OOO_FU_MEM;
+    }
+    if (opcode == OPCODE_MUL || opcode == OPCODE_DIV)
+    {
+        return APEX_OOO_FU_MUL;
+    }
+
+    return APEX_OOO_FU_ALU;
+}
+
+static int
+operand_class_of(const APEX_CPU *cpu, const CPU_Stage *insn)
+{
+    return cpu->code_memory[insn->code_index].operand_class;
+}
+
+/* Sets the result of physical register phys and wakes up its readers */
+static void
+wake_up(APEX_CPU *cpu, int phys, int value)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int i;
+    int j;
+
+    ooo->phys_value[phys] = value;
+    ooo->phys_ready[phys] = TRUE;
+    for (i = 0; i < ooo->iq_count; ++i)
+    {
+        for (j = 0; j < 3; ++j)
+        {
+            if (ooo->iq[i].src_phys[j] == phys)
+            {
+                ooo->iq[i].src_ready[j] = TRUE;
+            }
+        }
+    }
+}
+
+/* Repeats the push or pop fetch did for insn on ras */
+static void
+replay_ras(APEX_Ras *ras, const CPU_Stage *insn)
+{
+    int return_pc;
+
+    if (insn->opcode == OPCODE_JALR)
+    {
+        APEX_ras_push(ras, insn->pc + 4);
+    }
+    else if (APEX_is_return(insn->opcode, insn->imm))
+    {
+        APEX_ras_pop(ras, &return_pc);
+    }
+}
+
+/* Trains the BTB and direction predictor with a committed control transfer */
+static void
+train_predictors(APEX_CPU *cpu, const APEX_Rob_Entry *entry)
+{
+    const CPU_Stage *insn = &entry->insn;
+
+    cpu->stats.branches++;
+    if (entry->mispredicted)
+    {
+        cpu->stats.mispredictions++;
+        if (insn->ras_predicted)
+        {
+            cpu->stats.ras_mispredictions++;
+        }
+    }
+
+    if (APEX_is_btb_branch(insn->opcode))
+    {
+        BTB_entry *btb = update_btb_outcome(cpu, insn->pc, entry->taken,
+                                            insn->pc + insn->imm);
+
+        APEX_bpred_update(&cpu->bpred, insn->pc, insn->opcode,
+                          insn->bpred_history, btb, entry->taken);
+        cpu->stats.direction_predictions++;
+        if (insn->bpred_taken != entry->taken)
+        {
+            cpu->stats.direction_mispredictions++;
+        }
+    }
+}
+
+/*
+ * Retires completed instructions in program order. Returns TRUE when HALT
+ * retires or a load or store outside data memory faults.
+ */
+static int
+commit(APEX_CPU *cpu, Ooo_Activity *activity)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+
+    while (activity->committed < cpu->config.ooo_width && ooo->rob_count)
+    {
+        APEX_Rob_Entry *entry = &ooo->rob[ooo->rob_head];
+        const CPU_Stage *insn = &entry->insn;
+        int i;
+
+        if (!entry->completed)
+        {
+            break;
+        }
+        if (insn->fault)
+        {
+            APEX_cpu_fault(cpu, APEX_FAULT_DATA, insn->pc, insn->memory_address);
+            return TRUE;
+        }
+
+        if (entry->lsq_index >= 0)
+        {
+            const APEX_Lsq_Entry *lsq = &ooo->lsq[entry->lsq_index];
+
+            /* The store is done for the ROB, its L1D access does not stall */
+            if (lsq->is_store)
+            {
+                cpu->data_memory[lsq->address] = lsq->value;
+                APEX_data_access(cpu, insn->pc, lsq->address, TRUE);
+            }
+            ooo->lsq_head = ring(ooo->lsq_head, 1, cpu->config.lsq_size);
+            ooo->lsq_count--;
+        }
+
+        /* In order, so the LOADP increment wins when rd and rs1 are the same */
+        for (i = 0; i < entry->num_dests; ++i)
+        {
+            int value = entry->dest_value[i];
+
+            if (entry->dest_arch[i] == APEX_OOO_FLAGS_REG)
+            {
+                cpu->zero_flag = (value & FLAG_ZERO) != 0;
+                cpu->pos_flag = (value & FLAG_POS) != 0;
+                cpu->neg_flag = (value & FLAG_NEG) != 0;
+            }
+            else
+            {
+                cpu->regs[entry->dest_arch[i]] = value;
+            }
+            release_phys(cpu, entry->prev_phys[i]);
+        }
+
+        if (operand_class_of(cpu, insn) & APEX_OPND_CTRL)
+        {
+            train_predictors(cpu, entry);
+            if (cpu->config.ras_depth)
+            {
+                replay_ras(&ooo->commit_ras, insn);
+            }
+        }
+
+        cpu->outputDisplay[4] = *insn;
+        cpu->last_retired_pc = insn->pc;
+        if (insn->pc == cpu->stop_pc)
+        {
+            cpu->stop_pc_retired = TRUE;
+        }
+        cpu->insn_completed++;
+        activity->committed++;
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_WRITEBACK, insn->pc))
+        {
+            APEX_print_stage("Commit", insn);
+        }
+
+        ooo->rob_head = ring(ooo->rob_head, 1, cpu->config.rob_size);
+        ooo->rob_count--;
+        if (insn->opcode == OPCODE_HALT)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Squashes every instruction younger than the n-th entry of the ROB. The
+ * renames are undone youngest first, which leaves the alias table as it was
+ * after the n-th entry was renamed.
+ */
+static void
+squash_younger(APEX_CPU *cpu, int n)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+
+    while (ooo->rob_count > n + 1)
+    {
+        int index = ring(ooo->rob_head, ooo->rob_count - 1, cpu->config.rob_size);
+        APEX_Rob_Entry *entry = &ooo->rob[index];
+        int i;
+
+        for (i = entry->num_dests - 1; i >= 0; --i)
+        {
+            ooo->rat[entry->dest_arch[i]] = entry->prev_phys[i];
+            release_phys(cpu, entry->dest_phys[i]);
+        }
+        if (entry->lsq_index >= 0)
+        {
+            ooo->lsq_count--;
+        }
+        for (i = 0; i < ooo->iq_count; ++i)
+        {
+            if (ooo->iq[i].rob_index == index)
+            {
+                ooo->iq[i--] = ooo->iq[--ooo->iq_count];
+            }
+        }
+
+        ooo->rob_count--;
+        cpu->stats.ooo_squashed++;
+    }
+
+    ooo->fq_count = 0;
+    ooo->fetch_stopped = FALSE;
+    ooo->recovering = TRUE;
+}
+
+/*
+ * Sends fetch to the resolved PC of the mispredicted control transfer in the
+ * n-th entry of the ROB. The squashed instructions may have pushed and
+ * popped the RAS many times, overwriting entries below the top, so the RAS
+ * is rebuilt from the committed one with the operations of the entries up
+ * to the n-th.
+ */
+static void
+redirect(APEX_CPU *cpu, int n)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    const APEX_Rob_Entry *entry = &ooo->rob[ring(ooo->rob_head, n,
+                                                 cpu->config.rob_size)];
+    const CPU_Stage *insn = &entry->insn;
+    int i;
+
+    if (APEX_TRACING(cpu, APEX_TRACE_VERBOSE, APEX_TRACE_EXECUTE, insn->pc))
+    {
+        printf("Squash         : pc(%d) redirects fetch to %d\n", insn->pc,
+               entry->next_pc);
+    }
+
+    /* Fetch starts at the new PC in the next cycle, as in the pipeline */
+    cpu->pc = entry->next_pc;
+    cpu->fetch_from_next_cycle = TRUE;
+
+    APEX_bpred_repair(&cpu->bpred, insn->bpred_history,
+                      APEX_is_btb_branch(insn->opcode), entry->taken);
+    if (cpu->config.ras_depth)
+    {
+        APEX_Ras ras = ooo->commit_ras;
+
+        for (i = 0; i <= n; ++i)
+        {
+            replay_ras(&ras, &ooo->rob[ring(ooo->rob_head, i,
+                                            cpu->config.rob_size)].insn);
+        }
+        cpu->stats.ras_repairs += APEX_ras_restore(&cpu->ras, &ras);
+    }
+}
+
+/* Writes back the results of the instructions whose latency is over */
+static void
+complete(APEX_CPU *cpu)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int n;
+
+    for (n = 0; n < ooo->rob_count; ++n)
+    {
+        APEX_Rob_Entry *entry = &ooo->rob[ring(ooo->rob_head, n, cpu->config.rob_size)];
+        int i;
+
+        if (!entry->issued || entry->completed || entry->done_cycle > cpu->clock)
+        {
+            continue;
+        }
+
+        for (i = 0; i < entry->num_dests; ++i)
+        {
+            wake_up(cpu, entry->dest_phys[i], entry->dest_value[i]);
+        }
+        entry->completed = TRUE;
+
+        if ((operand_class_of(cpu, &entry->insn) & APEX_OPND_CTRL)
+            && entry->next_pc != entry->insn.predicted_pc)
+        {
+            entry->mispredicted = TRUE;
+            squash_younger(cpu, n);
+            redirect(cpu, n);
+        }
+    }
+}
+
+/*
+ * Checks the older stores of the load in lsq_index. Returns FALSE while
+ * the address of one of them is unknown, else sets *forward to the youngest
+ * older store to address, or -1.
+ */
+static int
+older_stores_known(const APEX_CPU *cpu, int lsq_index, int address, int *forward)
+{
+    const APEX_Ooo *ooo = &cpu->ooo;
+    int index = ooo->lsq_head;
+
+    *forward = -1;
+    for (; index != lsq_index; index = ring(index, 1, cpu->config.lsq_size))
+    {
+        const APEX_Lsq_Entry *lsq = &ooo->lsq[index];
+
+        if (!lsq->is_store)
+        {
+            continue;
+        }
+        if (!lsq->address_known)
+        {
+            return FALSE;
+        }
+        if (lsq->address == address)
+        {
+            *forward = index;
+        }
+    }
+
+    return TRUE;
+}
+
+static int
+source_value(const APEX_CPU *cpu, const APEX_Iq_Entry *iq, int i)
+{
+    return (iq->src_phys[i] >= 0) ? cpu->ooo.phys_value[iq->src_phys[i]] : 0;
+}
+
+/* Returns TRUE if the load of an issue queue entry may access memory now */
+static int
+load_can_issue(const APEX_CPU *cpu, const APEX_Iq_Entry *iq)
+{
+    const APEX_Rob_Entry *entry = &cpu->ooo.rob[iq->rob_index];
+    int forward;
+
+    if (!(operand_class_of(cpu, &entry->insn) & APEX_OPND_LOAD))
+    {
+        return TRUE;
+    }
+
+    return older_stores_known(cpu, entry->lsq_index,
+                              source_value(cpu, iq, 0) + entry->insn.imm, &forward);
+}
+
+/*
+ * Executes the instruction of an issue queue entry, whose sources are all
+ * ready. The results are written back once its latency is over.
+ */
+static void
+execute(APEX_CPU *cpu, const APEX_Iq_Entry *iq)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    APEX_Rob_Entry *entry = &ooo->rob[iq->rob_index];
+    CPU_Stage *insn = &entry->insn;
+    int flags = source_value(cpu, iq, 2);
+    int latency = 1;
+    int forward;
+    int result;
+
+    insn->rs1_value = source_value(cpu, iq, 0);
+    insn->rs2_value = source_value(cpu, iq, 1);
+
+    switch (insn->opcode)
+    {
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+            latency = (insn->opcode == OPCODE_MUL)
+                      ? cpu->config.mul_latency
+                      : APEX_div_latency(&cpu->config, insn->rs1_value,
+                                         insn->rs2_value);
+            /* fall through */
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        {
+            result = APEX_alu_result(insn->opcode, insn->rs1_value, insn->rs2_value,
+                                     insn->imm);
+            insn->result_buffer = result;
+            entry->dest_value[0] = result;
+            entry->dest_value[1] = encode_flags(result == 0, result > 0, result < 0);
+            break;
+        }
+
+        case OPCODE_MOVC:
+        {
+            insn->result_buffer = insn->imm;
+            entry->dest_value[0] = insn->imm;
+            break;
+        }
+
+        case OPCODE_CMP:
+        case OPCODE_CML:
+        {
+            int rhs = (insn->opcode == OPCODE_CMP) ? insn->rs2_value : insn->imm;
+
+            entry->dest_value[0] = encode_flags(insn->rs1_value == rhs,
+                                                insn->rs1_value > rhs,
+                                                insn->rs1_value < rhs);
+            break;
+        }
+
+        case OPCODE_LOAD:
+        case OPCODE_LOADP:
+        {
+            insn->memory_address = APEX_add(insn->rs1_value, insn->imm);
+            insn->fault = !APEX_data_address_valid(insn->memory_address);
+            older_stores_known(cpu, entry->lsq_index, insn->memory_address, &forward);
+            if (forward >= 0)
+            {
+                result = ooo->lsq[forward].value;
+                cpu->stats.ooo_load_forwards++;
+            }
+            else
+            {
+                /* A load on a mispredicted path may compute any address, it
+                 * only faults if it commits */
+                if (!insn->fault)
+                {
+                    result = cpu->data_memory[insn->memory_address];
+                    latency = APEX_data_access(cpu, insn->pc, insn->memory_address,
+                                               FALSE);
+                }
+                else
+                {
+                    result = 0;
+                    latency = cpu->config.mem_latency;
+                }
+            }
+            insn->result_buffer = result;
+            entry->dest_value[0] = result;
+            entry->dest_value[1] = APEX_add(insn->rs1_value, 4);
+            break;
+        }
+
+        case OPCODE_STORE:
+        case OPCODE_STOREP:
+        {
+            APEX_Lsq_Entry *lsq = &ooo->lsq[entry->lsq_index];
+
+            insn->memory_address = APEX_add(insn->rs2_value, insn->imm);
+            insn->fault = !APEX_data_address_valid(insn->memory_address);
+            lsq->address = insn->memory_address;
+            lsq->value = insn->rs1_value;
+            lsq->address_known = TRUE;
+            entry->dest_value[0] = APEX_add(insn->rs2_value, 4);
+            break;
+        }
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_BN:
+        case OPCODE_BNN:
+        {
+            entry->taken = APEX_flags_taken(insn->opcode, flags & FLAG_ZERO,
+                                            flags & FLAG_POS, flags & FLAG_NEG);
+            entry->next_pc = entry->taken ? insn->pc + insn->imm : insn->pc + 4;
+            break;
+        }
+
+        case OPCODE_JUMP:
+        case OPCODE_JALR:
+        {
+            insn->result_buffer = insn->pc + 4;
+            entry->dest_value[0] = insn->result_buffer;
+            entry->taken = TRUE;
+            entry->next_pc = APEX_add(insn->rs1_value, insn->imm);
+            break;
+        }
+    }
+
+    entry->issued = TRUE;
+    entry->done_cycle = cpu->clock + latency;
+}
+
+/*
+ * Claims a MUL unit which is neither dividing nor taken in this cycle, and
+ * keeps it busy until a DIV issued to it is done
+ */
+static void
+claim_mul_unit(APEX_CPU *cpu, const APEX_Iq_Entry *iq, int *claimed)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    const APEX_Rob_Entry *entry = &ooo->rob[iq->rob_index];
+    int unit;
+
+    for (unit = 0; unit < cpu->config.fu_count[APEX_OOO_FU_MUL]; ++unit)
+    {
+        if (!(*claimed & (1 << unit)) && ooo->div_done[unit] <= cpu->clock)
+        {
+            break;
+        }
+    }
+
+    *claimed |= 1 << unit;
+    if (entry->insn.opcode == OPCODE_DIV)
+    {
+        ooo->div_done[unit] = entry->done_cycle;
+    }
+}
+
+/* Selects the oldest ready instructions for the free function units */
+static void
+issue(APEX_CPU *cpu, Ooo_Activity *activity)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int free_units[APEX_OOO_NUM_FU_KINDS];
+    int mul_claimed = 0;
+    int first_pass = TRUE;
+    int i;
+
+    memcpy(free_units, cpu->config.fu_count, sizeof(free_units));
+    for (i = 0; i < cpu->config.fu_count[APEX_OOO_FU_MUL]; ++i)
+    {
+        if (ooo->div_done[i] > cpu->clock)
+        {
+            free_units[APEX_OOO_FU_MUL]--;
+        }
+    }
+    while (TRUE)
+    {
+        int best = -1;
+        APEX_Iq_Entry selected;
+
+        for (i = 0; i < ooo->iq_count; ++i)
+        {
+            const APEX_Iq_Entry *iq = &ooo->iq[i];
+
+            if (!free_units[iq->fu] || !iq->src_ready[0] || !iq->src_ready[1]
+                || !iq->src_ready[2] || (best >= 0 && ooo->iq[best].seq < iq->seq))
+            {
+                continue;
+            }
+            if (!load_can_issue(cpu, iq))
+            {
+                activity->loads_blocked += first_pass;
+                continue;
+            }
+            best = i;
+        }
+        first_pass = FALSE;
+
+        if (best < 0)
+        {
+            break;
+        }
+
+        selected = ooo->iq[best];
+        ooo->iq[best] = ooo->iq[--ooo->iq_count];
+        free_units[selected.fu]--;
+        execute(cpu, &selected);
+        if (selected.fu == APEX_OOO_FU_MUL)
+        {
+            claim_mul_unit(cpu, &selected, &mul_claimed);
+        }
+
+        cpu->stats.ooo_issued[selected.fu]++;
+        if (!activity->issued++)
+        {
+            cpu->outputDisplay[2] = ooo->rob[selected.rob_index].insn;
+        }
+        if (selected.fu == APEX_OOO_FU_MEM && !activity->memory_issued++)
+        {
+            cpu->outputDisplay[3] = ooo->rob[selected.rob_index].insn;
+        }
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_EXECUTE,
+                         ooo->rob[selected.rob_index].insn.pc))
+        {
+            APEX_print_stage("Issue", &ooo->rob[selected.rob_index].insn);
+        }
+    }
+    cpu->stats.ooo_load_blocked += activity->loads_blocked;
+}
+
+/* Renames insn and enters it into the ROB, issue queue and LSQ */
+static void
+rename_insn(APEX_CPU *cpu, const CPU_Stage *insn, int operand_class,
+            const int dests[3], int num_dests)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    int rob_index = ring(ooo->rob_head, ooo->rob_count, cpu->config.rob_size);
+    APEX_Rob_Entry *entry = &ooo->rob[rob_index];
+    int sources[3] = { -1, -1, -1 };
+    int i;
+
+    /* Sources are looked up before the instruction's own destinations */
+    if (operand_class & APEX_OPND_RS1)
+    {
+        sources[0] = ooo->rat[insn->rs1];
+    }
+    if (operand_class & APEX_OPND_RS2)
+    {
+        sources[1] = ooo->rat[insn->rs2];
+    }
+    if (operand_class & APEX_OPND_USES_FLAGS)
+    {
+        sources[2] = ooo->rat[APEX_OOO_FLAGS_REG];
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->insn = *insn;
+    entry->num_dests = num_dests;
+    for (i = 0; i < num_dests; ++i)
+    {
+        entry->dest_arch[i] = dests[i];
+        entry->prev_phys[i] = ooo->rat[dests[i]];
+        entry->dest_phys[i] = alloc_phys(cpu);
+        ooo->rat[dests[i]] = entry->dest_phys[i];
+    }
+
+    entry->lsq_index = -1;
+    if (operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+    {
+        APEX_Lsq_Entry *lsq;
+
+        entry->lsq_index = ring(ooo->lsq_head, ooo->lsq_count, cpu->config.lsq_size);
+        lsq = &ooo->lsq[entry->lsq_index];
+        memset(lsq, 0, sizeof(*lsq));
+        lsq->rob_index = rob_index;
+        lsq->is_store = (operand_class & APEX_OPND_STORE) != 0;
+        ooo->lsq_count++;
+    }
+
+    // first time this branch is seen - add it to the BTB
+    if (APEX_is_btb_branch(insn->opcode) && search_entry_in_btb(cpu, insn->pc) == -1)
+    {
+        add_btb_branch(cpu, insn->pc, insn->opcode);
+    }
+
+    /* NOP and HALT have nothing to execute */
+    if (insn->opcode == OPCODE_NOP || insn->opcode == OPCODE_HALT)
+    {
+        entry->completed = TRUE;
+    }
+    else
+    {
+        APEX_Iq_Entry *iq = &ooo->iq[ooo->iq_count++];
+
+        iq->rob_index = rob_index;
+        iq->fu = unit_of(insn->opcode, operand_class);
+        iq->seq = insn->seq;
+        for (i = 0; i < 3; ++i)
+        {
+            iq->src_phys[i] = sources[i];
+            iq->src_ready[i] = sources[i] < 0 || ooo->phys_ready[sources[i]];
+        }
+    }
+
+    ooo->rob_count++;
+}
+
+/* Renames up to ooo_width instructions from the fetch queue */
+static void
+dispatch(APEX_CPU *cpu, Ooo_Activity *activity)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+    const APEX_Config *config = &cpu->config;
+
+    while (activity->dispatched < config->ooo_width && ooo->fq_count)
+    {
+        const CPU_Stage *insn = &ooo->fetch_queue[ooo->fq_head];
+        int operand_class = operand_class_of(cpu, insn);
+        int dests[3];
+        int num_dests = dest_registers(insn, operand_class, dests);
+        int stall = -1;
+
+        if (ooo->rob_count == config->rob_size)
+        {
+            stall = APEX_OOO_STALL_ROB;
+        }
+        else if (insn->opcode != OPCODE_NOP && insn->opcode != OPCODE_HALT
+                 && ooo->iq_count == config->iq_size)
+        {
+            stall = APEX_OOO_STALL_IQ;
+        }
+        else if ((operand_class & (APEX_OPND_LOAD | APEX_OPND_STORE))
+                 && ooo->lsq_count == config->lsq_size)
+        {
+            stall = APEX_OOO_STALL_LSQ;
+        }
+        else if (ooo->free_count < num_dests)
+        {
+            stall = APEX_OOO_STALL_REGS;
+        }
+
+        if (stall >= 0)
+        {
+            cpu->stats.ooo_dispatch_stalls[stall]++;
+            cpu->stats.decode_stalls++;
+            activity->dispatch_stalled = TRUE;
+            return;
+        }
+
+        rename_insn(cpu, insn, operand_class, dests, num_dests);
+        cpu->outputDisplay[1] = *insn;
+        activity->dispatched++;
+        ooo->recovering = FALSE;
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_DECODE, insn->pc))
+        {
+            APEX_print_stage("Dispatch", insn);
+        }
+
+        ooo->fq_head = ring(ooo->fq_head, 1, FETCH_QUEUE_SIZE);
+        ooo->fq_count--;
+    }
+}
+
+/* Fetches up to ooo_width instructions, up to the first predicted taken */
+static void
+fetch(APEX_CPU *cpu, Ooo_Activity *activity)
+{
+    APEX_Ooo *ooo = &cpu->ooo;
+
+    if (cpu->fetch_from_next_cycle)
+    {
+        cpu->fetch_from_next_cycle = FALSE;
+        return;
+    }
+
+    while (activity->fetched < cpu->config.ooo_width && !ooo->fetch_stopped)
+    {
+        int code_index = APEX_code_index(cpu->pc);
+        const APEX_Instruction *current_ins;
+        CPU_Stage *stage;
+
+        if (ooo->fq_count == 2 * cpu->config.ooo_width)
+        {
+            activity->fetch_blocked = TRUE;
+            break;
+        }
+
+        /* Nothing to fetch outside code memory, wait for a redirect. Without
+         * an instruction in flight none can come. */
+        if (code_index < 0 || code_index >= cpu->code_memory_size)
+        {
+            if (!ooo->rob_count && !ooo->fq_count)
+            {
+                APEX_cpu_fault(cpu, APEX_FAULT_CODE, cpu->pc, 0);
+            }
+            break;
+        }
+        if (!APEX_fetch_ready(cpu))
+        {
+            break;
+        }
+
+        stage = &ooo->fetch_queue[ring(ooo->fq_head, ooo->fq_count, FETCH_QUEUE_SIZE)];
+        current_ins = &cpu->code_memory[code_index];
+        memset(stage, 0, sizeof(*stage));
+        stage->pc = cpu->pc;
+        stage->seq = cpu->next_seq++;
+        stage->code_index = code_index;
+        stage->opcode = current_ins->opcode;
+        stage->rd = current_ins->rd;
+        stage->rs1 = current_ins->rs1;
+        stage->rs2 = current_ins->rs2;
+        stage->imm = current_ins->imm;
+        stage->has_insn = TRUE;
+        APEX_predict_next_pc(cpu, stage);
+        ooo->fq_count++;
+
+        cpu->outputDisplay[0] = *stage;
+        activity->fetched++;
+        if (APEX_TRACING(cpu, APEX_TRACE_STAGE, APEX_TRACE_FETCH, stage->pc))
+        {
+            APEX_print_stage("Fetch", stage);
+        }
+
+        if (stage->opcode == OPCODE_HALT)
+        {
+            ooo->fetch_stopped = TRUE;
+        }
+        else if (stage->predicted_pc != stage->pc + 4)
+        {
+            break;
+        }
+    }
+}
+
+/*
+ * Counts the cycle in the stage counters and, by what commit did, in one
+ * top-down category: retiring, bad speculation while the ROB refills after a
+ * squash, frontend while it is empty otherwise, backend while its head has
+ * not completed.
+ */
+static void
+account_cycle(APEX_CPU *cpu, const Ooo_Activity *activity)
+{
+    const APEX_Ooo *ooo = &cpu->ooo;
+    APEX_Stats *stats = &cpu->stats;
+    int slot;
+
+    stats->ooo_rob_occupancy += ooo->rob_count;
+    stats->ooo_iq_occupancy += ooo->iq_count;
+
+    stats->stage_busy[0] += activity->fetched > 0;
+    stats->stage_busy[1] += activity->dispatched > 0;
+    stats->stage_busy[2] += activity->issued > 0;
+    stats->stage_busy[3] += activity->memory_issued > 0;
+    stats->stage_busy[4] += activity->committed > 0;
+    stats->stage_stalled[0] += activity->fetch_blocked;
+    stats->stage_stalled[1] += activity->dispatch_stalled;
+    stats->stage_stalled[2] += ooo->iq_count && !activity->issued;
+    stats->stage_stalled[3] += activity->loads_blocked > 0;
+    stats->stage_stalled[4] += ooo->rob_count && !activity->committed;
+
+    if (activity->committed)
+    {
+        slot = APEX_SLOT_RETIRING;
+    }
+    else if (ooo->rob_count)
+    {
+        slot = APEX_SLOT_BACKEND;
+    }
+    else if (ooo->recovering)
+    {
+        slot = APEX_SLOT_BAD_SPECULATION;
+    }
+    else
+    {
+        slot = APEX_SLOT_FRONTEND;
+    }
+    stats->slots[slot]++;
+}
+
+/*
+ * Simulates one cycle of the out-of-order backend.
+ * Returns TRUE when HALT commits or the CPU faults in this cycle.
+ */
+int
+APEX_ooo_cycle(APEX_CPU *cpu)
+{
+    Ooo_Activity activity;
+    int halted;
+
+    if (!cpu->ooo.active)
+    {
+        rebuild_state(cpu);
+    }
+
+    memset(&activity, 0, sizeof(activity));
+    memset(cpu->outputDisplay, 0, sizeof(cpu->outputDisplay));
+    halted = commit(cpu, &activity);
+    if (!halted)
+    {
+        complete(cpu);
+        issue(cpu, &activity);
+        dispatch(cpu, &activity);
+        fetch(cpu, &activity);
+    }
+    account_cycle(cpu, &activity);
+    return halted || cpu->fault;
+}
+
+/* Prints the counters of the out-of-order backend */
+void
+APEX_ooo_print_stats(const APEX_CPU *cpu)
+{
+    static const char *const unit_names[APEX_OOO_NUM_FU_KINDS] = {
+        "ALU", "MUL", "MEM"
+    };
+    const APEX_Config *config = &cpu->config;
+    const APEX_Stats *stats = &cpu->stats;
+    double cycles = cpu->clock ? cpu->clock : 1;
+    int i;
+
+    printf("APEX_CPU: Out-of-order backend, width %d, ROB %d, IQ %d, LSQ %d,"
+           " %d physical registers\n", config->ooo_width, config->rob_size,
+           config->iq_size, config->lsq_size, config->phys_regs);
+    printf("APEX_CPU: Average ROB occupancy = %.2f, IQ occupancy = %.2f\n",
+           stats->ooo_rob_occupancy / cycles, stats->ooo_iq_occupancy / cycles);
+    printf("APEX_CPU: Dispatch stalls: ROB full = %llu, IQ full = %llu,"
+           " LSQ full = %llu, no free register = %llu\n",
+           (unsigned long long)stats->ooo_dispatch_stalls[APEX_OOO_STALL_ROB],
+           (unsigned long long)stats->ooo_dispatch_stalls[APEX_OOO_STALL_IQ],
+           (unsigned long long)stats->ooo_dispatch_stalls[APEX_OOO_STALL_LSQ],
+           (unsigned long long)stats->ooo_dispatch_stalls[APEX_OOO_STALL_REGS]);
+    printf("APEX_CPU: Issued:");
+    for (i = 0; i < APEX_OOO_NUM_FU_KINDS; ++i)
+    {
+        printf("%s %s x%d = %llu (%.1f%% busy)", i ? "," : "", unit_names[i],
+               config->fu_count[i], (unsigned long long)stats->ooo_issued[i],
+               100.0 * stats->ooo_issued[i] / (cycles * config->fu_count[i]));
+    }
+    printf("\n");
+    printf("APEX_CPU: Squashed = %llu, load forwards = %llu,"
+           " loads held for store addresses = %llu\n",
+           (unsigned long long)stats->ooo_squashed,
+           (unsigned long long)stats->ooo_load_forwards,
+           (unsigned long long)stats->ooo_load_blocked);
+}
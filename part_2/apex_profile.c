@@ -0,0 +1,370 @@
+/*
+ * apex_profile.c
+ * Contains the per-instruction hotspot profile
+ *
+ * Every cycle is charged to code memory indices: each stage which shows an
+ * instruction adds a cycle to it, an instruction which issues or retires
+ * counts once, and a cycle lost in the decode issue slot is blamed on the
+ * instruction which caused it (the producer a source waits for, the older
+ * MOVC to the same register, the instruction still busy in execute, or the
+ * mispredicted branch for the bubbles of its redirect). The top-down
+ * category of a cycle is taken from the APEX_Stats.slots counter that moved.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_profile.h"
+
+static const char *const profile_stage_names[5] = { "F", "D", "X", "M", "W" };
+
+typedef struct Profile_Entry
+{
+    uint64_t executed;             /* Retired */
+    uint64_t stage_cycles[5];
+    uint64_t stalls_caused;        /* Issue slots lost because of it */
+    uint64_t mispredictions;
+} Profile_Entry;
+
+struct APEX_Profile
+{
+    FILE *fp;
+    Profile_Entry *entries;        /* One per code memory index */
+    int num_entries;
+    int last_mispredicted;         /* Code index of the last redirect or -1 */
+    APEX_Stats last_stats;
+};
+
+/*
+ * Creates filename for the profile of the program of cpu. Returns NULL on
+ * error.
+ */
+APEX_Profile *
+APEX_profile_open(const char *filename, const APEX_CPU *cpu)
+{
+    APEX_Profile *profile = calloc(1, sizeof(*profile));
+
+    if (!profile)
+    {
+        return NULL;
+    }
+
+    profile->num_entries = cpu->code_memory_size;
+    profile->entries = calloc(cpu->code_memory_size, sizeof(Profile_Entry));
+    profile->fp = fopen(filename, "w");
+    if (!profile->entries || !profile->fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to create profile %s\n", filename);
+        if (profile->fp)
+        {
+            fclose(profile->fp);
+        }
+        free(profile->entries);
+        free(profile);
+        return NULL;
+    }
+
+    profile->last_mispredicted = -1;
+    profile->last_stats = cpu->stats;
+    return profile;
+}
+
+static Profile_Entry *
+entry_of(APEX_Profile *profile, int code_index)
+{
+    if (code_index < 0 || code_index >= profile->num_entries)
+    {
+        return NULL;
+    }
+
+    return &profile->entries[code_index];
+}
+
+/* Code index of the in-flight instruction seq, or -1 */
+static int
+find_in_flight(const APEX_CPU *cpu, uint64_t seq)
+{
+    const CPU_Stage *latches[3] = { &cpu->execute, &cpu->memory, &cpu->writeback };
+    int i;
+
+    for (i = 0; i < 3; ++i)
+    {
+        if (latches[i]->has_insn && latches[i]->seq == seq)
+        {
+            return latches[i]->code_index;
+        }
+    }
+
+    return -1;
+}
+
+/* Code index of the older MOVC which still has to write rd, or -1 */
+static int
+find_movc_writer(const APEX_CPU *cpu, int rd)
+{
+    const CPU_Stage *latches[3] = { &cpu->execute, &cpu->memory, &cpu->writeback };
+    int i;
+
+    for (i = 0; i < 3; ++i)
+    {
+        if (latches[i]->has_insn && latches[i]->opcode == OPCODE_MOVC
+            && latches[i]->rd == rd)
+        {
+            return latches[i]->code_index;
+        }
+    }
+
+    return -1;
+}
+
+/* Code index of the producer the stalled decode instruction waits for */
+static int
+find_producer(const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    int operand_class = cpu->code_memory[stage->code_index].operand_class;
+    int sources[2];
+    int num_sources = 0;
+    int i;
+
+    if (operand_class & APEX_OPND_RS1)
+    {
+        sources[num_sources++] = stage->rs1;
+    }
+    if (operand_class & APEX_OPND_RS2)
+    {
+        sources[num_sources++] = stage->rs2;
+    }
+
+    for (i = 0; i < num_sources; ++i)
+    {
+        int status = cpu->regs_status_pending[sources[i]];
+
+        if (status == PENDING_WAIT
+            || (status == PENDING_FORWARD && !cpu->config.forwarding))
+        {
+            return find_in_flight(cpu, cpu->regs_pending_seq[sources[i]]);
+        }
+    }
+
+    return -1;
+}
+
+/* The top-down category the last cycle was counted in, or -1 */
+static int
+last_slot_kind(APEX_Profile *profile, const APEX_CPU *cpu)
+{
+    int kind = -1;
+    int i;
+
+    for (i = 0; i < APEX_NUM_SLOT_KINDS; ++i)
+    {
+        if (cpu->stats.slots[i] != profile->last_stats.slots[i])
+        {
+            kind = i;
+        }
+    }
+
+    return kind;
+}
+
+/*
+ * Charges the cycle that was just simulated. On the cycle HALT retires only
+ * writeback was evaluated.
+ */
+void
+APEX_profile_cycle(APEX_Profile *profile, const APEX_CPU *cpu, int halted)
+{
+    const CPU_Stage *decode = &cpu->outputDisplay[1];
+    Profile_Entry *entry;
+    int blamed = -1;
+    int i;
+
+    for (i = halted ? 4 : 0; i < 5; ++i)
+    {
+        const CPU_Stage *stage = &cpu->outputDisplay[i];
+
+        if (stage->has_insn && (entry = entry_of(profile, stage->code_index)))
+        {
+            entry->stage_cycles[i]++;
+            if (i == 4)
+            {
+                entry->executed++;
+            }
+        }
+    }
+
+    /* Execute shows one instruction, the others wait in function units */
+    for (i = 0; i < cpu->fu_window_count && !halted; ++i)
+    {
+        const CPU_Stage *stage = &cpu->fu_window[i];
+
+        if (stage->seq != cpu->outputDisplay[2].seq
+            && (entry = entry_of(profile, stage->code_index)))
+        {
+            entry->stage_cycles[2]++;
+        }
+    }
+
+    /* The redirecting branch was in execute this cycle */
+    if (cpu->stats.mispredictions != profile->last_stats.mispredictions)
+    {
+        profile->last_mispredicted = cpu->outputDisplay[2].code_index;
+        if ((entry = entry_of(profile, profile->last_mispredicted)))
+        {
+            entry->mispredictions++;
+        }
+    }
+
+    switch (last_slot_kind(profile, cpu))
+    {
+        case APEX_SLOT_OPERAND_WAIT:
+        {
+            blamed = find_producer(cpu, decode);
+            break;
+        }
+
+        case APEX_SLOT_MOVC_INTERLOCK:
+        {
+            blamed = find_movc_writer(cpu, decode->rd);
+            break;
+        }
+
+        case APEX_SLOT_BACKEND:
+        {
+            blamed = cpu->execute.has_insn ? cpu->execute.code_index : -1;
+            break;
+        }
+
+        case APEX_SLOT_BAD_SPECULATION:
+        {
+            blamed = profile->last_mispredicted;
+            break;
+        }
+    }
+
+    if ((entry = entry_of(profile, blamed)))
+    {
+        entry->stalls_caused++;
+    }
+
+    profile->last_stats = cpu->stats;
+}
+
+/* Cycles an instruction is responsible for: its issue slots and its stalls */
+static uint64_t
+entry_cost(const Profile_Entry *entry)
+{
+    return entry->executed + entry->stalls_caused;
+}
+
+typedef struct Profile_Rank
+{
+    int code_index;
+    uint64_t cost;
+} Profile_Rank;
+
+static int
+compare_cost(const void *a, const void *b)
+{
+    const Profile_Rank *rank_a = a;
+    const Profile_Rank *rank_b = b;
+
+    if (rank_a->cost != rank_b->cost)
+    {
+        return rank_a->cost < rank_b->cost ? 1 : -1;
+    }
+
+    return rank_a->code_index - rank_b->code_index;
+}
+
+static void
+write_entry(FILE *fp, const APEX_CPU *cpu, const Profile_Entry *entry,
+            int code_index, uint64_t cycles)
+{
+    int i;
+
+    fprintf(fp, "%5d %10llu %6.2f%%", 4000 + 4 * code_index,
+            (unsigned long long)entry->executed,
+            cycles ? 100.0 * entry_cost(entry) / cycles : 0.0);
+    for (i = 0; i < 5; ++i)
+    {
+        fprintf(fp, " %10llu", (unsigned long long)entry->stage_cycles[i]);
+    }
+    fprintf(fp, " %10llu %8llu  %s\n", (unsigned long long)entry->stalls_caused,
+            (unsigned long long)entry->mispredictions,
+            cpu->code_text ? cpu->code_text[code_index]
+                           : get_opcode_str(cpu->code_memory[code_index].opcode));
+}
+
+static void
+write_header(FILE *fp)
+{
+    int i;
+
+    fprintf(fp, "%5s %10s %7s", "pc", "executed", "cost");
+    for (i = 0; i < 5; ++i)
+    {
+        fprintf(fp, " %10s", profile_stage_names[i]);
+    }
+    fprintf(fp, " %10s %8s  %s\n", "stalls", "mispred", "instruction");
+}
+
+/*
+ * Writes the instructions sorted by cost followed by the program listing,
+ * and closes the profile. Returns 0 on success, -1 if writing failed.
+ */
+int
+APEX_profile_close(APEX_Profile *profile, const APEX_CPU *cpu)
+{
+    uint64_t cycles = 0;
+    Profile_Rank *ranks = malloc(sizeof(Profile_Rank) * (profile->num_entries + 1));
+    int status;
+    int i;
+
+    for (i = 0; i < APEX_NUM_SLOT_KINDS; ++i)
+    {
+        cycles += cpu->stats.slots[i];
+    }
+
+    fprintf(profile->fp, "# APEX profile, %llu cycles, %llu instructions retired\n",
+            (unsigned long long)cycles, (unsigned long long)cpu->insn_completed);
+    fprintf(profile->fp, "# cost: issue slots plus stall cycles caused, in %% of"
+                         " the cycles; F..W: cycles in each stage\n");
+
+    if (ranks)
+    {
+        for (i = 0; i < profile->num_entries; ++i)
+        {
+            ranks[i].code_index = i;
+            ranks[i].cost = entry_cost(&profile->entries[i]);
+        }
+        qsort(ranks, profile->num_entries, sizeof(Profile_Rank), compare_cost);
+
+        fprintf(profile->fp, "\n# Hotspots\n");
+        write_header(profile->fp);
+        for (i = 0; i < profile->num_entries && ranks[i].cost; ++i)
+        {
+            write_entry(profile->fp, cpu, &profile->entries[ranks[i].code_index],
+                        ranks[i].code_index, cycles);
+        }
+        free(ranks);
+    }
+
+    fprintf(profile->fp, "\n# Listing\n");
+    write_header(profile->fp);
+    for (i = 0; i < profile->num_entries; ++i)
+    {
+        write_entry(profile->fp, cpu, &profile->entries[i], i, cycles);
+    }
+
+    status = (fclose(profile->fp) != 0) ? -1 : 0;
+    if (status)
+    {
+        fprintf(stderr, "APEX_Error: Unable to write the profile\n");
+    }
+
+    free(profile->entries);
+    free(profile);
+    return status;
+}
@@ -0,0 +1,16 @@
+/*
+ * apex_profile.h
+ * Contains the per-instruction hotspot profile of the pipeline
+ */
+#ifndef _APEX_PROFILE_H_
+#define _APEX_PROFILE_H_
+
+#include "apex_cpu.h"
+
+typedef struct APEX_Profile APEX_Profile;
+
+APEX_Profile *APEX_profile_open(const char *filename, const APEX_CPU *cpu);
+void APEX_profile_cycle(APEX_Profile *profile, const APEX_CPU *cpu, int halted);
+int APEX_profile_close(APEX_Profile *profile, const APEX_CPU *cpu);
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * apex_ras.c
+ * Contains the return address stack
+ */
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_ras.h"
+
+/* Empties the stack and sets its depth, 0..APEX_RAS_MAX_DEPTH */
+void
+APEX_ras_init(APEX_Ras *ras, int depth)
+{
+    memset(ras, 0, sizeof(*ras));
+    ras->depth = depth;
+    ras->top = depth ? depth - 1 : 0;
+}
+
+/*
+ * Pushes the return address of a call. Returns TRUE if the stack was full
+ * and the oldest entry was overwritten.
+ */
+int
+APEX_ras_push(APEX_Ras *ras, int return_pc)
+{
+    int overflow = (ras->count == ras->depth);
+
+    ras->top = (ras->top + 1) % ras->depth;
+    ras->entries[ras->top] = return_pc;
+    if (!overflow)
+    {
+        ras->count++;
+    }
+
+    return overflow;
+}
+
+/*
+ * Pops the predicted address of a return. Returns FALSE if the stack is
+ * empty.
+ */
+int
+APEX_ras_pop(APEX_Ras *ras, int *return_pc)
+{
+    if (ras->count == 0)
+    {
+        return FALSE;
+    }
+
+    *return_pc = ras->entries[ras->top];
+    ras->top = (ras->top + ras->depth - 1) % ras->depth;
+    ras->count--;
+    return TRUE;
+}
+
+void
+APEX_ras_save(const APEX_Ras *ras, APEX_Ras_Snapshot *snapshot)
+{
+    snapshot->top = ras->top;
+    snapshot->count = ras->count;
+    snapshot->top_entry = ras->depth ? ras->entries[ras->top] : 0;
+}
+
+/*
+ * Returns the stack to the snapshot of the instruction which redirected
+ * fetch in the five stage pipeline. There only decode and fetch hold younger
+ * instructions, and of their operations only a pop followed by a push
+ * overwrites a live entry, the top one, so restoring the top entry is enough
+ * (a push to a full stack loses the oldest entry for good). Returns TRUE if
+ * the squashed instructions had pushed or popped, i.e. the stack differed
+ * from the snapshot.
+ */
+int
+APEX_ras_repair(APEX_Ras *ras, const APEX_Ras_Snapshot *snapshot)
+{
+    int changed;
+
+    if (!ras->depth)
+    {
+        return FALSE;
+    }
+
+    changed = ras->top != snapshot->top || ras->count != snapshot->count
+              || ras->entries[snapshot->top] != snapshot->top_entry;
+    ras->top = snapshot->top;
+    ras->count = snapshot->count;
+    ras->entries[ras->top] = snapshot->top_entry;
+    return changed;
+}
+
+/*
+ * Replaces the stack with a complete copy, for a backend whose squashed
+ * instructions can have pushed and popped any number of times. Returns TRUE
+ * if the top, the count or a live entry differed.
+ */
+int
+APEX_ras_restore(APEX_Ras *ras, const APEX_Ras *saved)
+{
+    int changed = ras->top != saved->top || ras->count != saved->count;
+    int i;
+
+    for (i = 0; i < saved->count && !changed; ++i)
+    {
+        int index = (saved->top + saved->depth - i) % saved->depth;
+
+        changed = ras->entries[index] != saved->entries[index];
+    }
+
+    *ras = *saved;
+    return changed;
+}
@@ -0,0 +1,42 @@
+/*
+ * apex_ras.h
+ * Contains the return address stack
+ *
+ * Fetch pushes PC + 4 for every JALR and predicts the return idiom
+ * JUMP Rx,#0 with the popped address. The stack is circular: a push to a
+ * full stack overwrites the oldest entry, a pop from an empty stack leaves
+ * the JUMP to be resolved in execute. In the five stage pipeline every
+ * fetched instruction records the top of the stack after its own push or
+ * pop, so a redirect can undo the operations of the squashed younger
+ * instructions. The out-of-order backend rebuilds the whole stack instead.
+ */
+#ifndef _APEX_RAS_H_
+#define _APEX_RAS_H_
+
+#define APEX_RAS_MAX_DEPTH 64
+
+/* Stack state, a plain value so CPUs and checkpoints can copy it */
+typedef struct APEX_Ras
+{
+    int depth;                     /* Entries used, 0 disables the RAS */
+    int top;                       /* Index of the top entry */
+    int count;                     /* Valid entries, at most depth */
+    int entries[APEX_RAS_MAX_DEPTH];
+} APEX_Ras;
+
+/* Top of the stack after an instruction was fetched */
+typedef struct APEX_Ras_Snapshot
+{
+    int top;
+    int count;
+    int top_entry;
+} APEX_Ras_Snapshot;
+
+void APEX_ras_init(APEX_Ras *ras, int depth);
+int APEX_ras_push(APEX_Ras *ras, int return_pc);
+int APEX_ras_pop(APEX_Ras *ras, int *return_pc);
+void APEX_ras_save(const APEX_Ras *ras, APEX_Ras_Snapshot *snapshot);
+int APEX_ras_repair(APEX_Ras *ras, const APEX_Ras_Snapshot *snapshot);
+int APEX_ras_restore(APEX_Ras *ras, const APEX_Ras *saved);
+
+#endif
@@ -0,0 +1,740 @@
+/*
+ * apex_simpoint.c
+ * Contains SimPoint-style sampled simulation of the APEX pipeline
+ *
+ * Pass 1 runs the program on the functional simulator and collects a basic
+ * block vector (BBV) for every interval of a fixed number of instructions.
+ * The BBVs are randomly projected to a few dimensions and clustered with
+ * k-means; the number of clusters is chosen with the Bayesian Information
+ * Criterion. Pass 2 replays the program functionally, warming the branch
+ * predictors, the RAS and the caches, and runs only the sampled intervals on
+ * the pipeline. Every cluster is represented by the interval closest to its
+ * centroid and, if it has more than one member, by one more randomly chosen
+ * interval so that the CPI variance of the cluster can be estimated.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Dimensions of the projected BBVs */
+#define SIMPOINT_DIMS 15
+
+/* k-means restarts per k and iteration limit per restart */
+#define SIMPOINT_RESTARTS 5
+#define SIMPOINT_MAX_ITERATIONS 100
+
+/* Chosen k is the smallest one that reaches this fraction of the BIC range */
+#define SIMPOINT_BIC_THRESHOLD 0.9
+
+#define SIMPOINT_SEED 0x5eed5eedu
+
+typedef struct SimPoint_Interval
+{
+    double bbv[SIMPOINT_DIMS];     /* Projected and normalized BBV */
+    uint64_t num_insns;            /* Only the last interval can be shorter */
+    int cluster;
+} SimPoint_Interval;
+
+typedef struct SimPoint_Profile
+{
+    const double *projection;      /* code_memory_size x SIMPOINT_DIMS */
+    double bbv[SIMPOINT_DIMS];     /* Projected BBV of the current interval */
+} SimPoint_Profile;
+
+typedef struct SimPoint_Sample
+{
+    int interval;
+    int cluster;
+    double cpi;
+} SimPoint_Sample;
+
+/* xorshift32, keeps the clustering deterministic */
+static uint32_t
+next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double
+random_unit(uint32_t *state)
+{
+    return next_random(state) / 4294967296.0;
+}
+
+/*
+ * APEX_Functional_Hooks.basic_block callback. Blocks are identified by their
+ * first instruction and weighted by their length, so the BBV can be projected
+ * on the fly instead of being stored with one entry per block.
+ */
+static void
+profile_basic_block(void *ctx, int start_index, int num_insns)
+{
+    SimPoint_Profile *profile = ctx;
+    const double *row = &profile->projection[start_index * SIMPOINT_DIMS];
+    int d;
+
+    for (d = 0; d < SIMPOINT_DIMS; ++d)
+    {
+        profile->bbv[d] += row[d] * num_insns;
+    }
+}
+
+/* Pass 1, returns the number of intervals or -1 on error */
+static int
+collect_intervals(const APEX_CPU *pristine, uint64_t interval_size,
+                  SimPoint_Interval **out)
+{
+    APEX_CPU *cpu;
+    APEX_Functional_Hooks hooks;
+    SimPoint_Profile profile;
+    SimPoint_Interval *intervals = NULL;
+    double *projection;
+    uint32_t seed = SIMPOINT_SEED;
+    int capacity = 0;
+    int count = 0;
+    int halted = FALSE;
+    int i;
+
+    cpu = calloc(1, sizeof(*cpu));
+    projection = malloc(sizeof(double) * SIMPOINT_DIMS
+                        * (pristine->code_memory_size + 1));
+    if (!cpu || !projection || APEX_cpu_copy(cpu, pristine) != 0)
+    {
+        APEX_cpu_free_copy(cpu);
+        free(projection);
+        return -1;
+    }
+    for (i = 0; i < SIMPOINT_DIMS * pristine->code_memory_size; ++i)
+    {
+        projection[i] = 2.0 * random_unit(&seed) - 1.0;
+    }
+
+    memset(&profile, 0, sizeof(profile));
+    profile.projection = projection;
+    hooks.warm = FALSE;
+    hooks.basic_block = profile_basic_block;
+    hooks.ctx = &profile;
+
+    while (!halted)
+    {
+        uint64_t executed = 0;
+        int d;
+
+        memset(profile.bbv, 0, sizeof(profile.bbv));
+        halted = APEX_functional_run(cpu, interval_size, &hooks, &executed);
+        if (executed == 0)
+        {
+            break;
+        }
+
+        if (count == capacity)
+        {
+            SimPoint_Interval *grown;
+
+            capacity = capacity ? 2 * capacity : 64;
+            grown = realloc(intervals, sizeof(*intervals) * capacity);
+            if (!grown)
+            {
+                free(intervals);
+                free(projection);
+                APEX_cpu_free_copy(cpu);
+                return -1;
+            }
+            intervals = grown;
+        }
+
+        /* Normalize so that short intervals compare with full ones */
+        for (d = 0; d < SIMPOINT_DIMS; ++d)
+        {
+            intervals[count].bbv[d] = profile.bbv[d] / executed;
+        }
+        intervals[count].num_insns = executed;
+        intervals[count].cluster = 0;
+        count++;
+    }
+
+    /* The profile ends at the fault, like at HALT */
+    APEX_cpu_print_fault(cpu);
+    free(projection);
+    APEX_cpu_free_copy(cpu);
+    *out = intervals;
+    return count;
+}
+
+static double
+distance2(const double *a, const double *b)
+{
+    double sum = 0;
+    int d;
+
+    for (d = 0; d < SIMPOINT_DIMS; ++d)
+    {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+
+    return sum;
+}
+
+static int
+nearest_centroid(const double *point, const double *centroids, int k,
+                 double *dist)
+{
+    int best = 0;
+    double best_dist = distance2(point, centroids);
+    int c;
+
+    for (c = 1; c < k; ++c)
+    {
+        double cur = distance2(point, &centroids[c * SIMPOINT_DIMS]);
+
+        if (cur < best_dist)
+        {
+            best_dist = cur;
+            best = c;
+        }
+    }
+
+    if (dist)
+    {
+        *dist = best_dist;
+    }
+    return best;
+}
+
+/*
+ * One k-means run with k-means++ seeding. Writes the assignment to
+ * assignment[] and returns the sum of squared distances, or -1 if out of
+ * memory.
+ */
+static double
+kmeans(const SimPoint_Interval *intervals, int n, int k, uint32_t *seed,
+       double *centroids, int *assignment)
+{
+    double *dist = malloc(sizeof(double) * n);
+    int *members = malloc(sizeof(int) * k);
+    double sse = 0;
+    int iteration;
+    int i;
+    int c;
+
+    if (!dist || !members)
+    {
+        free(dist);
+        free(members);
+        return -1;
+    }
+
+    /* k-means++: next centroid drawn with probability proportional to D^2 */
+    memcpy(centroids, intervals[next_random(seed) % n].bbv,
+           sizeof(intervals[0].bbv));
+    for (c = 1; c < k; ++c)
+    {
+        double total = 0;
+        double pick;
+
+        for (i = 0; i < n; ++i)
+        {
+            nearest_centroid(intervals[i].bbv, centroids, c, &dist[i]);
+            total += dist[i];
+        }
+
+        pick = random_unit(seed) * total;
+        for (i = 0; i < n - 1 && pick >= dist[i]; ++i)
+        {
+            pick -= dist[i];
+        }
+        memcpy(&centroids[c * SIMPOINT_DIMS], intervals[i].bbv,
+               sizeof(intervals[0].bbv));
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        assignment[i] = -1;
+    }
+
+    for (iteration = 0; iteration < SIMPOINT_MAX_ITERATIONS; ++iteration)
+    {
+        int changed = FALSE;
+
+        sse = 0;
+        for (i = 0; i < n; ++i)
+        {
+            int nearest = nearest_centroid(intervals[i].bbv, centroids, k,
+                                           &dist[i]);
+
+            if (nearest != assignment[i])
+            {
+                assignment[i] = nearest;
+                changed = TRUE;
+            }
+            sse += dist[i];
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        /* Empty clusters keep their old centroid */
+        memset(members, 0, sizeof(int) * k);
+        for (i = 0; i < n; ++i)
+        {
+            members[assignment[i]]++;
+        }
+        for (c = 0; c < k; ++c)
+        {
+            if (members[c])
+            {
+                memset(&centroids[c * SIMPOINT_DIMS], 0,
+                       sizeof(double) * SIMPOINT_DIMS);
+            }
+        }
+        for (i = 0; i < n; ++i)
+        {
+            double *centroid = &centroids[assignment[i] * SIMPOINT_DIMS];
+            int d;
+
+            for (d = 0; d < SIMPOINT_DIMS; ++d)
+            {
+                centroid[d] += intervals[i].bbv[d] / members[assignment[i]];
+            }
+        }
+    }
+
+    free(members);
+    free(dist);
+    return sse;
+}
+
+/*
+ * Bayesian Information Criterion of a clustering (Pelleg and Moore). Writes
+ * it to *bic and returns 0, or -1 if out of memory.
+ */
+static int
+clustering_bic(const int *assignment, int n, int k, double sse, double *bic)
+{
+    int *members = calloc(k, sizeof(int));
+    double variance;
+    double log_likelihood = 0;
+    int i;
+    int c;
+
+    if (!members)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        members[assignment[i]]++;
+    }
+
+    variance = (n > k) ? sse / ((double)SIMPOINT_DIMS * (n - k)) : 0;
+    if (variance < 1e-12)
+    {
+        variance = 1e-12;
+    }
+
+    for (c = 0; c < k; ++c)
+    {
+        if (members[c])
+        {
+            log_likelihood += members[c] * log((double)members[c] / n);
+        }
+    }
+    log_likelihood -= n * SIMPOINT_DIMS / 2.0 * log(2 * M_PI * variance);
+    log_likelihood -= SIMPOINT_DIMS * (n - k) / 2.0;
+
+    free(members);
+    *bic = log_likelihood - k * (SIMPOINT_DIMS + 1) / 2.0 * log(n);
+    return 0;
+}
+
+/*
+ * Clusters the intervals for k = 1..max_k and keeps the smallest k whose BIC
+ * reaches SIMPOINT_BIC_THRESHOLD of the range. Returns the chosen k and
+ * leaves its centroids in centroids[], or returns -1 if out of memory.
+ */
+static int
+cluster_intervals(SimPoint_Interval *intervals, int n, int max_k,
+                  double *centroids)
+{
+    double *all_centroids = malloc(sizeof(double) * SIMPOINT_DIMS
+                                   * max_k * (max_k + 1) / 2);
+    int *all_assignments = malloc(sizeof(int) * n * max_k);
+    double *bic = malloc(sizeof(double) * max_k);
+    double *trial = malloc(sizeof(double) * SIMPOINT_DIMS * max_k);
+    int *trial_assignment = malloc(sizeof(int) * n);
+    uint32_t seed = SIMPOINT_SEED;
+    double min_bic = 0;
+    double max_bic = 0;
+    int failed = !all_centroids || !all_assignments || !bic || !trial
+                 || !trial_assignment;
+    int chosen;
+    int k;
+    int i;
+
+    for (k = 1; k <= max_k && !failed; ++k)
+    {
+        double *best_centroids = &all_centroids[SIMPOINT_DIMS * k * (k - 1) / 2];
+        int *best_assignment = &all_assignments[n * (k - 1)];
+        double best_sse = -1;
+        int restart;
+
+        for (restart = 0; restart < SIMPOINT_RESTARTS && !failed; ++restart)
+        {
+            double sse = kmeans(intervals, n, k, &seed, trial, trial_assignment);
+
+            if (sse < 0)
+            {
+                failed = TRUE;
+            }
+            else if (best_sse < 0 || sse < best_sse)
+            {
+                best_sse = sse;
+                memcpy(best_centroids, trial, sizeof(double) * SIMPOINT_DIMS * k);
+                memcpy(best_assignment, trial_assignment, sizeof(int) * n);
+            }
+        }
+
+        if (failed
+            || clustering_bic(best_assignment, n, k, best_sse, &bic[k - 1]) != 0)
+        {
+            failed = TRUE;
+            break;
+        }
+        if (k == 1 || bic[k - 1] < min_bic)
+        {
+            min_bic = bic[k - 1];
+        }
+        if (k == 1 || bic[k - 1] > max_bic)
+        {
+            max_bic = bic[k - 1];
+        }
+    }
+
+    if (failed)
+    {
+        free(trial_assignment);
+        free(trial);
+        free(bic);
+        free(all_assignments);
+        free(all_centroids);
+        return -1;
+    }
+
+    for (chosen = 1; chosen < max_k; ++chosen)
+    {
+        if (bic[chosen - 1] >= min_bic + SIMPOINT_BIC_THRESHOLD * (max_bic - min_bic))
+        {
+            break;
+        }
+    }
+
+    memcpy(centroids, &all_centroids[SIMPOINT_DIMS * chosen * (chosen - 1) / 2],
+           sizeof(double) * SIMPOINT_DIMS * chosen);
+    for (i = 0; i < n; ++i)
+    {
+        intervals[i].cluster = all_assignments[n * (chosen - 1) + i];
+    }
+
+    free(trial_assignment);
+    free(trial);
+    free(bic);
+    free(all_assignments);
+    free(all_centroids);
+    return chosen;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+    const SimPoint_Sample *lhs = a;
+    const SimPoint_Sample *rhs = b;
+
+    return lhs->interval - rhs->interval;
+}
+
+/*
+ * Picks the samples of every cluster: the interval closest to the centroid,
+ * plus one other random member. Returns the number of samples, sorted by
+ * interval.
+ */
+static int
+choose_samples(const SimPoint_Interval *intervals, int n, int k,
+               const double *centroids, SimPoint_Sample *samples)
+{
+    uint32_t seed = SIMPOINT_SEED;
+    int num_samples = 0;
+    int c;
+    int i;
+
+    for (c = 0; c < k; ++c)
+    {
+        int representative = -1;
+        double best_dist = 0;
+        int members = 0;
+
+        for (i = 0; i < n; ++i)
+        {
+            double dist;
+
+            if (intervals[i].cluster != c)
+            {
+                continue;
+            }
+            members++;
+            dist = distance2(intervals[i].bbv, &centroids[c * SIMPOINT_DIMS]);
+            if (representative < 0 || dist < best_dist)
+            {
+                representative = i;
+                best_dist = dist;
+            }
+        }
+
+        if (members == 0)
+        {
+            continue;
+        }
+        samples[num_samples].interval = representative;
+        samples[num_samples].cluster = c;
+        num_samples++;
+
+        if (members > 1)
+        {
+            int pick = next_random(&seed) % (members - 1);
+
+            for (i = 0; i < n; ++i)
+            {
+                if (intervals[i].cluster == c && i != representative
+                    && pick-- == 0)
+                {
+                    break;
+                }
+            }
+            samples[num_samples].interval = i;
+            samples[num_samples].cluster = c;
+            num_samples++;
+        }
+    }
+
+    qsort(samples, num_samples, sizeof(*samples), compare_samples);
+    return num_samples;
+}
+
+/*
+ * Pass 2. Fast-forwards functionally (warming the branch predictors, the
+ * RAS and the caches) to every sample and runs the sample on a copy of the
+ * warmed CPU in the pipeline.
+ */
+static int
+simulate_samples(const APEX_CPU *pristine, const SimPoint_Interval *intervals,
+                 uint64_t interval_size, SimPoint_Sample *samples,
+                 int num_samples)
+{
+    APEX_Functional_Hooks hooks = { TRUE, NULL, NULL };
+    APEX_CPU *warm = calloc(1, sizeof(*warm));
+    APEX_CPU *detailed = calloc(1, sizeof(*detailed));
+    uint64_t position = 0;
+    int s;
+
+    if (!warm || !detailed || APEX_cpu_copy(warm, pristine) != 0)
+    {
+        APEX_cpu_free_copy(warm);
+        APEX_cpu_free_copy(detailed);
+        return -1;
+    }
+    for (s = 0; s < num_samples; ++s)
+    {
+        uint64_t start = (uint64_t)samples[s].interval * interval_size;
+        uint64_t executed = 0;
+        uint64_t start_clock;
+        uint64_t start_insns;
+
+        APEX_functional_run(warm, start - position, &hooks, &executed);
+        position += executed;
+
+        if (APEX_cpu_copy(detailed, warm) != 0)
+        {
+            APEX_cpu_free_copy(detailed);
+            APEX_cpu_free_copy(warm);
+            return -1;
+        }
+        APEX_cpu_reset_pipeline(detailed);
+        detailed->trace.level = APEX_TRACE_OFF;
+        detailed->single_step = FALSE;
+        start_clock = detailed->clock;
+        start_insns = detailed->insn_completed;
+
+        while (detailed->insn_completed - start_insns
+               < intervals[samples[s].interval].num_insns)
+        {
+            if (APEX_cpu_cycle(detailed))
+            {
+                break;
+            }
+        }
+
+        samples[s].cpi = (double)(detailed->clock - start_clock)
+                         / intervals[samples[s].interval].num_insns;
+    }
+
+    APEX_cpu_free_copy(detailed);
+    APEX_cpu_free_copy(warm);
+    return 0;
+}
+
+/*
+ * Runs the program in cpu with SimPoint sampling and prints the weighted CPI
+ * with a 95% confidence interval. cpu must be freshly initialized and is
+ * left unchanged. Returns 0 on success, -1 on error.
+ */
+int
+APEX_simpoint_run(const APEX_CPU *cpu, uint64_t interval_size, int max_k)
+{
+    SimPoint_Interval *intervals = NULL;
+    SimPoint_Sample *samples;
+    double *centroids;
+    uint64_t total_insns = 0;
+    uint64_t simulated_insns = 0;
+    double cpi = 0;
+    double variance = 0;
+    int num_samples;
+    int n;
+    int k;
+    int c;
+    int i;
+
+    n = collect_intervals(cpu, interval_size, &intervals);
+    if (n <= 0)
+    {
+        fprintf(stderr, "APEX_Error: SimPoint profiling failed\n");
+        free(intervals);
+        return -1;
+    }
+
+    if (max_k > n)
+    {
+        max_k = n;
+    }
+    centroids = malloc(sizeof(double) * SIMPOINT_DIMS * max_k);
+    samples = malloc(sizeof(*samples) * 2 * max_k);
+    k = (centroids && samples)
+            ? cluster_intervals(intervals, n, max_k, centroids) : -1;
+    if (k < 0)
+    {
+        fprintf(stderr, "APEX_Error: SimPoint clustering failed\n");
+        free(samples);
+        free(centroids);
+        free(intervals);
+        return -1;
+    }
+    num_samples = choose_samples(intervals, n, k, centroids, samples);
+
+    if (simulate_samples(cpu, intervals, interval_size, samples, num_samples) != 0)
+    {
+        fprintf(stderr, "APEX_Error: SimPoint simulation failed\n");
+        free(samples);
+        free(centroids);
+        free(intervals);
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+        total_insns += intervals[i].num_insns;
+    }
+
+    printf("APEX_CPU: SimPoint, %d intervals of %llu instructions, %d clusters\n",
+           n, (unsigned long long)interval_size, k);
+    printf("%-8s %-8s %-10s %-10s %s\n", "Cluster", "Members", "Weight",
+           "CPI", "Samples");
+
+    /*
+     * Each cluster is a stratum: its CPI is the mean of its samples and the
+     * error of that mean comes from the sample variance with the finite
+     * population correction.
+     */
+    for (c = 0; c < k; ++c)
+    {
+        uint64_t cluster_insns = 0;
+        double sum = 0;
+        double sum2 = 0;
+        double weight;
+        double mean;
+        int members = 0;
+        int m = 0;
+
+        for (i = 0; i < n; ++i)
+        {
+            if (intervals[i].cluster == c)
+            {
+                cluster_insns += intervals[i].num_insns;
+                members++;
+            }
+        }
+        if (members == 0)
+        {
+            continue;
+        }
+
+        printf("%-8d %-8d ", c, members);
+        weight = (double)cluster_insns / total_insns;
+        for (i = 0; i < num_samples; ++i)
+        {
+            if (samples[i].cluster == c)
+            {
+                sum += samples[i].cpi;
+                sum2 += samples[i].cpi * samples[i].cpi;
+                simulated_insns += intervals[samples[i].interval].num_insns;
+                m++;
+            }
+        }
+        mean = sum / m;
+        cpi += weight * mean;
+
+        if (m > 1)
+        {
+            double s2 = (sum2 - m * mean * mean) / (m - 1);
+
+            if (s2 < 0)
+            {
+                s2 = 0;
+            }
+            variance += weight * weight * s2 / m * (1.0 - (double)m / members);
+        }
+
+        printf("%-10.4f %-10.4f", weight, mean);
+        for (i = 0; i < num_samples; ++i)
+        {
+            if (samples[i].cluster == c)
+            {
+                printf(" %d", samples[i].interval);
+            }
+        }
+        printf("\n");
+    }
+
+    printf("APEX_CPU: Estimated CPI = %.4f +/- %.4f (95%% confidence)\n", cpi,
+           1.96 * sqrt(variance));
+    printf("APEX_CPU: Estimated cycles = %.0f for %llu instructions\n",
+           cpi * total_insns, (unsigned long long)total_insns);
+    printf("APEX_CPU: Simulated %llu of %llu instructions in the pipeline (%.2f%%)\n",
+           (unsigned long long)simulated_insns, (unsigned long long)total_insns,
+           100.0 * simulated_insns / total_insns);
+
+    free(samples);
+    free(centroids);
+    free(intervals);
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * apex_stride.c
+ * Contains the PC-indexed stride prefetcher
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "apex_stride.h"
+#include "apex_macros.h"
+
+/*
+ * Returns NULL if the table can be modelled, 0 entries always can.
+ * Otherwise returns the option suffix of the first parameter which can not.
+ */
+const char *
+APEX_stride_config_error(const APEX_Stride_Config *config)
+{
+    if (!config->entries)
+    {
+        return NULL;
+    }
+    if (config->entries < 0 || config->entries > APEX_STRIDE_MAX_ENTRIES
+        || (config->entries & (config->entries - 1)) != 0)
+    {
+        return "entries";
+    }
+    if (config->degree < 1 || config->degree > APEX_STRIDE_MAX_DEGREE)
+    {
+        return "degree";
+    }
+    if (config->distance < 1)
+    {
+        return "distance";
+    }
+
+    return NULL;
+}
+
+/* Empties the table and sets its size, which must be valid */
+void
+APEX_stride_init(APEX_Stride *stride, const APEX_Stride_Config *config)
+{
+    memset(stride, 0, sizeof(*stride));
+    stride->config = *config;
+}
+
+/*
+ * Trains the entry of the load or store at pc with its address. A new PC
+ * replaces the entry it maps to. A stride which differs from the learnt one
+ * lowers the confidence, and replaces it once the confidence is 0. Returns
+ * the number of addresses predicted into addresses, 0 unless the entry is
+ * steady. Counts the lookup in stats unless it is NULL.
+ */
+int
+APEX_stride_train(APEX_Stride *stride, int pc, int address,
+                  int addresses[APEX_STRIDE_MAX_DEGREE],
+                  APEX_Stride_Stats *stats)
+{
+    const APEX_Stride_Config *config = &stride->config;
+    APEX_Stride_Entry *entry = &stride->entries[(pc / 4) & (config->entries - 1)];
+    int delta;
+    int count = 0;
+    int i;
+
+    if (!entry->valid || entry->pc != pc)
+    {
+        entry->valid = TRUE;
+        entry->pc = pc;
+        entry->last_address = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        if (stats)
+        {
+            stats->lookups++;
+        }
+        return 0;
+    }
+
+    delta = address - entry->last_address;
+    entry->last_address = address;
+    if (delta == entry->stride)
+    {
+        if (entry->confidence < APEX_STRIDE_CONFIDENCE_MAX)
+        {
+            entry->confidence++;
+        }
+    }
+    else if (entry->confidence > 0)
+    {
+        entry->confidence--;
+    }
+    else
+    {
+        entry->stride = delta;
+    }
+
+    if (entry->stride != 0 && entry->confidence >= APEX_STRIDE_STEADY)
+    {
+        for (i = 0; i < config->degree; ++i)
+        {
+            addresses[count++] = address + (config->distance + i) * entry->stride;
+        }
+    }
+
+    if (stats)
+    {
+        stats->lookups++;
+        stats->steady += count > 0;
+        stats->predictions += count;
+    }
+    return count;
+}
+
+/*
+ * Prints the counters of an enabled prefetcher. The accuracy and coverage
+ * come from the cache it fills: the share of the prefetched lines a demand
+ * access used, and the share of the misses they removed.
+ */
+void
+APEX_stride_print_stats(const APEX_Stride_Config *config,
+                        const APEX_Stride_Stats *stats,
+                        const APEX_Cache_Stats *cache)
+{
+    uint64_t misses = cache->read_misses + cache->write_misses;
+
+    printf("APEX_CPU: Stride prefetcher %d entries, degree %d, distance %d\n",
+           config->entries, config->degree, config->distance);
+    printf("          lookups = %llu, steady = %llu, predictions = %llu,"
+           " redundant = %llu, prefetches = %llu",
+           (unsigned long long)stats->lookups, (unsigned long long)stats->steady,
+           (unsigned long long)stats->predictions,
+           (unsigned long long)stats->redundant,
+           (unsigned long long)cache->prefetches);
+    if (cache->prefetches)
+    {
+        printf(", accuracy %.1f%%",
+               100.0 * cache->useful_prefetches / cache->prefetches);
+    }
+    if (cache->useful_prefetches + misses)
+    {
+        printf(", coverage %.1f%%", 100.0 * cache->useful_prefetches
+                                    / (cache->useful_prefetches + misses));
+    }
+    printf("\n");
+}
@@ -0,0 +1,66 @@
+/*
+ * apex_stride.h
+ * Contains the PC-indexed stride prefetcher
+ *
+ * Every load and store trains the entry of its PC with the distance between
+ * its address and the previous one of the same instruction. Once the same
+ * stride was seen twice in a row the entry is steady, and each further
+ * access predicts the addresses distance to distance + degree - 1 strides
+ * ahead, which the caller prefetches. LOADP and STOREP walk memory with a
+ * stride of 4, so their streams are learnt after three accesses.
+ */
+#ifndef _APEX_STRIDE_H_
+#define _APEX_STRIDE_H_
+
+#include <stdint.h>
+
+#include "apex_cache.h"
+
+#define APEX_STRIDE_MAX_ENTRIES 256
+#define APEX_STRIDE_MAX_DEGREE 8
+#define APEX_STRIDE_CONFIDENCE_MAX 3
+#define APEX_STRIDE_STEADY 1       /* Confidence needed to predict */
+
+/* Table size and aggressiveness, part of APEX_Config */
+typedef struct APEX_Stride_Config
+{
+    int entries;                   /* A power of two, 0 disables the prefetcher */
+    int degree;                    /* Addresses predicted per access */
+    int distance;                  /* Strides ahead of the first one */
+} APEX_Stride_Config;
+
+/* Event counters, part of APEX_Stats */
+typedef struct APEX_Stride_Stats
+{
+    uint64_t lookups;              /* Loads and stores trained on */
+    uint64_t steady;               /* ... whose entry predicted */
+    uint64_t predictions;          /* Addresses predicted */
+    uint64_t redundant;            /* ... whose line the cache held already */
+} APEX_Stride_Stats;
+
+typedef struct APEX_Stride_Entry
+{
+    int pc;
+    int valid;
+    int last_address;
+    int stride;
+    int confidence;                /* 0..APEX_STRIDE_CONFIDENCE_MAX */
+} APEX_Stride_Entry;
+
+/* Table state, a plain value so CPUs and checkpoints can copy it */
+typedef struct APEX_Stride
+{
+    APEX_Stride_Config config;
+    APEX_Stride_Entry entries[APEX_STRIDE_MAX_ENTRIES];
+} APEX_Stride;
+
+const char *APEX_stride_config_error(const APEX_Stride_Config *config);
+void APEX_stride_init(APEX_Stride *stride, const APEX_Stride_Config *config);
+int APEX_stride_train(APEX_Stride *stride, int pc, int address,
+                      int addresses[APEX_STRIDE_MAX_DEGREE],
+                      APEX_Stride_Stats *stats);
+void APEX_stride_print_stats(const APEX_Stride_Config *config,
+                             const APEX_Stride_Stats *stats,
+                             const APEX_Cache_Stats *cache);
+
+#endif
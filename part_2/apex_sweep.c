@@ -0,0 +1,500 @@
+/*
+ * apex_sweep.c
+ * Design-space sweep driver. Runs one program under every point of a
+ * parameter grid, each point as an independent APEX_CPU, on a pool of host
+ * threads, and prints IPC and branch statistics of all points with the
+ * Pareto-optimal ones marked.
+ *
+ * Jobs take very different times (a longer latency can double the cycle
+ * count), so every thread owns a deque of jobs: it pops from the bottom of
+ * its own deque and, once that is empty, steals from the top of the others.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apex_lib.h"
+#include "apex_macros.h"
+
+#define SWEEP_MAX_VALUES 16
+#define SWEEP_AXES 8
+
+/* Largest grid, the Pareto marking is quadratic in the number of points */
+#define SWEEP_MAX_POINTS 65536
+
+typedef struct Sweep_Axis
+{
+    const char *name;
+    int values[SWEEP_MAX_VALUES];
+    int num_values;
+} Sweep_Axis;
+
+typedef struct Sweep_Job
+{
+    APEX_Config config;
+    int cycles;
+    int insns;
+    int halted;
+    int invalid;                   /* Rejected by APEX_config_valid, not run */
+    APEX_Stats stats;
+    int pareto;
+} Sweep_Job;
+
+typedef struct Sweep_Deque
+{
+    pthread_mutex_t lock;
+    int *jobs;                     /* Job indices, valid in [top, bottom) */
+    int top;
+    int bottom;
+} Sweep_Deque;
+
+typedef struct Sweep_Pool
+{
+    const APEX_Program *program;   /* Shared by the CPUs of all jobs */
+    Sweep_Job *jobs;
+    Sweep_Deque *deques;
+    int num_threads;
+    int max_cycles;
+} Sweep_Pool;
+
+typedef struct Sweep_Worker
+{
+    Sweep_Pool *pool;
+    int id;
+    int steals;                    /* Jobs taken from other threads */
+} Sweep_Worker;
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr,
+            "APEX_Help: Usage %s <input_file> [options]\n"
+            "  --threads <N>            host threads (default: all CPUs)\n"
+            "  --max-cycles <N>         stop a point after N cycles (default 100000000)\n"
+            "  --btb-size <a,b,...>     BTB entries (default 4)\n"
+            "  --btb-ways <a,b,...>     BTB entries per set, 0 = all (default 0)\n"
+            "  --forwarding <a,b,...>   1 = forwarding, 0 = wait for writeback (default 1)\n"
+            "  --mul-latency <a,b,...>  execute cycles of MUL (default 1)\n"
+            "  --mem-latency <a,b,...>  memory cycles of loads and stores (default 1)\n"
+            "  --l1d-size <a,b,...>     L1 data cache bytes, 0 = none (default 0)\n"
+            "  --issue-width <a,b,...>  pipeline instructions issued per cycle, 1 or 2 (default 1)\n"
+            "  --ooo <a,b,...>          1 = out-of-order backend, 0 = pipeline (default 0)\n"
+            "  at most %d points in the grid\n",
+            prog, SWEEP_MAX_POINTS);
+}
+
+/* Parses a comma separated list of integers. Returns FALSE on error */
+static int
+parse_axis(Sweep_Axis *axis, const char *list)
+{
+    const char *p = list;
+
+    axis->num_values = 0;
+    while (*p)
+    {
+        char *end;
+        long value = strtol(p, &end, 10);
+
+        if (end == p || axis->num_values == SWEEP_MAX_VALUES)
+        {
+            return FALSE;
+        }
+        axis->values[axis->num_values++] = (int)value;
+
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end)
+        {
+            return FALSE;
+        }
+        p = end;
+    }
+
+    return axis->num_values > 0;
+}
+
+/* Takes a job from the bottom of the own deque */
+static int
+pop_job(Sweep_Deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        job = deque->jobs[--deque->bottom];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return job;
+}
+
+/* Takes a job from the top of another thread's deque */
+static int
+steal_job(Sweep_Deque *deque)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+    {
+        job = deque->jobs[deque->top++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return job;
+}
+
+static void
+run_job(const Sweep_Pool *pool, Sweep_Job *job)
+{
+    APEX_CPU *cpu = apex_create(pool->program, &job->config);
+
+    if (!cpu)
+    {
+        job->invalid = TRUE;
+        return;
+    }
+
+    apex_step(cpu, pool->max_cycles);
+    job->halted = apex_halted(cpu);
+    job->cycles = apex_cycles(cpu);
+    job->insns = apex_instructions(cpu);
+    job->stats = *apex_stats(cpu);
+    apex_destroy(cpu);
+}
+
+static void *
+worker_main(void *arg)
+{
+    Sweep_Worker *worker = arg;
+    Sweep_Pool *pool = worker->pool;
+
+    while (TRUE)
+    {
+        int job = pop_job(&pool->deques[worker->id]);
+        int i;
+
+        /* Jobs never create jobs, so all deques empty means done */
+        for (i = 1; job < 0 && i < pool->num_threads; ++i)
+        {
+            Sweep_Deque *victim
+                = &pool->deques[(worker->id + i) % pool->num_threads];
+
+            job = steal_job(victim);
+            if (job >= 0)
+            {
+                worker->steals++;
+            }
+        }
+
+        if (job < 0)
+        {
+            break;
+        }
+        run_job(pool, &pool->jobs[job]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Hardware cost of a point only grows with the BTB size, forwarding, the
+ * L1D size, the issue width and the out-of-order backend and shrinks with
+ * longer latencies. A point is Pareto-optimal if no other point is at most
+ * as expensive in every parameter and has a higher IPC.
+ */
+static int
+is_cheaper_or_equal(const APEX_Config *a, const APEX_Config *b)
+{
+    return a->btb_size <= b->btb_size && a->btb_ways <= b->btb_ways
+           && a->forwarding <= b->forwarding
+           && a->mul_latency >= b->mul_latency
+           && a->mem_latency >= b->mem_latency
+           && a->l1d.size <= b->l1d.size
+           && a->issue_width <= b->issue_width
+           && a->backend <= b->backend;
+}
+
+static double
+job_ipc(const Sweep_Job *job)
+{
+    return job->cycles ? (double)job->insns / job->cycles : 0.0;
+}
+
+static void
+mark_pareto(Sweep_Job *jobs, int num_jobs)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].pareto = jobs[i].halted;
+        for (j = 0; j < num_jobs && jobs[i].pareto; ++j)
+        {
+            if (j == i || !jobs[j].halted
+                || !is_cheaper_or_equal(&jobs[j].config, &jobs[i].config))
+            {
+                continue;
+            }
+
+            /* Same IPC: the strictly cheaper point, or the first of equals */
+            if (job_ipc(&jobs[j]) > job_ipc(&jobs[i])
+                || (job_ipc(&jobs[j]) == job_ipc(&jobs[i])
+                    && (!is_cheaper_or_equal(&jobs[i].config, &jobs[j].config)
+                        || j < i)))
+            {
+                jobs[i].pareto = FALSE;
+            }
+        }
+    }
+}
+
+static void
+print_results(const Sweep_Job *jobs, int num_jobs)
+{
+    int i;
+
+    printf("%-5s %-5s %-4s %-4s %-4s %-5s %-4s %-4s %-10s %-10s %-7s %-9s %-9s %-8s %s\n",
+           "btb", "ways", "fwd", "mul", "mem", "l1d", "iw", "ooo", "cycles", "insns", "IPC", "branches", "mispred",
+           "BTB_hit%", "pareto");
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        const Sweep_Job *job = &jobs[i];
+        uint64_t lookups = job->stats.btb_hits + job->stats.btb_misses;
+
+        printf("%-5d %-5d %-4d %-4d %-4d %-5d %-4d %-4d %-10d %-10d %-7.4f %-9llu %-9llu %-8.2f %s\n",
+               job->config.btb_size, job->config.btb_ways, job->config.forwarding,
+               job->config.mul_latency, job->config.mem_latency, job->config.l1d.size,
+               job->config.issue_width, job->config.backend == APEX_BACKEND_OOO, job->cycles,
+               job->insns, job_ipc(job),
+               (unsigned long long)job->stats.branches,
+               (unsigned long long)job->stats.mispredictions,
+               lookups ? 100.0 * job->stats.btb_hits / lookups : 0.0,
+               job->pareto ? "*"
+               : job->invalid ? "invalid"
+               : (job->halted ? "" : "(no HALT)"));
+    }
+}
+
+int
+main(int argc, char const *argv[])
+{
+    Sweep_Axis axes[SWEEP_AXES] = {
+        { "btb-size", { BTB_adding_4_buffer }, 1 },
+        { "btb-ways", { 0 }, 1 },
+        { "forwarding", { TRUE }, 1 },
+        { "mul-latency", { 1 }, 1 },
+        { "mem-latency", { 1 }, 1 },
+        { "l1d-size", { 0 }, 1 },
+        { "issue-width", { 1 }, 1 },
+        { "ooo", { FALSE }, 1 },
+    };
+    const char *filename = NULL;
+    Sweep_Pool pool;
+    Sweep_Worker *workers;
+    pthread_t *threads;
+    APEX_Program *program;
+    uint64_t grid = 1;
+    int num_jobs;
+    int num_started;
+    int num_invalid = 0;
+    int steals = 0;
+    int i;
+    int a;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    pool.max_cycles = 100000000;
+
+    for (i = 1; i < argc; ++i)
+    {
+        int matched = FALSE;
+
+        for (a = 0; a < SWEEP_AXES && i + 1 < argc; ++a)
+        {
+            if (strncmp(argv[i], "--", 2) == 0
+                && strcmp(argv[i] + 2, axes[a].name) == 0)
+            {
+                if (!parse_axis(&axes[a], argv[++i]))
+                {
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                matched = TRUE;
+                break;
+            }
+        }
+
+        if (matched)
+        {
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            pool.num_threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-cycles") == 0 && i + 1 < argc)
+        {
+            pool.max_cycles = atoi(argv[++i]);
+        }
+        else if (strncmp(argv[i], "--", 2) != 0 && !filename)
+        {
+            filename = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    /* Cartesian product of the axes, the last axis varies fastest */
+    for (a = 0; a < SWEEP_AXES; ++a)
+    {
+        if (grid > SWEEP_MAX_POINTS / (uint64_t)axes[a].num_values)
+        {
+            grid = SWEEP_MAX_POINTS + 1;
+            break;
+        }
+        grid *= axes[a].num_values;
+    }
+
+    if (!filename || pool.num_threads < 1 || pool.max_cycles < 1
+        || grid > SWEEP_MAX_POINTS)
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+    num_jobs = (int)grid;
+
+    program = apex_program_load(filename);
+    if (!program)
+    {
+        fprintf(stderr, "APEX_Error: Unable to load %s\n", filename);
+        exit(1);
+    }
+    pool.program = program;
+
+    pool.jobs = calloc(num_jobs, sizeof(Sweep_Job));
+    if (!pool.jobs)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for %d points\n", num_jobs);
+        exit(1);
+    }
+    for (i = 0; i < num_jobs; ++i)
+    {
+        int rest = i;
+        int value[SWEEP_AXES];
+
+        for (a = SWEEP_AXES - 1; a >= 0; --a)
+        {
+            value[a] = axes[a].values[rest % axes[a].num_values];
+            rest /= axes[a].num_values;
+        }
+        APEX_config_default(&pool.jobs[i].config);
+        pool.jobs[i].config.btb_size = value[0];
+        pool.jobs[i].config.btb_ways = value[1] ? value[1] : value[0];
+        pool.jobs[i].config.forwarding = value[2];
+        pool.jobs[i].config.mul_latency = value[3];
+        pool.jobs[i].config.mem_latency = value[4];
+        pool.jobs[i].config.l1d.size = value[5];
+        pool.jobs[i].config.issue_width = value[6];
+        pool.jobs[i].config.backend = value[7] ? APEX_BACKEND_OOO
+                                               : APEX_BACKEND_INORDER;
+
+        /* Such as an L1D smaller than a line, reported instead of run */
+        pool.jobs[i].invalid = !APEX_config_valid(&pool.jobs[i].config);
+        num_invalid += pool.jobs[i].invalid;
+    }
+
+    if (pool.num_threads > num_jobs)
+    {
+        pool.num_threads = num_jobs;
+    }
+
+    /* Contiguous slices, so neighbouring (similar) points start together */
+    pool.deques = calloc(pool.num_threads, sizeof(Sweep_Deque));
+    workers = calloc(pool.num_threads, sizeof(Sweep_Worker));
+    threads = calloc(pool.num_threads, sizeof(pthread_t));
+    if (!pool.deques || !workers || !threads)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for %d threads\n",
+                pool.num_threads);
+        exit(1);
+    }
+    for (i = 0; i < pool.num_threads; ++i)
+    {
+        Sweep_Deque *deque = &pool.deques[i];
+        int first = (int)((long)num_jobs * i / pool.num_threads);
+        int last = (int)((long)num_jobs * (i + 1) / pool.num_threads);
+        int j;
+
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->jobs = malloc(sizeof(int) * (last - first + 1));
+        if (!deque->jobs)
+        {
+            fprintf(stderr, "APEX_Error: Out of memory for %d threads\n",
+                    pool.num_threads);
+            exit(1);
+        }
+        for (j = first; j < last; ++j)
+        {
+            if (!pool.jobs[j].invalid)
+            {
+                deque->jobs[deque->bottom++] = j;
+            }
+        }
+    }
+
+    /*
+     * If a thread cannot be started, the main thread works instead; it steals
+     * the jobs of the threads which were never started.
+     */
+    for (num_started = 0; num_started < pool.num_threads; ++num_started)
+    {
+        Sweep_Worker *worker = &workers[num_started];
+
+        worker->pool = &pool;
+        worker->id = num_started;
+        if (pthread_create(&threads[num_started], NULL, worker_main, worker) != 0)
+        {
+            fprintf(stderr, "APEX_Error: Unable to start thread %d of %d\n",
+                    num_started + 1, pool.num_threads);
+            worker_main(worker);
+            break;
+        }
+    }
+    for (i = 0; i < pool.num_threads; ++i)
+    {
+        if (i < num_started)
+        {
+            pthread_join(threads[i], NULL);
+        }
+        steals += workers[i].steals;
+    }
+
+    mark_pareto(pool.jobs, num_jobs);
+    printf("APEX_SWEEP: %d points (%d invalid) on %d threads, %d jobs stolen\n",
+           num_jobs, num_invalid, pool.num_threads, steals);
+    print_results(pool.jobs, num_jobs);
+
+    for (i = 0; i < pool.num_threads; ++i)
+    {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].jobs);
+    }
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    free(pool.jobs);
+    apex_program_free(program);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * apex_trace.c
+ * Contains the defaults and the command line parsing of the trace settings
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_trace.h"
+
+static const char *const level_names[] = { "off", "summary", "stage", "verbose" };
+
+static const struct
+{
+    const char *name;
+    unsigned int mask;
+} category_names[] = {
+    { "fetch", APEX_TRACE_FETCH },
+    { "decode", APEX_TRACE_DECODE },
+    { "execute", APEX_TRACE_EXECUTE },
+    { "memory", APEX_TRACE_MEMORY },
+    { "writeback", APEX_TRACE_WRITEBACK },
+    { "btb", APEX_TRACE_BTB },
+    { "forwarding", APEX_TRACE_FORWARDING },
+    { "regs", APEX_TRACE_REGS },
+    { "all", APEX_TRACE_ALL },
+};
+
+/* ENABLE_DEBUG_MESSAGES selects full tracing, as the simulator always did */
+void
+APEX_trace_default(APEX_Trace *trace)
+{
+    trace->level = ENABLE_DEBUG_MESSAGES ? APEX_TRACE_VERBOSE : APEX_TRACE_OFF;
+    trace->mask = APEX_TRACE_DEFAULT_MASK;
+    trace->first_cycle = 0;
+    trace->last_cycle = INT_MAX;
+    trace->first_pc = 0;
+    trace->last_pc = INT_MAX;
+}
+
+/* Returns the level called name, or -1 */
+int
+APEX_trace_parse_level(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(level_names) / sizeof(level_names[0])); ++i)
+    {
+        if (strcmp(name, level_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Parses a comma separated list of categories. Returns FALSE on error */
+int
+APEX_trace_parse_mask(const char *list, unsigned int *mask)
+{
+    const char *p = list;
+
+    *mask = 0;
+    while (*p)
+    {
+        size_t len = strcspn(p, ",");
+        int found = FALSE;
+        int i;
+
+        for (i = 0; i < (int)(sizeof(category_names) / sizeof(category_names[0])); ++i)
+        {
+            if (strlen(category_names[i].name) == len
+                && strncmp(p, category_names[i].name, len) == 0)
+            {
+                *mask |= category_names[i].mask;
+                found = TRUE;
+            }
+        }
+
+        if (!found)
+        {
+            return FALSE;
+        }
+        p += len;
+        if (*p == ',')
+        {
+            p++;
+        }
+    }
+
+    return *mask != 0;
+}
+
+/*
+ * Parses "first:last", either bound may be left out. Returns FALSE on error
+ */
+int
+APEX_trace_parse_range(const char *range, int *first, int *last)
+{
+    const char *colon = strchr(range, ':');
+    char *end;
+
+    if (!colon)
+    {
+        return FALSE;
+    }
+
+    *first = 0;
+    *last = INT_MAX;
+    if (colon != range)
+    {
+        *first = (int)strtol(range, &end, 10);
+        if (end != colon)
+        {
+            return FALSE;
+        }
+    }
+    if (colon[1])
+    {
+        *last = (int)strtol(colon + 1, &end, 10);
+        if (*end)
+        {
+            return FALSE;
+        }
+    }
+
+    return *first <= *last;
+}
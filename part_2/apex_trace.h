@@ -0,0 +1,74 @@
+/*
+ * apex_trace.h
+ * Contains the tracing levels, categories and filters of the simulator
+ *
+ * A trace point is guarded by APEX_TRACING(), which only compares the level
+ * when tracing is off. Building with -DAPEX_ENABLE_TRACE=0 removes all trace
+ * points from the pipeline.
+ */
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+
+#include <limits.h>
+#include <stdint.h>
+
+#ifndef APEX_ENABLE_TRACE
+#define APEX_ENABLE_TRACE 1
+#endif
+
+/* Levels, each one includes the ones below it */
+#define APEX_TRACE_OFF 0
+#define APEX_TRACE_SUMMARY 1       /* Program listing and end of run counters */
+#define APEX_TRACE_STAGE 2         /* Cycle headers and stage contents */
+#define APEX_TRACE_VERBOSE 3       /* Register file, BTB, memory and forwarding events */
+
+/* Categories */
+#define APEX_TRACE_FETCH 0x01
+#define APEX_TRACE_DECODE 0x02
+#define APEX_TRACE_EXECUTE 0x04
+#define APEX_TRACE_MEMORY 0x08
+#define APEX_TRACE_WRITEBACK 0x10
+#define APEX_TRACE_BTB 0x20
+#define APEX_TRACE_FORWARDING 0x40
+#define APEX_TRACE_REGS 0x80
+#define APEX_TRACE_ALL 0xff
+
+/* Forwarding events are only traced when asked for */
+#define APEX_TRACE_DEFAULT_MASK (APEX_TRACE_ALL & ~APEX_TRACE_FORWARDING)
+
+typedef struct APEX_Trace
+{
+    int level;                     /* APEX_TRACE_OFF..APEX_TRACE_VERBOSE */
+    unsigned int mask;             /* Categories to trace */
+    int first_cycle;               /* Cycle window, inclusive */
+    int last_cycle;
+    int first_pc;                  /* PC range, inclusive */
+    int last_pc;
+} APEX_Trace;
+
+/* pc is -1 for events which do not belong to one instruction. A cycle
+ * window left open ends at INT_MAX, which a run may outlast. */
+static inline int
+APEX_trace_filter(const APEX_Trace *trace, uint64_t cycle, int pc)
+{
+    return (int64_t)cycle >= trace->first_cycle
+           && ((int64_t)cycle <= trace->last_cycle || trace->last_cycle == INT_MAX)
+           && (pc < 0 || (pc >= trace->first_pc && pc <= trace->last_pc));
+}
+
+#if APEX_ENABLE_TRACE
+#define APEX_TRACING(cpu, lvl, category, pc)                                 \
+    ((cpu)->trace.level >= (lvl) && ((cpu)->trace.mask & (category))         \
+     && APEX_trace_filter(&(cpu)->trace, (cpu)->clock + 1, (pc)))
+#define APEX_TRACING_SUMMARY(cpu) ((cpu)->trace.level >= APEX_TRACE_SUMMARY)
+#else
+#define APEX_TRACING(cpu, lvl, category, pc) 0
+#define APEX_TRACING_SUMMARY(cpu) 0
+#endif
+
+void APEX_trace_default(APEX_Trace *trace);
+int APEX_trace_parse_level(const char *name);
+int APEX_trace_parse_mask(const char *list, unsigned int *mask);
+int APEX_trace_parse_range(const char *range, int *first, int *last);
+
+#endif
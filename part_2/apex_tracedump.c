@@ -0,0 +1,91 @@
+/*
+ * apex_tracedump.c
+ * Offline decoder of binary pipeline traces (apex_sim --bintrace). Prints
+ * every cycle in the same format as display mode, the V pipe included.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_bintrace.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+/* Prints the stages of one cycle like display mode does */
+static void
+print_cycle(const CPU_Stage display[10], uint32_t pipes)
+{
+    APEX_display_stages(display);
+    if (pipes > 1)
+    {
+        printf("\nV pipe:");
+        APEX_display_stages(display + 5);
+    }
+}
+
+int
+main(int argc, char const *argv[])
+{
+    APEX_Bintrace_Header header;
+    APEX_Bintrace_Record record;
+    CPU_Stage display[10];         /* The U pipe, then the V pipe */
+    long cycle = -1;
+    FILE *fp;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "APEX_Help: Usage %s <trace_file>\n", argv[0]);
+        exit(1);
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open %s\n", argv[1]);
+        exit(1);
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(header.magic, APEX_BINTRACE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != APEX_BINTRACE_VERSION
+        || header.record_size != sizeof(APEX_Bintrace_Record)
+        || header.pipes < 1 || header.pipes > APEX_BINTRACE_MAX_PIPES)
+    {
+        fprintf(stderr, "APEX_Error: %s is not a version %d APEX trace\n",
+                argv[1], APEX_BINTRACE_VERSION);
+        fclose(fp);
+        exit(1);
+    }
+
+    memset(display, 0, sizeof(display));
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        CPU_Stage *stage = &display[(record.stage & ~APEX_BINTRACE_VALID) % 10];
+
+        if (record.cycle != cycle)
+        {
+            if (cycle >= 0)
+            {
+                print_cycle(display, header.pipes);
+            }
+            cycle = record.cycle;
+            printf("---Clock Cycle #:%ld------\n", cycle);
+        }
+
+        stage->has_insn = (record.stage & APEX_BINTRACE_VALID) != 0;
+        stage->pc = record.pc;
+        stage->imm = record.imm;
+        stage->opcode = record.opcode;
+        stage->rd = record.regs & 0x1f;
+        stage->rs1 = (record.regs >> 5) & 0x1f;
+        stage->rs2 = (record.regs >> 10) & 0x1f;
+    }
+
+    if (cycle >= 0)
+    {
+        print_cycle(display, header.pipes);
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# check.sh
+#
+# Regression check: runs every sample program on the functional simulator
+# and on several pipeline configurations, and compares the final register
+# file and data memory. Exits non-zero if any configuration disagrees.
+#
+
+SIM=./apex_sim
+TMP=${TMPDIR:-/tmp}/apex_check.$$
+FAILED=0
+
+trap 'rm -f "$TMP".*' EXIT
+
+# Final architectural state, without the pipeline-only register status
+final_state()
+{
+    sed -n '/== STATE REGISTER FILE/,$p' | grep 'REG\|MEM' |
+        sed 's/Status = [A-Z]*//'
+}
+
+for program in input.asm inputh.asm "inputc (2).asm"
+do
+    "$SIM" "$program" --functional 2>/dev/null | final_state > "$TMP.ref"
+    if [ ! -s "$TMP.ref" ]
+    then
+        echo "FAIL $program --functional"
+        FAILED=1
+        continue
+    fi
+
+    while read -r options
+    do
+        # $options is split into words on purpose
+        "$SIM" "$program" simulate 1 $options 2>/dev/null |
+            final_state > "$TMP.out"
+        if cmp -s "$TMP.ref" "$TMP.out"
+        then
+            echo "PASS $program $options"
+        else
+            echo "FAIL $program $options"
+            FAILED=1
+        fi
+    done <<CONFIGS
+--backend inorder
+--no-forwarding
+--mul-latency 3 --div-latency 4
+--bpred gshare --ras-depth 0
+--issue-width 2
+--fusion
+--l1d-size 64 --l1i-size 64 --l2-size 256 --dram-banks 2 --stride-entries 4
+--store-buffer 4 --mshrs 4 --mem-latency 5
+--backend ooo
+--backend ooo --rob-size 8 --iq-size 4 --lsq-size 4
+CONFIGS
+done
+
+exit $FAILED
@@ -7,8 +7,13 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#include "apex_bintrace.h"
 #include "apex_cpu.h"
+#include "apex_kanata.h"
+#include "apex_profile.h"
 
 // int
 // main(int argc, char const *argv[])
@@ -35,33 +40,553 @@
 //     return 0;
 // }
 
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr,
+            "APEX_Help: Usage %s <input_file> [<simulate|display> <cycles>]"
+            " [options]\n"
+            "  --functional    run the functional (ISA-only) simulator\n"
+            "  --skip <N>      run the first N instructions functionally, then\n"
+            "                  switch to the pipeline with warm predictors and caches\n"
+            "  --restore <f>   resume from checkpoint file f, with the configuration\n"
+            "                  it was taken with (no configuration options)\n"
+            "  --checkpoint <f> write a checkpoint to f after <cycles>, or\n"
+            "                  right after --skip when no cycles are given\n"
+            "  --simpoint <N>  sampled simulation with intervals of N instructions\n"
+            "  --simpoint-k <K> maximum number of SimPoint clusters (default 10)\n"
+            "  --btb-size <N>  BTB entries (default 4)\n"
+            "  --btb-ways <N>  BTB entries per set (default: all, one set)\n"
+            "  --btb-policy <p> BTB replacement: fifo, lru or random (default fifo)\n"
+            "  --no-forwarding consumers wait for the producer to write back\n"
+            "  --mul-latency <N> execute cycles of the pipelined multiplier (default 1)\n"
+            "  --div-latency <N> worst case execute cycles of the divider, small\n"
+            "                  quotients finish early (default 1)\n"
+            "  --mem-latency <N> cycles of every memory access without --dram-banks\n"
+            "                  (default 1)\n"
+            "  --l1d-size <B>  L1 data cache bytes, 0 disables it (default 0)\n"
+            "  --l1d-ways <N> --l1d-line <B> --l1d-latency <N>\n"
+            "                  L1D ways, line bytes and hit cycles (default 4, 16\n"
+            "                  and 1)\n"
+            "  --l1d-policy <p> L1D replacement: lru, plru or rrip (default lru)\n"
+            "  --l1d-write-through --l1d-no-write-allocate\n"
+            "                  L1D write policy (default write-back, write-allocate)\n"
+            "  --l1i-size <B>  L1 instruction cache bytes, 0 disables it (default 0)\n"
+            "  --l1i-ways <N> --l1i-line <B> --l1i-latency <N> --l1i-policy <p>\n"
+            "                  as for the L1D (default 4, 16, 1 and lru)\n"
+            "  --l1i-prefetch  prefetch the next line into the L1I\n"
+            "  --l2-size <B>   unified L2 cache bytes, 0 disables it (default 0)\n"
+            "  --l2-ways <N> --l2-line <B> --l2-latency <N> --l2-policy <p>\n"
+            "                  as for the L1D (default 8, 16, 8 and lru)\n"
+            "  --dram-banks <N> banked DRAM behind the caches, 0 for a flat\n"
+            "                  --mem-latency (default 0)\n"
+            "  --dram-row <B> --dram-cas <N> --dram-activate <N>\n"
+            "  --dram-precharge <N> --dram-burst <N>\n"
+            "                  row bytes, access cycles and data bus cycles per\n"
+            "                  line (default 256, 10, 10, 10 and 4)\n"
+            "  --stride-entries <N> PC-indexed stride prefetcher into the L1D,\n"
+            "                  0 disables it (default 0)\n"
+            "  --stride-degree <N> lines predicted per load or store (default 2)\n"
+            "  --stride-distance <N> strides ahead of the first (default 4)\n"
+            "  --store-buffer <N> in-order pipeline: stores retire into a buffer\n"
+            "                  of N entries, 0 disables it (default 0)\n"
+            "  --mshrs <N>     in-order pipeline: loads leave memory before their\n"
+            "                  data, N lines outstanding, 0 disables it (default 0)\n"
+            "  --bpred <name>  direction predictor: legacy, bimodal, gshare, tage or\n"
+            "                  perceptron (default legacy, the BTB outcome bits)\n"
+            "  --ras-depth <N> return address stack entries, 0 disables it\n"
+            "                  (default 8)\n"
+            "  --backend <b>   inorder (the five stage pipeline, default) or ooo\n"
+            "  --issue-width <N> 2 issues U/V pairs in the inorder pipeline\n"
+            "                  (default 1)\n"
+            "  --fusion        single issue inorder pipeline: a CMP or CML and the\n"
+            "                  conditional branch after it issue as one micro-op\n"
+            "  --ooo-width <N> instructions fetched, renamed and committed per\n"
+            "                  cycle by the ooo backend (default 2)\n"
+            "  --rob-size <N> --iq-size <N> --lsq-size <N> --phys-regs <N>\n"
+            "                  ooo window sizes (default 32, 16, 8 and 64)\n"
+            "  --alus <N> --muls <N> --mem-ports <N>\n"
+            "                  ooo function units (default 2, 1 and 1)\n"
+            "  --trace <level> off, summary, stage or verbose (default verbose)\n"
+            "  --trace-mask <c,...> fetch, decode, execute, memory, writeback, btb,\n"
+            "                  forwarding, regs or all (default all but forwarding)\n"
+            "  --trace-cycles <a:b> trace only cycles a to b\n"
+            "  --trace-pc <a:b> trace only instructions with PC a to b\n"
+            "  --bintrace <f>  write a binary trace of every cycle to f, instead of\n"
+            "                  the display mode text (see apex_tracedump)\n"
+            "  --kanata <f>    write a Kanata log of the pipeline to f, for the\n"
+            "                  Konata viewer\n"
+            "  --profile <f>   write the program listing annotated with the cycles\n"
+            "                  of every instruction to f, hottest first\n",
+            prog);
+}
+
+static double
+host_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs the whole program on the functional simulator */
+static void
+run_functional(APEX_CPU *cpu)
+{
+    uint64_t executed = 0;
+    double start = host_seconds();
+    double elapsed;
+
+    APEX_functional_run(cpu, UINT64_MAX, NULL, &executed);
+    elapsed = host_seconds() - start;
+    APEX_cpu_print_fault(cpu);
+
+    printf("APEX_CPU: Functional simulation complete, instructions = %llu\n",
+           (unsigned long long)executed);
+    fprintf(stderr, "APEX_CPU: %.3f s host time, %.2f MIPS\n", elapsed,
+            elapsed > 0 ? executed / elapsed / 1e6 : 0.0);
+
+    Registers_state(cpu);
+    printf("Zero flag: %d\n", cpu->zero_flag);
+    printf("Positive flag: %d\n", cpu->pos_flag);
+    printf("Negative flag: %d\n", cpu->neg_flag);
+    State_data_memory(cpu);
+}
+
 int
 main(int argc, char const *argv[])
 {
     APEX_CPU *cpu;
+    const char *positional[3];
+    int num_positional = 0;
+    int functional = FALSE;
+    uint64_t skip = 0;
+    const char *restore_file = NULL;
+    const char *checkpoint_file = NULL;
+    const char *bintrace_file = NULL;
+    const char *kanata_file = NULL;
+    const char *profile_file = NULL;
+    int btb_ways = 0;
+    uint64_t simpoint_interval = 0;
+    int simpoint_max_k = 10;
+    APEX_Config config;
+    APEX_Config defaults;
+    char config_error[128];
+    APEX_Trace trace;
+    int i;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    if (argc < 2 || argc > 4)
+    /* Zeroed first, so that memcmp() tells whether an option changed it */
+    memset(&config, 0, sizeof(config));
+    memset(&defaults, 0, sizeof(defaults));
+    APEX_config_default(&config);
+    APEX_config_default(&defaults);
+    APEX_trace_default(&trace);
+    for (i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--functional") == 0)
+        {
+            functional = TRUE;
+        }
+        else if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc)
+        {
+            skip = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc)
+        {
+            restore_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+        {
+            checkpoint_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--simpoint") == 0 && i + 1 < argc)
+        {
+            simpoint_interval = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--simpoint-k") == 0 && i + 1 < argc)
+        {
+            simpoint_max_k = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--btb-size") == 0 && i + 1 < argc)
+        {
+            config.btb_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--btb-ways") == 0 && i + 1 < argc)
+        {
+            btb_ways = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--btb-policy") == 0 && i + 1 < argc
+                 && (config.btb_policy = APEX_btb_parse_policy(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--no-forwarding") == 0)
+        {
+            config.forwarding = FALSE;
+        }
+        else if (strcmp(argv[i], "--mul-latency") == 0 && i + 1 < argc)
+        {
+            config.mul_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--div-latency") == 0 && i + 1 < argc)
+        {
+            config.div_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mem-latency") == 0 && i + 1 < argc)
+        {
+            config.mem_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1d-size") == 0 && i + 1 < argc)
+        {
+            config.l1d.size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1d-ways") == 0 && i + 1 < argc)
+        {
+            config.l1d.ways = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1d-line") == 0 && i + 1 < argc)
+        {
+            config.l1d.line_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1d-latency") == 0 && i + 1 < argc)
+        {
+            config.l1d.hit_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1d-policy") == 0 && i + 1 < argc
+                 && (config.l1d.policy = APEX_cache_parse_policy(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--l1d-write-through") == 0)
+        {
+            config.l1d.write_back = FALSE;
+        }
+        else if (strcmp(argv[i], "--l1d-no-write-allocate") == 0)
+        {
+            config.l1d.write_allocate = FALSE;
+        }
+        else if (strcmp(argv[i], "--l1i-size") == 0 && i + 1 < argc)
+        {
+            config.l1i.size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1i-ways") == 0 && i + 1 < argc)
+        {
+            config.l1i.ways = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1i-line") == 0 && i + 1 < argc)
+        {
+            config.l1i.line_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1i-latency") == 0 && i + 1 < argc)
+        {
+            config.l1i.hit_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l1i-policy") == 0 && i + 1 < argc
+                 && (config.l1i.policy = APEX_cache_parse_policy(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--l1i-prefetch") == 0)
+        {
+            config.l1i_prefetch = TRUE;
+        }
+        else if (strcmp(argv[i], "--l2-size") == 0 && i + 1 < argc)
+        {
+            config.l2.size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l2-ways") == 0 && i + 1 < argc)
+        {
+            config.l2.ways = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l2-line") == 0 && i + 1 < argc)
+        {
+            config.l2.line_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l2-latency") == 0 && i + 1 < argc)
+        {
+            config.l2.hit_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--l2-policy") == 0 && i + 1 < argc
+                 && (config.l2.policy = APEX_cache_parse_policy(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--dram-banks") == 0 && i + 1 < argc)
+        {
+            config.dram.banks = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dram-row") == 0 && i + 1 < argc)
+        {
+            config.dram.row_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dram-cas") == 0 && i + 1 < argc)
+        {
+            config.dram.cas_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dram-activate") == 0 && i + 1 < argc)
+        {
+            config.dram.activate_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dram-precharge") == 0 && i + 1 < argc)
+        {
+            config.dram.precharge_latency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--dram-burst") == 0 && i + 1 < argc)
+        {
+            config.dram.burst_cycles = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stride-entries") == 0 && i + 1 < argc)
+        {
+            config.stride.entries = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stride-degree") == 0 && i + 1 < argc)
+        {
+            config.stride.degree = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stride-distance") == 0 && i + 1 < argc)
+        {
+            config.stride.distance = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--store-buffer") == 0 && i + 1 < argc)
+        {
+            config.store_buffer = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mshrs") == 0 && i + 1 < argc)
+        {
+            config.mshrs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bpred") == 0 && i + 1 < argc
+                 && (config.bpred = APEX_bpred_parse(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--ras-depth") == 0 && i + 1 < argc)
+        {
+            config.ras_depth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc
+                 && (config.backend = APEX_backend_parse(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--issue-width") == 0 && i + 1 < argc)
+        {
+            config.issue_width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fusion") == 0)
+        {
+            config.fusion = TRUE;
+        }
+        else if (strcmp(argv[i], "--ooo-width") == 0 && i + 1 < argc)
+        {
+            config.ooo_width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rob-size") == 0 && i + 1 < argc)
+        {
+            config.rob_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--iq-size") == 0 && i + 1 < argc)
+        {
+            config.iq_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--lsq-size") == 0 && i + 1 < argc)
+        {
+            config.lsq_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--phys-regs") == 0 && i + 1 < argc)
+        {
+            config.phys_regs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--alus") == 0 && i + 1 < argc)
+        {
+            config.fu_count[APEX_OOO_FU_ALU] = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--muls") == 0 && i + 1 < argc)
+        {
+            config.fu_count[APEX_OOO_FU_MUL] = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mem-ports") == 0 && i + 1 < argc)
+        {
+            config.fu_count[APEX_OOO_FU_MEM] = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bintrace") == 0 && i + 1 < argc)
+        {
+            bintrace_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--kanata") == 0 && i + 1 < argc)
+        {
+            kanata_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profile_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc
+                 && (trace.level = APEX_trace_parse_level(argv[i + 1])) >= 0)
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace-mask") == 0 && i + 1 < argc
+                 && APEX_trace_parse_mask(argv[i + 1], &trace.mask))
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace-cycles") == 0 && i + 1 < argc
+                 && APEX_trace_parse_range(argv[i + 1], &trace.first_cycle,
+                                           &trace.last_cycle))
+        {
+            i++;
+        }
+        else if (strcmp(argv[i], "--trace-pc") == 0 && i + 1 < argc
+                 && APEX_trace_parse_range(argv[i + 1], &trace.first_pc,
+                                           &trace.last_pc))
+        {
+            i++;
+        }
+        else if (strncmp(argv[i], "--", 2) != 0 && num_positional < 3)
+        {
+            positional[num_positional++] = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if ((num_positional != 1 && num_positional != 3)
+        || (restore_file && (functional || skip || btb_ways
+                             || memcmp(&config, &defaults, sizeof(config)) != 0))
+        || (checkpoint_file && !skip && num_positional != 3)
+        || (simpoint_interval && (num_positional != 1 || functional || skip
+                                  || restore_file || checkpoint_file))
+        || ((bintrace_file || kanata_file || profile_file)
+            && (functional || simpoint_interval))
+        || ((kanata_file || profile_file)
+            && (config.backend == APEX_BACKEND_OOO || config.issue_width > 1
+                || config.fusion))
+        || simpoint_max_k < 1)
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    /* Without --btb-ways the BTB is fully associative */
+    config.btb_ways = btb_ways ? btb_ways : config.btb_size;
+    if (APEX_config_check(&config, config_error, sizeof(config_error)) != 0)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        fprintf(stderr, "APEX_Error: Invalid configuration, %s\n", config_error);
         exit(1);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
+    cpu = APEX_cpu_init(positional[0]);
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
-    if( argc>2 && argc == 4)
+    if (APEX_cpu_configure(cpu, &config) != 0)
+    {
+        fprintf(stderr, "APEX_Error: Out of memory for the caches\n");
+        APEX_cpu_stop(cpu);
+        exit(1);
+    }
+    cpu->trace = trace;
+    APEX_cpu_print_program(cpu);
+    if (kanata_file)
+    {
+        cpu->kanata = APEX_kanata_open(kanata_file);
+        if (!cpu->kanata)
+        {
+            APEX_cpu_stop(cpu);
+            exit(1);
+        }
+    }
+    if (restore_file)
+    {
+        if (APEX_cpu_restore(cpu, restore_file) != 0)
+        {
+            APEX_cpu_stop(cpu);
+            exit(1);
+        }
+        printf("APEX_CPU: Restored %s at cycle %llu, PC %d\n", restore_file,
+               (unsigned long long)cpu->clock, cpu->pc);
+    }
+
+    /* After the restore, which replaces the configuration the trace follows */
+    if (bintrace_file)
+    {
+        cpu->bintrace = APEX_bintrace_open(bintrace_file, 0,
+                                           APEX_cpu_display_pipes(cpu));
+        if (!cpu->bintrace)
+        {
+            APEX_cpu_stop(cpu);
+            exit(1);
+        }
+    }
+
+    /* After the restore, which replaces the counters the profile follows */
+    if (profile_file)
+    {
+        cpu->profile = APEX_profile_open(profile_file, cpu);
+        if (!cpu->profile)
+        {
+            APEX_cpu_stop(cpu);
+            exit(1);
+        }
+    }
+    if (simpoint_interval)
+    {
+        int status = APEX_simpoint_run(cpu, simpoint_interval, simpoint_max_k);
+
+        APEX_cpu_stop(cpu);
+        return status ? 1 : 0;
+    }
+    if (functional)
     {
-        
-        APEX_cpu_simulate(cpu,atoi(argv[3]),argv[2]);
+        run_functional(cpu);
         APEX_cpu_stop(cpu);
         return 0;
     }
+    if (skip)
+    {
+        uint64_t executed = 0;
+
+        if (APEX_cpu_fast_forward(cpu, skip, &executed))
+        {
+            APEX_cpu_print_fault(cpu);
+            printf("APEX_CPU: Program halted after %llu fast-forwarded instructions\n",
+                   (unsigned long long)executed);
+            APEX_cpu_stop(cpu);
+            return 0;
+        }
+        printf("APEX_CPU: Fast-forwarded %llu instructions, pipeline starts at PC %d\n",
+               (unsigned long long)executed, cpu->pc);
+
+        if (checkpoint_file && num_positional == 1)
+        {
+            int status = APEX_cpu_checkpoint(cpu, checkpoint_file);
+
+            APEX_cpu_stop(cpu);
+            return status ? 1 : 0;
+        }
+    }
+    if (num_positional == 3)
+    {
+        int status = 0;
+
+        APEX_cpu_simulate(cpu, atoi(positional[2]), positional[1]);
+        if (checkpoint_file)
+        {
+            status = APEX_cpu_checkpoint(cpu, checkpoint_file);
+        }
+        APEX_cpu_stop(cpu);
+        return status ? 1 : 0;
+    }
     APEX_cpu_run(cpu);
     APEX_cpu_stop(cpu);
     return 0;
-}
\ No newline at end of file
+}